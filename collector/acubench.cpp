@@ -0,0 +1,234 @@
+/**
+ * Loopback benchmark for the collector: runs it with 1, 2, 4, ... receive
+ * threads and each receive loop against the same load from many nodes, and
+ * reports the receive rate, system calls per datagram and latency from send
+ * to ingest of each. Reader threads can snapshot the latest-value table
+ * meanwhile.
+ *
+ * Usage: acubench [-p port] [-t threads] [-n datagrams] [-s senders]
+ *                 [-m nodes] [-d devices] [-k payloads] [-r readers]
+ *                 [-w log] [-y]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "loadgen.h"
+
+#define BENCH_LATENCIES     (1 << 20)       // Probe latencies kept per run
+
+/* Probes of the run in progress, see LoadConfig::probes. */
+static std::atomic<uint64_t> *probes;
+static uint32_t probe_first;                // Source address of sender 0's first node
+static int probe_nodes;
+static int probe_senders;
+static std::atomic<uint64_t> probes_seen;   // Not counted as load received
+static uint64_t *latencies;
+static std::atomic<size_t> latency_count;
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acubench [-p port] [-t threads] [-n datagrams] [-s senders]\n"
+        "                [-m nodes] [-d devices] [-k payloads] [-r readers]\n"
+        "                [-w log] [-y]\n"
+        "  -p port      loopback port (default %u)\n"
+        "  -t threads   most receive threads to try (default: all cores)\n"
+        "  -n count     datagrams per run (default 2000000)\n"
+        "  -s senders   sender threads (default 16)\n"
+        "  -m nodes     nodes per sender, each its own source address (default 128)\n"
+        "  -d devices   devices per node (default 2)\n"
+        "  -k payloads  payloads per datagram (default 1)\n"
+        "  -r readers   threads reading the latest-value table during each run (default 0)\n"
+        "  -w log       also append readings to log.<thread>\n"
+        "  -y           fdatasync the log after every write\n", COLLECTOR_PORT + 1);
+    exit(1);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Collector handler: times each probe from its send to its ingest. */
+static void time_probe(uint32_t node, const Payload& payload, uint64_t) {
+    if (payload.device != LOAD_PROBE_DEVICE)
+        return;
+    probes_seen++;
+    uint32_t sender = (node - probe_first) / probe_nodes;
+    if (sender >= (uint32_t)probe_senders)
+        return;
+    uint64_t sent = probes[sender].exchange(0);
+    if (!sent)
+        return;
+    size_t i = latency_count++;
+    if (i < BENCH_LATENCIES)
+        latencies[i] = load_now_ns() - sent;
+}
+
+/** @return the q quantile of the first count sorted latencies, in microseconds */
+static double quantile(size_t count, double q) {
+    if (count == 0)
+        return 0;
+    size_t i = std::min(count - 1, (size_t)(q * count));
+    return latencies[i] / 1e3;
+}
+
+/**
+ * Sends the load to a collector with the given number of threads, while
+ * readers walk the latest-value table taking snapshots of every device.
+ *
+ * @return false if the collector could not be started
+ */
+static bool bench(CollectorConfig config, LoadConfig load, int senders, int readers) {
+    Collector collector(config);
+    if (!collector.open_sockets()) {
+        perror("collector");
+        return false;
+    }
+    collector.start();
+    for (int i = 0; i < senders; i++)
+        probes[i] = 0;
+    latency_count = 0;
+    probes_seen = 0;
+    std::atomic<bool> sending(true);
+    std::atomic<uint64_t> reads(0);
+    std::vector<std::thread> reader_threads;
+    for (int i = 0; i < readers; i++) {
+        reader_threads.emplace_back([&]() {
+            uint64_t n = 0, key;
+            DeviceState state;
+            while (sending) {
+                for (size_t index = 0; index < collector.latest.capacity; index++)
+                    n += collector.latest.read_entry(index, key, state);
+            }
+            reads += n;
+        });
+    }
+    double t0 = now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < senders; i++)
+        threads.emplace_back([&, i]() { load_send(load, i); });
+    for (std::thread& thread : threads)
+        thread.join();
+    double sent = now();
+    sending = false;
+    for (std::thread& thread : reader_threads)
+        thread.join();
+
+    /* Received until the counters stop moving. */
+    CollectorStats stats = collector.stats();
+    double last = now();
+    while (now() - last < 0.1) {
+        usleep(10000);
+        CollectorStats next = collector.stats();
+        if (next.readings != stats.readings) {
+            stats = next;
+            last = now();
+        }
+    }
+    size_t devices = collector.device_count();
+    collector.stop();
+    collector.wait();
+    uint64_t total = load.datagrams * senders;
+    uint64_t received = stats.datagrams - probes_seen;
+    size_t timed = std::min(latency_count.load(), (size_t)BENCH_LATENCIES);
+    std::sort(latencies, latencies + timed);
+    printf("%-8s %7d %12.0f %12.0f %11.2f%% %8.1f %8zu %12.0f %9.3f %8.0f %8.0f %8.0f\n",
+            config.backend == COLLECTOR_URING ? "io_uring" : "epoll", config.threads,
+            total / (sent - t0), received / (last - t0),
+            100.0 * (total - received) / total,
+            stats.batches ? (double)stats.datagrams / stats.batches : 0.0, devices,
+            reads / (sent - t0), stats.datagrams ? (double)stats.syscalls / stats.datagrams : 0.0,
+            quantile(timed, 0.5), quantile(timed, 0.99), quantile(timed, 0.999));
+    return true;
+}
+
+int main(int argc, char **argv) {
+    CollectorConfig config;
+    LoadConfig load;
+    int threads = std::thread::hardware_concurrency();
+    uint64_t datagrams = 2000000;
+    int senders = 16;
+    int readers = 0;
+    int opt;
+    config.address = "127.0.0.1";
+    config.port = COLLECTOR_PORT + 1;
+    load.source = "127.0.1.1";
+    load.nodes = 128;
+    load.devices = 2;
+    while ((opt = getopt(argc, argv, "p:t:n:s:m:d:k:r:w:y")) != -1) {
+        switch (opt) {
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                datagrams = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                senders = atoi(optarg);
+                break;
+            case 'm':
+                load.nodes = atoi(optarg);
+                break;
+            case 'd':
+                load.devices = atoi(optarg);
+                break;
+            case 'k':
+                load.payloads = atoi(optarg);
+                break;
+            case 'r':
+                readers = atoi(optarg);
+                break;
+            case 'w':
+                config.log = optarg;
+                break;
+            case 'y':
+                config.sync = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (threads < 1 || senders < 1 || load.nodes < 1 || load.devices < 1 || readers < 0 || load.payloads < 1 ||
+            load.payloads * sizeof(Payload) > COLLECTOR_MTU)
+        usage();
+    load.port = config.port;
+    load.datagrams = datagrams / senders;
+
+    /* Every device and each sender's probe device, in a table at most half full. */
+    size_t devices = (size_t)senders * load.nodes * load.devices + senders;
+    while (config.devices < devices * 2)
+        config.devices *= 2;
+    struct in_addr source;
+    inet_pton(AF_INET, load.source, &source);
+    probes = new std::atomic<uint64_t>[senders];
+    probe_first = ntohl(source.s_addr);
+    probe_nodes = load.nodes;
+    probe_senders = senders;
+    latencies = new uint64_t[BENCH_LATENCIES];
+    load.probes = probes;
+    config.handler = time_probe;
+
+    printf("backend  threads       sent/s   received/s     dropped  per batch  devices      reads/s"
+            " calls/dgram   p50 us   p99 us  p999 us\n");
+    for (int t = 1; t <= threads; t *= 2) {
+        config.threads = t;
+        for (int backend : { COLLECTOR_EPOLL, COLLECTOR_URING }) {
+            config.backend = backend;
+            if (!bench(config, load, senders, readers))
+                return 1;
+        }
+        if (t < threads && t * 2 > threads)
+            t = threads / 2;
+    }
+    return 0;
+}
@@ -0,0 +1,324 @@
+/**
+ * Collects readings sent by the nodes over UDP and writes each to stdout.
+ *
+ * Usage: acucollect [-a address] [-p port] [-t threads] [-k cpu] [-u]
+ *                   [-w log] [-y] [-m devices] [-l name] [-d dir [-g us] [-G bytes]]
+ *                   [-c ms] [-D ms] [-A rules] [-S secs] [-b] [-q]
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "collector.h"
+
+static Collector *collector;
+static bool binary = false;
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acucollect [-a address] [-p port] [-t threads] [-k cpu] [-u]\n"
+        "                  [-w log] [-y] [-m devices] [-l name] [-d dir [-g us] [-G bytes]]\n"
+        "                  [-c ms] [-D ms] [-A rules] [-S secs] [-b] [-q]\n"
+        "  -a address  IPv4 address to listen on (default 0.0.0.0)\n"
+        "  -p port     UDP port (default %u)\n"
+        "  -t threads  receive threads, each with its own SO_REUSEPORT socket (default 1)\n"
+        "  -k cpu      pin receive thread i to cpu + i\n"
+        "  -u          receive with io_uring instead of recvmmsg and epoll\n"
+        "  -w log      append readings to log.<thread>\n"
+        "  -y          fdatasync the log after every write\n"
+        "  -m devices  size of the latest-value table (default %u)\n"
+        "  -l name     share the latest-value table as POSIX shared memory, e.g. %s\n"
+        "  -d dir      store readings and their rollups in dir, behind a write-ahead log\n"
+        "  -g us       longest wait before a write-ahead log commit (default %u)\n"
+        "  -G bytes    commit the write-ahead log once this much is waiting (default %u)\n"
+        "  -c ms       combine raw words the nodes forward for one transmission within ms\n"
+        "  -D ms       drop copies of a reading heard through several nodes within ms\n"
+        "  -A rules    raise alerts from this rules file, written with the readings\n"
+        "  -S secs     report receive rates every secs seconds\n"
+        "  -b          write raw 14-byte payloads instead of text\n"
+        "  -q          do not write readings\n", COLLECTOR_PORT, LATEST_DEVICES, LATEST_SHM,
+        WAL_COMMIT_US, WAL_COMMIT_BYTES);
+    exit(1);
+}
+
+static void on_signal(int) {
+    collector->stop();
+}
+
+static void print_reading(uint32_t node, const Payload& p, uint64_t) {
+    if (binary) {
+        fwrite(&p, sizeof(p), 1, stdout);
+        return;
+    }
+    printf("node=%u.%u.%u.%u model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f\n",
+            node >> 24, (node >> 16) & 0xff, (node >> 8) & 0xff, node & 0xff,
+            p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0);
+}
+
+/* Alerts go out as soon as they are raised, whatever the buffering of readings. */
+static void print_alert(const Alert& a) {
+    const AlertRule& rule = *a.rule;
+    uint32_t node = a.key >> 32;
+    double value = rule.kind == ALERT_MISSING || rule.field == ALERT_BATTERY ? a.value : a.value / 10.0;
+    printf("alert=%s state=%s node=%u.%u.%u.%u model=%u device=%u %s=%g\n",
+            rule.name, a.firing ? "raised" : "cleared", node >> 24, (node >> 16) & 0xff, (node >> 8) & 0xff, node & 0xff,
+            (unsigned)(a.key >> 16) & 0xffff, (unsigned)a.key & 0xffff,
+            rule.kind == ALERT_MISSING ? "silent" : rule.kind == ALERT_RATE ? "rate" :
+            rule.field == ALERT_TEMPERATURE ? "temperature" : rule.field == ALERT_HUMIDITY ? "humidity" : "battery",
+            value);
+    fflush(stdout);
+}
+
+static void report_stats(Collector& c, double secs) {
+    static CollectorStats last;
+    CollectorStats stats = c.stats();
+    fprintf(stderr, "collector: %.0f datagrams/s, %.0f readings/s, %.1f datagrams/batch, %lu invalid, %lu dropped\n",
+            (stats.datagrams - last.datagrams) / secs, (stats.readings - last.readings) / secs,
+            stats.batches ? (double)stats.datagrams / stats.batches : 0.0,
+            (unsigned long)stats.invalid, (unsigned long)stats.dropped);
+    last = stats;
+}
+
+int main(int argc, char **argv) {
+    CollectorConfig config;
+    BitstreamValidator validator;
+    config.handler = print_reading;
+    config.validator = &validator;
+    const char *shared = NULL;
+    StoreConfig store_config;
+    WalConfig wal_config;
+    int combine_ms = 0;
+    int dedup_ms = 0;
+    const char *rules_path = NULL;
+    std::vector<AlertRule> rules;
+    int report = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:t:k:uw:ym:l:d:g:G:c:D:A:S:bq")) != -1) {
+        switch (opt) {
+            case 'a':
+                config.address = optarg;
+                break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'k':
+                config.cpu = atoi(optarg);
+                break;
+            case 'u':
+                config.backend = COLLECTOR_URING;
+                break;
+            case 'w':
+                config.log = optarg;
+                break;
+            case 'y':
+                config.sync = true;
+                break;
+            case 'm':
+                config.devices = strtoul(optarg, NULL, 10);
+                break;
+            case 'l':
+                shared = optarg;
+                break;
+            case 'd':
+                store_config.path = optarg;
+                break;
+            case 'g':
+                wal_config.commit_us = strtoul(optarg, NULL, 10);
+                break;
+            case 'G':
+                wal_config.commit_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'c':
+                combine_ms = atoi(optarg);
+                break;
+            case 'D':
+                dedup_ms = atoi(optarg);
+                break;
+            case 'A':
+                rules_path = optarg;
+                break;
+            case 'S':
+                report = atoi(optarg);
+                break;
+            case 'b':
+                binary = true;
+                break;
+            case 'q':
+                config.handler = NULL;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (config.threads < 1 || config.devices < 1 || wal_config.commit_bytes < 1)
+        usage();
+    if (combine_ms > 0)
+        config.combiner = new Combiner(&validator, combine_ms);
+    if (dedup_ms > 0)
+        config.dedup = new DedupSet(DEDUP_SLOTS, dedup_ms);
+    if (rules_path) {
+        int line;
+        if (!alert_load(rules_path, rules, &line, !config.dedup)) {
+            if (line && errno == EOPNOTSUPP)
+                fprintf(stderr, "%s:%d: rule names a node, but -D takes readings from node 0\n", rules_path, line);
+            else if (line)
+                fprintf(stderr, "%s:%d: bad rule\n", rules_path, line);
+            else
+                perror(rules_path);
+            return 1;
+        }
+        config.rules = &rules;
+        config.alert_handler = print_alert;
+    }
+    Store *store = NULL;
+    Rollups *rollups = NULL;
+    Wal *wal = NULL;
+    if (store_config.path) {
+        store = new Store(store_config);
+        rollups = new Rollups(store_config.path);
+        if (!store->open() || !rollups->open()) {
+            fprintf(stderr, "%s: %s\n", store_config.path, strerror(errno));
+            return 1;
+        }
+        /*
+         * Whatever the last run logged but did not checkpoint goes back in
+         * the store first, apart from what reached the segments anyway.
+         */
+        wal_config.path = store_config.path;
+        wal_config.replay_threads = config.threads;
+        wal = new Wal(wal_config);
+        std::unordered_map<uint64_t, StoreTail> tails;
+        if (wal->pending() && !store->tails(tails)) {
+            fprintf(stderr, "%s: %s\n", store_config.path, strerror(errno));
+            return 1;
+        }
+        rollups->recover(wal->pending());
+        uint64_t resolution = store_config.resolution_ns;
+        bool opened = wal->open([&](const Reading& r) {
+            /* Each device is replayed by one thread, in order. */
+            uint64_t key = device_key(r.node, r.payload.model, r.payload.device);
+            rollups->add(key, r.ns, r.payload);
+            auto it = tails.find(key);
+            if (it != tails.end()) {
+                uint64_t ns = r.ns - r.ns % resolution;
+                if (ns < it->second.ns)
+                    return;
+                if (ns == it->second.ns && it->second.count > 0) {
+                    it->second.count--;
+                    return;
+                }
+            }
+            store->append(key, r.ns, r.payload);
+        }, [&]() { return store->flush() && rollups->flush(); });
+        if (!opened) {
+            fprintf(stderr, "%s: %s\n", store_config.path, strerror(errno));
+            return 1;
+        }
+        rollups->recover(false);
+        if (wal->stats().replayed)
+            fprintf(stderr, "wal: replayed %lu readings\n", (unsigned long)wal->stats().replayed);
+        config.store = store;
+        config.rollups = rollups;
+        config.wal = wal;
+    }
+    collector = new Collector(config);
+    if (!collector->open_sockets()) {
+        fprintf(stderr, "%s:%u: %s\n", config.address, config.port, strerror(errno));
+        return 1;
+    }
+    if (shared && !collector->latest.share(shared)) {
+        fprintf(stderr, "%s: %s\n", shared, strerror(errno));
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    std::mutex lock;
+    std::condition_variable done;
+    bool finished = false;
+    std::thread reporter([&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (report > 0 && !done.wait_for(guard, std::chrono::seconds(report), [&]() { return finished; }))
+            report_stats(*collector, report);
+    });
+    std::thread checker([&]() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (config.rules && !done.wait_for(guard, std::chrono::milliseconds(ALERT_TICK_MS), [&]() { return finished; })) {
+            guard.unlock();
+            collector->check_alerts();
+            guard.lock();
+        }
+    });
+    collector->start();
+    bool ok = collector->wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+    }
+    done.notify_all();
+    reporter.join();
+    checker.join();
+    fflush(stdout);
+    CollectorStats stats = collector->stats();
+    fprintf(stderr, "collector: %lu datagrams, %lu readings from %zu devices, %lu invalid, %lu dropped\n",
+            (unsigned long)stats.datagrams, (unsigned long)stats.readings, collector->device_count(),
+            (unsigned long)stats.invalid, (unsigned long)stats.dropped);
+    if (config.combiner) {
+        CombineStats c = config.combiner->stats();
+        fprintf(stderr, "collector: %lu readings recovered from %lu raw words, %lu more copies of them\n",
+                (unsigned long)c.combined, (unsigned long)c.words, (unsigned long)c.late);
+    }
+    if (stats.forwarded)
+        fprintf(stderr, "collector: %lu readings validated from thin nodes' raw frames\n",
+                (unsigned long)stats.forwarded);
+    if (config.dedup)
+        fprintf(stderr, "collector: %lu copies heard through other nodes dropped\n", (unsigned long)stats.duplicates);
+    if (config.rules)
+        fprintf(stderr, "collector: %lu alerts raised\n", (unsigned long)stats.alerts);
+    if (stats.untracked)
+        fprintf(stderr, "collector: %lu readings of devices beyond the table, see -m\n",
+                (unsigned long)stats.untracked);
+    delete collector;
+    delete config.dedup;
+    delete config.combiner;
+    if (wal) {
+        if (!wal->close()) {
+            perror(store_config.path);
+            ok = false;
+        }
+        WalStats w = wal->stats();
+        fprintf(stderr, "wal: %lu readings in %lu commits, %.2f ms mean and %.2f ms max commit latency, %lu failed\n",
+                (unsigned long)w.readings, (unsigned long)w.commits,
+                w.commits ? w.latency_ns / 1e6 / w.commits : 0.0, w.max_latency_ns / 1e6,
+                (unsigned long)stats.unlogged);
+        delete wal;
+    }
+    if (store) {
+        if (!store->flush() || !rollups->flush()) {
+            perror(store_config.path);
+            ok = false;
+        }
+        StoreStats s = store->stats();
+        fprintf(stderr, "store: %lu readings in %lu blocks, %lu bytes, %.2f bytes/reading, %lu failed, %lu lost\n",
+                (unsigned long)s.readings, (unsigned long)s.blocks, (unsigned long)s.bytes,
+                s.readings ? (double)s.bytes / s.readings : 0.0, (unsigned long)stats.unstored,
+                (unsigned long)s.lost);
+        if (stats.unrolled)
+            fprintf(stderr, "rollups: %lu readings failed\n", (unsigned long)stats.unrolled);
+        delete rollups;
+        delete store;
+    }
+    return ok ? 0 : 1;
+}
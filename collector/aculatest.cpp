@@ -0,0 +1,75 @@
+/**
+ * Prints the latest reading of every device from the shared memory segment
+ * of a running collector (acucollect -l), without talking to it.
+ *
+ * Usage: aculatest [-l name] [-i secs]
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "latestreader.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: aculatest [-l name] [-i secs]\n"
+        "  -l name   shared memory name (default %s)\n"
+        "  -i secs   print again every secs seconds\n", LATEST_SHM);
+    exit(1);
+}
+
+static void print_table(const LatestReader& reader) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    for (size_t index = 0; index < reader.capacity; index++) {
+        uint64_t key;
+        DeviceState state;
+        if (!reader.read_entry(index, key, state))
+            continue;
+        uint32_t node = key >> 32;
+        const Payload& p = state.latest;
+        printf("node=%u.%u.%u.%u model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f readings=%lu age=%.1fs\n",
+                node >> 24, (node >> 16) & 0xff, (node >> 8) & 0xff, node & 0xff,
+                p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0,
+                (unsigned long)state.readings, now > state.last_ns ? (now - state.last_ns) / 1e9 : 0.0);
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *name = LATEST_SHM;
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:i:")) != -1) {
+        switch (opt) {
+            case 'l':
+                name = optarg;
+                break;
+            case 'i':
+                interval = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+
+    LatestReader reader;
+    if (!reader.open(name)) {
+        fprintf(stderr, "%s: %s\n", name, strerror(errno));
+        return 1;
+    }
+    for (;;) {
+        print_table(reader);
+        if (interval <= 0)
+            break;
+        fflush(stdout);
+        sleep(interval);
+        /* The collector restarted: follow it to its new segment. */
+        while (reader.closed() && !reader.open(name))
+            sleep(1);
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * Load generator for the collector: sends Payload datagrams from one or more
+ * senders as fast as possible (or at a fixed rate) and reports the send rate.
+ * Each sender is a thread with its own socket, standing in for one node, or
+ * with a source address for -m nodes of consecutive addresses.
+ *
+ * Usage: acuload [-a address] [-p port] [-n datagrams] [-s senders]
+ *                [-d devices] [-k payloads] [-r rate] [-b source] [-m nodes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "loadgen.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acuload [-a address] [-p port] [-n datagrams] [-s senders]\n"
+        "               [-d devices] [-k payloads] [-r rate] [-b source] [-m nodes]\n"
+        "  -a address   collector address (default 127.0.0.1)\n"
+        "  -p port      collector port (default %u)\n"
+        "  -n count     datagrams per sender (default 1000000)\n"
+        "  -s senders   sender threads, each with its own socket (default 1)\n"
+        "  -d devices   devices per node (default 8)\n"
+        "  -k payloads  payloads per datagram (default 1)\n"
+        "  -r rate      datagrams per second per sender, 0 for no limit (default 0)\n"
+        "  -b source    send from source + i, e.g. 127.0.1.1, for sender i, so that\n"
+        "               each shows up as its own node on loopback\n"
+        "  -m nodes     with -b, sender i sends from nodes addresses in turn,\n"
+        "               source + i * nodes on (default 1)\n", COLLECTOR_PORT);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    LoadConfig config;
+    int senders = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:n:s:d:k:r:b:m:")) != -1) {
+        switch (opt) {
+            case 'a':
+                config.address = optarg;
+                break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 'n':
+                config.datagrams = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                senders = atoi(optarg);
+                break;
+            case 'd':
+                config.devices = atoi(optarg);
+                break;
+            case 'k':
+                config.payloads = atoi(optarg);
+                break;
+            case 'r':
+                config.rate = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                config.source = optarg;
+                break;
+            case 'm':
+                config.nodes = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (senders < 1 || config.nodes < 1 || config.devices < 1 || config.payloads < 1 ||
+            config.payloads * sizeof(Payload) > COLLECTOR_MTU)
+        usage();
+
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> sent(0);
+    std::atomic<bool> failed(false);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < senders; i++) {
+        threads.emplace_back([&, i]() {
+            int64_t n = load_send(config, i);
+            if (n < 0) {
+                perror("sendmmsg");
+                failed = true;
+            }
+            else
+                sent += n;
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "acuload: %lu datagrams (%lu readings) in %.2fs, %.0f datagrams/s\n",
+            (unsigned long)sent, (unsigned long)sent * config.payloads, secs, sent / secs);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,203 @@
+/**
+ * Queries a store for the readings in a time range that match ranges of
+ * temperature, humidity and battery and a set of statuses, scanning its
+ * segments on several threads. Prints the readings, or only counts them.
+ *
+ * Usage: acuquery -d dir [-j threads] [-c] [-V] [-f from] [-t to] [-n node -m model -e device]
+ *                 [-T min:max] [-H min:max] [-b min:max] [-s status,...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "collector.h"
+#include "query.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acuquery -d dir [-j threads] [-c] [-V] [-f from] [-t to] [-n node -m model -e device]\n"
+        "                [-T min:max] [-H min:max] [-b min:max] [-s status,...]\n"
+        "  -d dir      store directory\n"
+        "  -j threads  scan threads (default %ld, 0 for the calling thread alone)\n"
+        "  -c          only count the readings\n"
+        "  -V          run the query again on the calling thread alone and fail\n"
+        "              unless it finds the same readings\n"
+        "  -f from     first time, in seconds since the epoch\n"
+        "  -t to       last time, in seconds since the epoch\n"
+        "  -n node     only this node (IPv4 address), with -m and -e\n"
+        "  -m model    only this model\n"
+        "  -e device   only this device\n"
+        "  -T min:max  temperature range in degrees C, STATUS_OK readings only\n"
+        "  -H min:max  humidity range in percent, STATUS_OK readings only\n"
+        "  -b min:max  battery range\n"
+        "  -s status   only these statuses, separated by commas\n", sysconf(_SC_NPROCESSORS_ONLN));
+    exit(1);
+}
+
+/** Parses min:max in tenths, either side left empty for no limit. */
+static void parse_tenths(const char *arg, int16_t& min, int16_t& max) {
+    const char *colon = strchr(arg, ':');
+    if (!colon)
+        usage();
+    if (colon > arg)
+        min = (int16_t)(atof(arg) * 10);
+    if (colon[1])
+        max = (int16_t)(atof(colon + 1) * 10);
+}
+
+static void parse_range(const char *arg, uint8_t& min, uint8_t& max) {
+    const char *colon = strchr(arg, ':');
+    if (!colon)
+        usage();
+    if (colon > arg)
+        min = atoi(arg);
+    if (colon[1])
+        max = atoi(colon + 1);
+}
+
+/** Hash of one reading, summed over a query's results whatever their order. */
+static uint64_t reading_hash(const Reading& r) {
+    uint64_t words[4] = { r.ns, r.node, 0, 0 };
+    memcpy(&words[2], (const uint8_t *)&r.payload + sizeof(r.payload.tag), sizeof(r.payload) - sizeof(r.payload.tag));
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (uint64_t w : words) {
+        h ^= w;
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static uint8_t parse_statuses(char *arg) {
+    uint8_t statuses = 0;
+    for (char *s = strtok(arg, ","); s; s = strtok(NULL, ",")) {
+        int status = atoi(s);
+        if (status < 0 || status > 7)
+            usage();
+        statuses |= 1 << status;
+    }
+    return statuses;
+}
+
+int main(int argc, char **argv) {
+    StoreConfig config;
+    QueryFilter filter;
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool count = false;
+    bool verify = false;
+    double from = 0, to = 0;
+    const char *node = NULL;
+    int model = -1, device = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:j:cVf:t:n:m:e:T:H:b:s:")) != -1) {
+        switch (opt) {
+            case 'd':
+                config.path = optarg;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'c':
+                count = true;
+                break;
+            case 'V':
+                verify = true;
+                break;
+            case 'f':
+                from = atof(optarg);
+                break;
+            case 't':
+                to = atof(optarg);
+                break;
+            case 'n':
+                node = optarg;
+                break;
+            case 'm':
+                model = atoi(optarg);
+                break;
+            case 'e':
+                device = atoi(optarg);
+                break;
+            case 'T':
+                parse_tenths(optarg, filter.temperature_min, filter.temperature_max);
+                break;
+            case 'H':
+                parse_tenths(optarg, filter.humidity_min, filter.humidity_max);
+                break;
+            case 'b':
+                parse_range(optarg, filter.battery_min, filter.battery_max);
+                break;
+            case 's':
+                filter.statuses = parse_statuses(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (!config.path || threads < 0 || optind != argc)
+        usage();
+    if ((node != NULL) != (model >= 0) || (node != NULL) != (device >= 0))
+        usage();
+    if (node) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, node, &addr) != 1)
+            usage();
+        filter.key = device_key(ntohl(addr.s_addr), model, device);
+    }
+    filter.from_ns = (uint64_t)(from * 1e9);
+    if (to > 0)
+        filter.to_ns = (uint64_t)(to * 1e9);
+
+    Store store(config);
+    QueryEngine engine(&store, threads);
+    QueryStats stats;
+    uint64_t sum = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool ok = engine.run(filter, [&](const Reading *readings, size_t n) {
+        for (size_t i = 0; verify && i < n; i++)
+            sum += reading_hash(readings[i]);
+        if (count)
+            return;
+        for (size_t i = 0; i < n; i++) {
+            const Reading& r = readings[i];
+            const Payload& p = r.payload;
+            printf("time=%.3f node=%u.%u.%u.%u model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f\n",
+                    r.ns / 1e9, r.node >> 24, (r.node >> 16) & 0xff, (r.node >> 8) & 0xff, r.node & 0xff,
+                    p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0);
+        }
+    }, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (!ok) {
+        perror(config.path);
+        return 1;
+    }
+    if (count)
+        printf("%lu\n", (unsigned long)stats.readings);
+    fprintf(stderr, "acuquery: %lu readings, %lu blocks, %lu skipped on their header, %lu decoded, %.1f ms\n",
+            (unsigned long)stats.readings, (unsigned long)stats.blocks, (unsigned long)stats.skipped,
+            (unsigned long)stats.decoded,
+            (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    if (verify) {
+        QueryEngine serial(&store, 0);
+        QueryStats check;
+        uint64_t check_sum = 0;
+        if (!serial.run(filter, [&](const Reading *readings, size_t n) {
+            for (size_t i = 0; i < n; i++)
+                check_sum += reading_hash(readings[i]);
+        }, &check)) {
+            perror(config.path);
+            return 1;
+        }
+        if (check.readings != stats.readings || check_sum != sum) {
+            fprintf(stderr, "acuquery: %d threads found %lu readings, the calling thread alone %lu%s\n",
+                    threads, (unsigned long)stats.readings, (unsigned long)check.readings,
+                    check.readings == stats.readings ? ", not the same ones" : "");
+            return 1;
+        }
+        fprintf(stderr, "acuquery: the calling thread alone found the same readings\n");
+    }
+    return 0;
+}
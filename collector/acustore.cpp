@@ -0,0 +1,180 @@
+/**
+ * Imports reading logs written by acucollect -w into a columnar store and
+ * its rollups, prints the readings of a store, or prints the min, mean, max
+ * and last reading of one device over steps of a time range.
+ *
+ * Usage: acustore -d dir [-r ms] log...
+ *        acustore -d dir -p [-f from] [-t to] [-n node -m model -e device]
+ *        acustore -d dir -a step -f from -t to -n node -m model -e device
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "collector.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acustore -d dir [-r ms] log...\n"
+        "       acustore -d dir -p [-f from] [-t to] [-n node -m model -e device]\n"
+        "       acustore -d dir -a step -f from -t to -n node -m model -e device\n"
+        "  -d dir      store directory\n"
+        "  -r ms       timestamp resolution of new blocks (default %llu)\n"
+        "  -p          print readings instead of importing\n"
+        "  -a step     print aggregates over steps of this many seconds instead\n"
+        "  -f from     first time to print, in seconds since the epoch\n"
+        "  -t to       last time to print, in seconds since the epoch\n"
+        "  -n node     only this node (IPv4 address), with -m and -e\n"
+        "  -m model    only this model\n"
+        "  -e device   only this device\n", STORE_RESOLUTION / 1000000);
+    exit(1);
+}
+
+/** @return false with errno set if the log could not be read */
+static bool import_log(Store& store, Rollups& rollups, const char *path, uint64_t& count) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    Reading readings[1024];
+    size_t have = 0;
+    for (;;) {
+        ssize_t n = read(fd, (uint8_t *)readings + have, sizeof(readings) - have);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return n == 0;
+        }
+        have += n;
+        size_t whole = have / sizeof(Reading);
+        for (size_t i = 0; i < whole; i++) {
+            const Reading& r = readings[i];
+            uint64_t key = device_key(r.node, r.payload.model, r.payload.device);
+            if (!store.append(key, r.ns, r.payload) || !rollups.add(key, r.ns, r.payload)) {
+                close(fd);
+                return false;
+            }
+        }
+        count += whole;
+        have -= whole * sizeof(Reading);
+        memmove(readings, (uint8_t *)readings + whole * sizeof(Reading), have);
+    }
+}
+
+int main(int argc, char **argv) {
+    StoreConfig config;
+    bool print = false;
+    double from = 0, to = 0, step = 0;
+    const char *node = NULL;
+    int model = -1, device = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:r:pa:f:t:n:m:e:")) != -1) {
+        switch (opt) {
+            case 'd':
+                config.path = optarg;
+                break;
+            case 'r':
+                config.resolution_ns = strtoull(optarg, NULL, 10) * 1000000;
+                break;
+            case 'p':
+                print = true;
+                break;
+            case 'a':
+                step = atof(optarg);
+                break;
+            case 'f':
+                from = atof(optarg);
+                break;
+            case 't':
+                to = atof(optarg);
+                break;
+            case 'n':
+                node = optarg;
+                break;
+            case 'm':
+                model = atoi(optarg);
+                break;
+            case 'e':
+                device = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (!config.path || config.resolution_ns == 0 || (!print && step <= 0 && optind == argc))
+        usage();
+    if ((node != NULL) != (model >= 0) || (node != NULL) != (device >= 0))
+        usage();
+    if (step > 0 && (!node || from <= 0 || to <= from))
+        usage();
+
+    Store store(config);
+    Rollups rollups(config.path);
+    uint64_t key = 0;
+    if (node) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, node, &addr) != 1)
+            usage();
+        key = device_key(ntohl(addr.s_addr), model, device);
+    }
+    if (step > 0) {
+        int level;
+        bool ok = rollups.query(&store, key, (uint64_t)(from * 1e9), (uint64_t)(to * 1e9), (uint64_t)(step * 1e9),
+                [](const Aggregate& a) {
+            printf("time=%.3f count=%u temperature=%.1f/%.1f/%.1f humidity=%.1f/%.1f/%.1f last=%.3f status=%u battery=%u\n",
+                    a.start_ns / 1e9, a.count,
+                    a.valid ? a.temperature_min / 10.0 : 0.0, a.valid ? a.temperature_sum / 10.0 / a.valid : 0.0,
+                    a.valid ? a.temperature_max / 10.0 : 0.0,
+                    a.valid ? a.humidity_min / 10.0 : 0.0, a.valid ? a.humidity_sum / 10.0 / a.valid : 0.0,
+                    a.valid ? a.humidity_max / 10.0 : 0.0,
+                    a.last_ns / 1e9, a.last.status, a.last.battery);
+        }, &level);
+        if (!ok) {
+            perror(config.path);
+            return 1;
+        }
+        static const char *names[] = { "1m", "1h", "1d" };
+        fprintf(stderr, "acustore: from %s\n", level == ROLLUP_RAW ? "readings" : names[level]);
+        return 0;
+    }
+    if (print) {
+        uint64_t to_ns = to > 0 ? (uint64_t)(to * 1e9) : UINT64_MAX;
+        bool ok = store.scan((uint64_t)(from * 1e9), to_ns, key, [](uint64_t key, uint64_t ns, const Payload& p) {
+            uint32_t node = key >> 32;
+            printf("time=%.3f node=%u.%u.%u.%u model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f\n",
+                    ns / 1e9, node >> 24, (node >> 16) & 0xff, (node >> 8) & 0xff, node & 0xff,
+                    p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0);
+        });
+        if (!ok) {
+            perror(config.path);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (!store.open() || !rollups.open()) {
+        perror(config.path);
+        return 1;
+    }
+    uint64_t count = 0;
+    for (int i = optind; i < argc; i++) {
+        if (!import_log(store, rollups, argv[i], count)) {
+            perror(argv[i]);
+            return 1;
+        }
+    }
+    if (!store.flush() || !rollups.flush()) {
+        perror(config.path);
+        return 1;
+    }
+    StoreStats stats = store.stats();
+    fprintf(stderr, "acustore: %lu readings in %lu blocks, %lu bytes (%lu as logged), %.2f bytes/reading\n",
+            (unsigned long)stats.readings, (unsigned long)stats.blocks, (unsigned long)stats.bytes,
+            (unsigned long)(count * sizeof(Reading)), stats.readings ? (double)stats.bytes / stats.readings : 0.0);
+    return 0;
+}
@@ -0,0 +1,132 @@
+/**
+ * Benchmark for the write-ahead log: appender threads feed one log while
+ * the group commit latency is stepped from 0 up, and the throughput and
+ * commit latency of each step are reported. With -w every appender waits
+ * for its readings to be durable before going on, as a caller needing
+ * acknowledged writes would.
+ *
+ * Usage: acuwal -d dir [-t threads] [-s secs] [-k readings] [-G bytes] [-w]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "wal.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acuwal -d dir [-t threads] [-s secs] [-k readings] [-G bytes] [-w]\n"
+        "  -d dir       directory for the log files, emptied after each step\n"
+        "  -t threads   appender threads (default 4)\n"
+        "  -s secs      duration of each step (default 2)\n"
+        "  -k readings  readings per append (default 64)\n"
+        "  -G bytes     commit once this much is waiting (default %u)\n"
+        "  -w           wait for each append to be durable\n", WAL_COMMIT_BYTES);
+    exit(1);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @return false if the log could not be opened or written */
+static bool bench(WalConfig config, int threads, double secs, int batch, bool wait) {
+    Wal wal(config);
+    bool ok = wal.open([](const Reading&) {}, []() { return true; });
+    if (!ok) {
+        perror(config.path);
+        return false;
+    }
+    std::atomic<bool> running(true);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> appenders;
+    double t0 = now();
+    for (int t = 0; t < threads; t++) {
+        appenders.emplace_back([&, t]() {
+            std::vector<Reading> readings(batch);
+            for (uint64_t n = 0; running; n++) {
+                for (int i = 0; i < batch; i++) {
+                    Reading& r = readings[i];
+                    r.ns = n * batch + i;
+                    r.node = 0x0a000001 + t;
+                    r.payload.tag = TAG_TEMPMONITOR;
+                    r.payload.model = MODEL_ACURITE609;
+                    r.payload.device = i;
+                    r.payload.status = STATUS_OK;
+                    r.payload.battery = 3;
+                    r.payload.temperature = n % 600 - 200;
+                    r.payload.humidity = 400 + n % 200;
+                }
+                uint64_t sequence;
+                if (!wal.append(readings.data(), batch, &sequence) || (wait && !wal.wait(sequence))) {
+                    failed = true;
+                    return;
+                }
+            }
+        });
+    }
+    usleep(secs * 1e6);
+    running = false;
+    for (std::thread& thread : appenders)
+        thread.join();
+    ok = wal.close() && !failed;
+    double elapsed = now() - t0;
+    if (!ok) {
+        perror(config.path);
+        return false;
+    }
+    WalStats stats = wal.stats();
+    printf("%10u %14.0f %10.0f %12.3f %12.3f %12.1f\n",
+            config.commit_us, stats.readings / elapsed, stats.commits / elapsed,
+            stats.commits ? stats.latency_ns / 1e6 / stats.commits : 0.0, stats.max_latency_ns / 1e6,
+            stats.commits ? (double)stats.readings / stats.commits : 0.0);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    WalConfig config;
+    int threads = 4;
+    double secs = 2;
+    int batch = 64;
+    bool wait = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:s:k:G:w")) != -1) {
+        switch (opt) {
+            case 'd':
+                config.path = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 's':
+                secs = atof(optarg);
+                break;
+            case 'k':
+                batch = atoi(optarg);
+                break;
+            case 'G':
+                config.commit_bytes = strtoul(optarg, NULL, 10);
+                break;
+            case 'w':
+                wait = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (!config.path || threads < 1 || secs <= 0 || batch < 1 || config.commit_bytes < 1)
+        usage();
+
+    printf(" commit_us     readings/s  commits/s      mean ms       max ms   per commit\n");
+    for (uint32_t us : { 0, 100, 1000, 10000, 100000 }) {
+        config.commit_us = us;
+        if (!bench(config, threads, secs, batch, wait))
+            return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,299 @@
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "alert.h"
+#include "latest.h"
+
+static bool parse_number(const char *s, double& value) {
+    char *end;
+    if (!s)
+        return false;
+    value = strtod(s, &end);
+    return end != s && *end == '\0';
+}
+
+static bool parse_seconds(const char *s, uint64_t& ns) {
+    double secs;
+    if (!parse_number(s, secs) || secs < 0)
+        return false;
+    ns = (uint64_t)(secs * 1e9);
+    return true;
+}
+
+/** Parses a device, model/device or node/model/device, any part of which may be "*". */
+static bool parse_device(char *s, AlertRule& rule) {
+    char *parts[3], *save;
+    int n = 0;
+    for (char *part = strtok_r(s, "/", &save); part; part = strtok_r(NULL, "/", &save)) {
+        if (n == 3)
+            return false;
+        parts[n++] = part;
+    }
+    if (n < 2)
+        return false;
+    if (n == 3 && strcmp(parts[0], "*") != 0) {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, parts[0], &addr) != 1)
+            return false;
+        rule.node = ntohl(addr.s_addr);
+    }
+    int *fields[2] = { &rule.model, &rule.device };
+    for (int i = 0; i < 2; i++) {
+        const char *part = parts[n - 2 + i];
+        if (strcmp(part, "*") == 0)
+            continue;
+        char *end;
+        long value = strtol(part, &end, 10);
+        if (end == part || *end != '\0' || value < 0 || value > UINT16_MAX)
+            return false;
+        *fields[i] = value;
+    }
+    return true;
+}
+
+/** Parses the condition after the device, the rest of the line as left by strtok_r(). */
+static bool parse_condition(AlertRule& rule, char **save) {
+    const char *token = strtok_r(NULL, " \t", save);
+    if (!token)
+        return false;
+    if (strcmp(token, "missing") == 0) {
+        rule.kind = ALERT_MISSING;
+        return parse_seconds(strtok_r(NULL, " \t", save), rule.for_ns) && rule.for_ns > 0 &&
+                !strtok_r(NULL, " \t", save);
+    }
+    if (strcmp(token, "temperature") == 0)
+        rule.field = ALERT_TEMPERATURE;
+    else if (strcmp(token, "humidity") == 0)
+        rule.field = ALERT_HUMIDITY;
+    else if (strcmp(token, "battery") == 0)
+        rule.field = ALERT_BATTERY;
+    else
+        return false;
+    token = strtok_r(NULL, " \t", save);
+    if (token && strcmp(token, "rate") == 0) {
+        if (rule.field == ALERT_BATTERY)
+            return false;
+        rule.kind = ALERT_RATE;
+        token = strtok_r(NULL, " \t", save);
+    }
+    if (!token || (strcmp(token, ">") != 0 && strcmp(token, "<") != 0))
+        return false;
+    rule.above = token[0] == '>';
+    double limit;
+    if (!parse_number(strtok_r(NULL, " \t", save), limit))
+        return false;
+    rule.limit = (int32_t)lround(rule.field == ALERT_BATTERY ? limit : limit * 10);
+    while ((token = strtok_r(NULL, " \t", save))) {
+        if (strcmp(token, "for") == 0) {
+            if (!parse_seconds(strtok_r(NULL, " \t", save), rule.for_ns))
+                return false;
+        }
+        else if (strcmp(token, "over") == 0 && rule.kind == ALERT_RATE) {
+            if (!parse_seconds(strtok_r(NULL, " \t", save), rule.over_ns))
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Reads a rules file, one rule per line:
+ *
+ *   name device condition
+ *
+ * where device is model/device or node/model/device, any part "*", and
+ * condition is one of
+ *
+ *   field < limit [for secs]
+ *   field > limit [for secs]
+ *   field rate < limit [over secs] [for secs]
+ *   field rate > limit [over secs] [for secs]
+ *   missing secs
+ *
+ * with field temperature (degrees C), humidity (percent) or battery, and
+ * rates per minute. Blank lines and lines starting with # are skipped.
+ *
+ * @param line set to the line at fault, or 0 if the file could not be read
+ * @param nodes false to refuse rules that name a node, as for readings
+ *        that are deduplicated and so all come from node 0
+ * @return true on success, false with errno set on failure, EINVAL for a
+ *         line that does not parse, EOPNOTSUPP for a node refused
+ */
+bool alert_load(const char *path, std::vector<AlertRule>& rules, int *line, bool nodes) {
+    *line = 0;
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return false;
+    char text[256];
+    int n = 0;
+    while (fgets(text, sizeof(text), file)) {
+        n++;
+        text[strcspn(text, "\r\n")] = '\0';
+        char *save;
+        char *name = strtok_r(text, " \t", &save);
+        if (!name || name[0] == '#')
+            continue;
+        AlertRule rule;
+        memset(&rule, 0, sizeof(rule));
+        rule.model = -1;
+        rule.device = -1;
+        char *device = strtok_r(NULL, " \t", &save);
+        if (strlen(name) >= ALERT_NAME || !device || !parse_device(device, rule) || !parse_condition(rule, &save)) {
+            fclose(file);
+            *line = n;
+            errno = EINVAL;
+            return false;
+        }
+        if (rule.node && !nodes) {
+            fclose(file);
+            *line = n;
+            errno = EOPNOTSUPP;
+            return false;
+        }
+        strcpy(rule.name, name);
+        rules.push_back(rule);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+AlertEngine::AlertEngine(const std::vector<AlertRule> *rules, AlertHandler handler) {
+    this->rules = rules;
+    this->handler = handler;
+}
+
+/** Builds the machines of a device seen for the first time, one per rule that applies. */
+AlertEngine::Device& AlertEngine::compile(uint64_t key, uint64_t ns) {
+    Device& device = devices[key];
+    device.last_ns = ns;
+    for (const AlertRule& rule : *rules) {
+        if ((rule.node && rule.node != key >> 32) || (rule.model >= 0 && rule.model != (int)((key >> 16) & 0xffff)) ||
+                (rule.device >= 0 && rule.device != (int)(key & 0xffff)))
+            continue;
+        device.machines.push_back({ &rule, 0, 0, 0, false });
+    }
+    return device;
+}
+
+void AlertEngine::fire(Machine& m, uint64_t key, uint64_t ns, bool firing, int32_t value) {
+    m.firing = firing;
+    if (handler)
+        handler({ m.rule, key, ns, firing, value });
+}
+
+/** @return true if the machine raised an alert */
+bool AlertEngine::step(Machine& m, uint64_t key, uint64_t ns, const Payload& payload) {
+    const AlertRule& rule = *m.rule;
+    int32_t value = rule.field == ALERT_TEMPERATURE ? payload.temperature :
+            rule.field == ALERT_HUMIDITY ? payload.humidity : payload.battery;
+    if (rule.kind == ALERT_RATE) {
+        /* The rate since the anchor, once it is far enough back; the reading is the next anchor. */
+        if (m.anchor_ns == 0 || ns <= m.anchor_ns) {
+            m.anchor_ns = ns;
+            m.anchor = value;
+            return false;
+        }
+        if (ns - m.anchor_ns < rule.over_ns)
+            return false;
+        int32_t change = value - m.anchor;
+        uint64_t elapsed = ns - m.anchor_ns;
+        m.anchor_ns = ns;
+        m.anchor = value;
+        /* Readings a few ns apart make any change a huge rate; keep it in range of the cast. */
+        double rate = change * 60e9 / elapsed;
+        value = rate >= INT32_MAX ? INT32_MAX : rate <= INT32_MIN ? INT32_MIN : (int32_t)rate;
+    }
+    bool holds = rule.above ? value > rule.limit : value < rule.limit;
+    if (!holds) {
+        m.since_ns = 0;
+        if (m.firing)
+            fire(m, key, ns, false, value);
+        return false;
+    }
+    if (m.since_ns == 0)
+        m.since_ns = ns;
+    if (m.firing || ns - m.since_ns < rule.for_ns)
+        return false;
+    fire(m, key, ns, true, value);
+    return true;
+}
+
+/**
+ * Steps the machines of a device with one of its readings. Only STATUS_OK
+ * readings carry values; any other leaves the machines where they were.
+ *
+ * @return number of alerts raised
+ */
+uint64_t AlertEngine::update(uint64_t key, uint64_t ns, const Payload& payload) {
+    auto it = devices.find(key);
+    Device& device = it != devices.end() ? it->second : compile(key, ns);
+    if (payload.status != STATUS_OK)
+        return 0;
+    device.last_ns = ns;
+    uint64_t raised = 0;
+    for (Machine& m : device.machines) {
+        if (m.rule->kind != ALERT_MISSING)
+            raised += step(m, key, ns, payload);
+        else if (m.firing)
+            fire(m, key, ns, false, 0);
+    }
+    return raised;
+}
+
+/**
+ * Raises ALERT_MISSING rules of devices that have gone quiet. A device is
+ * quiet from when it was first seen until its first STATUS_OK reading.
+ *
+ * @return number of alerts raised
+ */
+uint64_t AlertEngine::check(uint64_t now_ns) {
+    uint64_t raised = 0;
+    for (auto& it : devices) {
+        Device& device = it.second;
+        for (Machine& m : device.machines) {
+            if (m.rule->kind != ALERT_MISSING || m.firing || now_ns < device.last_ns + m.rule->for_ns)
+                continue;
+            fire(m, it.first, now_ns, true, (int32_t)((now_ns - device.last_ns) / 1000000000));
+            raised++;
+        }
+    }
+    return raised;
+}
+
+static size_t stripe_of(uint64_t key) {
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (key ^ key >> 32) & (ALERT_STRIPES - 1);
+}
+
+SharedAlertEngine::SharedAlertEngine(const std::vector<AlertRule> *rules, AlertHandler handler) {
+    for (Stripe& stripe : stripes)
+        stripe.engine = new AlertEngine(rules, handler);
+}
+
+SharedAlertEngine::~SharedAlertEngine() {
+    for (Stripe& stripe : stripes)
+        delete stripe.engine;
+}
+
+/** AlertEngine::update() on the stripe of key; safe from any thread. */
+uint64_t SharedAlertEngine::update(uint64_t key, uint64_t ns, const Payload& payload) {
+    Stripe& stripe = stripes[stripe_of(key)];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    return stripe.engine->update(key, ns, payload);
+}
+
+/** AlertEngine::check() on every stripe in turn; safe from any thread. */
+uint64_t SharedAlertEngine::check(uint64_t now_ns) {
+    uint64_t raised = 0;
+    for (Stripe& stripe : stripes) {
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        raised += stripe.engine->check(now_ns);
+    }
+    return raised;
+}
@@ -0,0 +1,115 @@
+#ifndef ALERT_H
+#define ALERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../esp32/acumonitor.h"
+
+#define ALERT_NAME          32              // Longest rule name, with its terminator
+#define ALERT_TICK_MS       1000            // How often missing data is checked for
+#define ALERT_STRIPES       16              // Locks of a SharedAlertEngine, a power of two
+
+/* Rule kinds */
+#define ALERT_VALUE         0               // A field above or below a limit
+#define ALERT_RATE          1               // A field changing faster than a limit, per minute
+#define ALERT_MISSING       2               // No STATUS_OK reading for a while
+
+/* Fields */
+#define ALERT_TEMPERATURE   0
+#define ALERT_HUMIDITY      1
+#define ALERT_BATTERY       2
+
+/*
+ * One line of a rules file. Values, rates and battery levels are compared
+ * in the units of Payload, so temperatures and humidities in tenths; only
+ * STATUS_OK readings are compared.
+ */
+struct AlertRule {
+    char name[ALERT_NAME];
+    uint32_t node;                  // 0 for any; always 0 for deduplicated readings
+    int model;                      // -1 for any
+    int device;                     // -1 for any
+    int kind;
+    int field;
+    bool above;                     // Fires above limit rather than below
+    int32_t limit;
+    uint64_t for_ns;                // How long the condition must hold, or the silence for ALERT_MISSING
+    uint64_t over_ns;               // Shortest time a rate is measured over, 0 for successive readings
+};
+
+/* An alert raised, or cleared once its condition no longer holds. */
+struct Alert {
+    const AlertRule *rule;
+    uint64_t key;                   // device_key
+    uint64_t ns;                    // Reading, or check for ALERT_MISSING
+    bool firing;
+    int32_t value;                  // Value, rate or seconds of silence
+};
+
+/* Called from the receiving threads, or with a SharedAlertEngine from the
+   thread checking for missing data, so it must not block for long. */
+typedef void (*AlertHandler)(const Alert& alert);
+
+bool alert_load(const char *path, std::vector<AlertRule>& rules, int *line, bool nodes = true);
+
+/**
+ * Evaluates alert rules on the readings of one receive thread. The rules
+ * that apply to a device are compiled into a state machine per rule when
+ * the device is first seen, and each reading then steps its device's
+ * machines in O(1) apiece, raising or clearing alerts on the spot. Devices
+ * are partitioned across threads the same way as readings, so nothing is
+ * shared and nothing is locked; only check() for missing data is driven
+ * from outside, through the same thread. SharedAlertEngine is for readings
+ * that are not partitioned that way.
+ */
+class AlertEngine {
+    public:
+        AlertEngine(const std::vector<AlertRule> *rules, AlertHandler handler);
+        uint64_t update(uint64_t key, uint64_t ns, const Payload& payload);
+        uint64_t check(uint64_t now_ns);
+    private:
+        struct Machine {
+            const AlertRule *rule;
+            uint64_t since_ns;              // Condition has held since, 0 if it does not
+            uint64_t anchor_ns;             // Start of the rate being measured, 0 if none
+            int32_t anchor;
+            bool firing;
+        };
+        struct Device {
+            uint64_t last_ns;               // Newest STATUS_OK reading, or first sighting
+            std::vector<Machine> machines;
+        };
+        const std::vector<AlertRule> *rules;
+        AlertHandler handler;
+        std::unordered_map<uint64_t, Device> devices;
+        Device& compile(uint64_t key, uint64_t ns);
+        bool step(Machine& m, uint64_t key, uint64_t ns, const Payload& payload);
+        void fire(Machine& m, uint64_t key, uint64_t ns, bool firing, int32_t value);
+};
+
+/**
+ * Alert engines for readings that may arrive on any receive thread, as the
+ * copy of a reading that survives deduplication does: it comes through
+ * whichever node's shard won the race. Devices are spread by key over
+ * ALERT_STRIPES engines, each behind its own lock, so every machine of a
+ * device sees all of its readings, and threads only wait on each other
+ * for devices that share a stripe.
+ */
+class SharedAlertEngine {
+    public:
+        SharedAlertEngine(const std::vector<AlertRule> *rules, AlertHandler handler);
+        ~SharedAlertEngine();
+        uint64_t update(uint64_t key, uint64_t ns, const Payload& payload);
+        uint64_t check(uint64_t now_ns);
+    private:
+        struct alignas(64) Stripe {
+            std::mutex lock;
+            AlertEngine *engine;
+        };
+        Stripe stripes[ALERT_STRIPES];
+};
+
+#endif
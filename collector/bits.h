@@ -0,0 +1,84 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Appends bit fields, most significant bit first. */
+class BitWriter {
+    public:
+        BitWriter() { clear(); }
+        void clear() {
+            bytes.clear();
+            acc = 0;
+            used = 0;
+        }
+        /** Appends the low bits of value; bits from 1 to 57. */
+        void write(uint64_t value, int bits) {
+            acc = acc << bits | (value & (~0ULL >> (64 - bits)));
+            used += bits;
+            while (used >= 8) {
+                used -= 8;
+                bytes.push_back(acc >> used);
+            }
+        }
+        void write64(uint64_t value) {
+            write(value >> 32, 32);
+            write(value & 0xffffffff, 32);
+        }
+        /** Pads the last byte with zero bits. */
+        void finish() {
+            if (used)
+                write(0, 8 - used);
+        }
+        size_t size() const { return bytes.size(); }
+        const uint8_t *data() const { return bytes.data(); }
+    private:
+        std::vector<uint8_t> bytes;
+        uint64_t acc;
+        int used;                   // Bits in acc not yet in bytes
+};
+
+/* Reads what BitWriter wrote. Reads past the end return zero bits. */
+class BitReader {
+    public:
+        BitReader(const uint8_t *data, size_t size) {
+            this->data = data;
+            this->size = size;
+            this->next = 0;
+            this->acc = 0;
+            this->used = 0;
+        }
+        /** @param bits from 1 to 57 */
+        uint64_t read(int bits) {
+            while (used < bits) {
+                acc = acc << 8 | (next < size ? data[next] : 0);
+                next++;
+                used += 8;
+            }
+            used -= bits;
+            return acc >> used & (~0ULL >> (64 - bits));
+        }
+        uint64_t read64() {
+            uint64_t high = read(32);
+            return high << 32 | read(32);
+        }
+        bool overrun() const { return next > size; }
+    private:
+        const uint8_t *data;
+        size_t size;
+        size_t next;                // Next byte to load
+        uint64_t acc;
+        int used;
+};
+
+static inline uint64_t zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+#endif
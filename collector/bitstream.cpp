@@ -0,0 +1,155 @@
+#include "bitstream.h"
+
+/** @return the low byte of the sum of the bytes above the lowest one */
+static uint8_t byte_sum(uint64_t word, int bytes) {
+    uint32_t sum = 0;
+    for (int i = 1; i < bytes; i++)
+        sum += (word >> (i * 8)) & 0xff;
+    return sum & 0xff;
+}
+
+/** byte_sum for 40 or 48 bits at once: bytes are added in pairs, then the pairs by a multiply. */
+static inline uint8_t byte_sum_swar(uint64_t word, uint64_t mask) {
+    uint64_t body = (word >> 8) & mask;
+    uint64_t pairs = (body & 0x00ff00ff00ffULL) + ((body >> 8) & 0x00ff00ff00ffULL);
+    return (pairs * 0x0001000100010001ULL) >> 48;
+}
+
+BitstreamValidator::BitstreamValidator() {
+    for (std::atomic<uint64_t>& binding : bindings)
+        binding = 0;
+}
+
+/**
+ * Binds the 609 of node to signature unless the node has one already: the
+ * first signature that validates is the outdoor sensor's, as on each node.
+ *
+ * @return true if signature is node's outdoor sensor
+ */
+bool BitstreamValidator::bind(uint32_t node, uint16_t signature) {
+    uint64_t bound = (uint64_t)1 << 48 | (uint64_t)node << 16 | signature;
+    size_t mask = VALIDATOR_NODES - 1;
+    size_t index = (size_t)node * 0x9e3779b1u >> 16 & mask;
+    for (size_t probes = 0; probes < VALIDATOR_NODES; probes++) {
+        std::atomic<uint64_t>& binding = bindings[index];
+        uint64_t found = binding.load(std::memory_order_acquire);
+        if (found == 0 && binding.compare_exchange_strong(found, bound))
+            return true;
+        /* found is now whatever took the slot, maybe another node. */
+        if (found >> 16 == bound >> 16)
+            return found == bound;
+        index = (index + 1) & mask;
+    }
+    return false;
+}
+
+bool BitstreamValidator::validate_523(uint64_t word, Payload& payload) {
+    uint16_t signature = word >> 32;
+    uint16_t device;
+    if (signature == ACURITE523_SIG_FREEZER)
+        device = DEVICE_FREEZER;
+    else if (signature == ACURITE523_SIG_FRIDGE)
+        device = DEVICE_FRIDGE;
+    else
+        return false;
+    if ((word & 0xff) != byte_sum(word, ACURITE523_SIGNAL_BIT_LENGTH / 8))
+        return false;
+    uint8_t byte1 = (word >> 8) & 0x7f;
+    uint8_t byte2 = (word >> 16) & 0x7f;
+    if ((uint64_t)(__builtin_popcount(byte1) & 1) != ((word >> 15) & 1) ||
+            (uint64_t)(__builtin_popcount(byte2) & 1) != ((word >> 23) & 1))
+        return false;
+    float temperature = ((uint16_t)byte2 << 7) | byte1;
+    temperature = (temperature - 1800) / 18;
+    if (temperature < -40 || temperature >= 70)
+        return false;
+    payload.tag = TAG_TEMPMONITOR;
+    payload.model = MODEL_ACURITE523;
+    payload.device = device;
+    payload.status = STATUS_OK;
+    payload.battery = (word >> 30) & 0x03;
+    payload.temperature = int16_t(temperature * 10);
+    payload.humidity = 0;
+    return true;
+}
+
+bool BitstreamValidator::validate_609(uint32_t node, uint64_t word, Payload& payload) {
+    uint16_t signature = word >> 32;
+    if (((word >> 28) & 0x03) != ACURITE609_CHANNEL_ID)
+        return false;
+    if ((word & 0xff) != byte_sum(word, ACURITE609_SIGNAL_BIT_LENGTH / 8))
+        return false;
+    float temperature = (word >> 15) & 0x1fff;
+    if (((uint16_t)temperature & 0x1000) == 0x1000)
+        temperature = -(0x2000 - temperature);
+    temperature /= 20;
+    float humidity = (word >> 8) & 0x7f;
+    if (humidity < 1 || humidity > 99 || temperature < -40 || temperature > 70)
+        return false;
+    if (!bind(node, signature))
+        return false;
+    payload.tag = TAG_TEMPMONITOR;
+    payload.model = MODEL_ACURITE609;
+    payload.device = DEVICE_OUTDOOR;
+    payload.status = STATUS_OK;
+    payload.battery = (word >> 30) & 0x03;
+    payload.temperature = int16_t(temperature * 10);
+    payload.humidity = int16_t(humidity * 10);
+    return true;
+}
+
+/**
+ * Validates a word parse_rf completed for a model on node.
+ *
+ * @return true with payload filled in if the word is a reading of a known device
+ */
+bool BitstreamValidator::validate(uint32_t node, uint16_t model, uint64_t word, Payload& payload) {
+    if (word == 0)
+        return false;
+    if (model == MODEL_ACURITE523)
+        return validate_523(word, payload);
+    if (model == MODEL_ACURITE609)
+        return validate_609(node, word, payload);
+    return false;
+}
+
+/**
+ * Validates the words of a raw frame from node. Readings come out in the
+ * order of their words.
+ *
+ * @param payloads room for count readings
+ * @param which set to the index in words of each reading's word
+ * @return number of readings
+ */
+size_t BitstreamValidator::validate(uint32_t node, const RawFrameWord *words, size_t count, Payload *payloads, size_t *which) {
+    size_t candidates[RAWFRAME_WORDS];
+    size_t valid = 0;
+    for (size_t start = 0; start < count; start += RAWFRAME_WORDS) {
+        size_t end = count - start < RAWFRAME_WORDS ? count : start + RAWFRAME_WORDS;
+        size_t n = 0;
+        for (size_t i = start; i < end; i++) {
+            uint64_t word = words[i].word;
+            uint16_t model = words[i].model;
+            uint16_t signature = word >> 32;
+            bool is523 = model == MODEL_ACURITE523;
+            bool is609 = model == MODEL_ACURITE609;
+            uint64_t mask = is523 ? 0xffffffffffULL : 0xffffffffULL;
+            bool sum = (word & 0xff) == byte_sum_swar(word, mask);
+            bool known = (signature == ACURITE523_SIG_FREEZER) | (signature == ACURITE523_SIG_FRIDGE);
+            bool parity = ((__builtin_popcount((word >> 8) & 0xff) & 1) == 0) &
+                    ((__builtin_popcount((word >> 16) & 0xff) & 1) == 0);
+            bool channel = ((word >> 28) & 0x03) == ACURITE609_CHANNEL_ID;
+            bool pass = (word != 0) & sum & ((is523 & known & parity) | (is609 & channel));
+            candidates[n] = i;
+            n += pass;
+        }
+        for (size_t j = 0; j < n; j++) {
+            const RawFrameWord& w = words[candidates[j]];
+            if (validate(node, w.model, w.word, payloads[valid])) {
+                which[valid] = candidates[j];
+                valid++;
+            }
+        }
+    }
+    return valid;
+}
@@ -0,0 +1,40 @@
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../esp32/acumonitor.h"
+
+#define VALIDATOR_NODES     4096            // Nodes whose 609 binding is kept, power of two
+
+/**
+ * The checks validate_bitstream makes on the nodes, for words the nodes
+ * forward unvalidated: signature lookup, checksum, parity, channel and
+ * reading ranges, and binding the 609 to the first signature it is heard
+ * with. Payloads come out exactly as create_payload would make them. Safe
+ * from any number of threads at once.
+ *
+ * Each node binds its own 609, as validate_bitstream does on the node, so
+ * the bindings are kept per node in a fixed open-addressed table. A node
+ * that finds the table full gets no 609 readings.
+ *
+ * A thin node forwards every word its parsers complete, most of them noise,
+ * so a whole frame is first screened without branches: signatures,
+ * checksums, parity and channel for all words, summed across bytes a word at
+ * a time. Only the words that pass go through the checks one by one.
+ */
+class BitstreamValidator {
+    public:
+        BitstreamValidator();
+        bool validate(uint32_t node, uint16_t model, uint64_t word, Payload& payload);
+        size_t validate(uint32_t node, const RawFrameWord *words, size_t count, Payload *payloads, size_t *which);
+    private:
+        /* Bit 48 set, the node in bits 16-47 and its outdoor signature below; 0 while free. */
+        std::atomic<uint64_t> bindings[VALIDATOR_NODES];
+        bool bind(uint32_t node, uint16_t signature);
+        bool validate_523(uint64_t word, Payload& payload);
+        bool validate_609(uint32_t node, uint64_t word, Payload& payload);
+};
+
+#endif
@@ -0,0 +1,762 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "../rpi/realtime.h"
+#include "collector.h"
+#include "uring.h"
+
+/* io_uring user_data */
+#define URING_RECV          1
+#define URING_WAKE          2
+#define URING_WRITE         3
+#define URING_SYNC          4
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Checks a payload received from a node. Models and status must be known and
+ * readings within range; unknown devices are accepted so new sensors show up
+ * without a collector update.
+ */
+bool validate_payload(const Payload& payload) {
+    if (payload.tag != TAG_TEMPMONITOR)
+        return false;
+    if (payload.model != MODEL_ACURITE523 && payload.model != MODEL_ACURITE609)
+        return false;
+    if (payload.status > STATUS_NO_DATA)
+        return false;
+    if (payload.status != STATUS_OK)
+        return true;
+    if (payload.temperature < TEMPERATURE_MIN || payload.temperature > TEMPERATURE_MAX)
+        return false;
+    return payload.humidity >= HUMIDITY_MIN && payload.humidity <= HUMIDITY_MAX;
+}
+
+Shard::Shard(const CollectorConfig& config, int index, LatestTable *latest, SharedAlertEngine *shared_alerts) :
+    datagrams(0), readings(0), invalid(0), combined(0), forwarded(0), dropped(0), batches(0), syscalls(0), untracked(0), duplicates(0), unstored(0),
+    unrolled(0), unlogged(0), alerts(0), stopping(false) {
+    this->config = config;
+    this->index = index;
+    this->latest = latest;
+    this->closed = false;
+    this->fd = -1;
+    this->epoll_fd = -1;
+    this->wake_fd = -1;
+    this->log_fd = -1;
+    this->log_buffers[0] = NULL;
+    this->log_buffers[1] = NULL;
+    this->log_used[0] = 0;
+    this->log_used[1] = 0;
+    this->log_slot = 0;
+    this->log_busy = -1;
+    this->shared_alerts = shared_alerts;
+    this->alert_engine = config.rules && !shared_alerts ? new AlertEngine(config.rules, config.alert_handler) : NULL;
+    if (config.wal)
+        this->wal_batch.reserve(COLLECTOR_BATCH * (COLLECTOR_MTU / sizeof(Payload)));
+    this->buffers = new uint8_t[COLLECTOR_BATCH][COLLECTOR_MTU];
+    this->messages = new struct mmsghdr[COLLECTOR_BATCH];
+    this->iovecs = new struct iovec[COLLECTOR_BATCH];
+    this->addresses = new struct sockaddr_in[COLLECTOR_BATCH];
+    this->controls = new uint8_t[COLLECTOR_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+    memset(messages, 0, sizeof(struct mmsghdr) * COLLECTOR_BATCH);
+    for (int i = 0; i < COLLECTOR_BATCH; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = COLLECTOR_MTU;
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_name = &addresses[i];
+        messages[i].msg_hdr.msg_control = controls[i];
+    }
+}
+
+Shard::~Shard() {
+    if (fd >= 0)
+        close(fd);
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+    if (wake_fd >= 0)
+        close(wake_fd);
+    if (log_fd >= 0)
+        close(log_fd);
+    delete[] log_buffers[0];
+    delete[] log_buffers[1];
+    delete[] buffers;
+    delete[] messages;
+    delete[] iovecs;
+    delete[] addresses;
+    delete[] controls;
+    delete alert_engine;
+}
+
+/**
+ * Binds the UDP socket, shared with the other shards through SO_REUSEPORT,
+ * and sets up the epoll set.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Shard::open_socket() {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.address, &addr.sin_addr) != 1) {
+        errno = EINVAL;
+        return false;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int rcvbuf = COLLECTOR_RCVBUF, on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+    if (config.threads > 1 && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+        return false;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd < 0 || wake_fd < 0)
+        return false;
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        return false;
+    ev.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0)
+        return false;
+    return !config.log || open_log();
+}
+
+/** Opens this shard's log, config.log followed by the shard index. */
+bool Shard::open_log() {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%d", config.log, index);
+    log_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (log_fd < 0)
+        return false;
+    log_buffers[0] = new uint8_t[COLLECTOR_LOG_BUFFER];
+    log_buffers[1] = new uint8_t[COLLECTOR_LOG_BUFFER];
+    return true;
+}
+
+/** Writes the buffer being filled to the log and waits for it. */
+bool Shard::flush_log() {
+    uint8_t *data = log_buffers[log_slot];
+    size_t size = log_used[log_slot];
+    while (size > 0) {
+        syscalls++;
+        ssize_t n = write(log_fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    if (log_used[log_slot] && config.sync) {
+        syscalls++;
+        if (fdatasync(log_fd) < 0)
+            return false;
+    }
+    log_used[log_slot] = 0;
+    return true;
+}
+
+/**
+ * Queues the buffer being filled as a write from registered buffer, linked
+ * to an fdatasync with config.sync, and switches to the other buffer. Only
+ * one chain is in flight at a time.
+ */
+bool Shard::submit_log(Uring& uring) {
+    struct io_uring_sqe *sqe = uring.get_sqe();
+    if (!sqe) {
+        errno = EBUSY;
+        return false;
+    }
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = log_fd;
+    sqe->addr = (uint64_t)log_buffers[log_slot];
+    sqe->len = log_used[log_slot];
+    sqe->off = (uint64_t)-1;
+    sqe->buf_index = log_slot;
+    sqe->user_data = URING_WRITE;
+    if (config.sync) {
+        sqe->flags |= IOSQE_IO_LINK;
+        if (!(sqe = uring.get_sqe())) {
+            errno = EBUSY;
+            return false;
+        }
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = log_fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = URING_SYNC;
+    }
+    log_busy = log_slot;
+    log_slot ^= 1;
+    log_used[log_slot] = 0;
+    return true;
+}
+
+/**
+ * Receives and ingests datagrams, and serves requests from other threads,
+ * until stopping is set.
+ *
+ * @return true once stopped, false with errno set on error
+ */
+bool Shard::run() {
+    bool ok = config.backend == COLLECTOR_URING ? run_uring() : run_epoll();
+    int err = errno;
+    std::lock_guard<std::mutex> guard(mailbox_lock);
+    closed = true;
+    for (ShardRequest *request : mailbox) {
+        request->fn(*this);
+        std::lock_guard<std::mutex> done(request->lock);
+        if (--request->pending == 0)
+            request->done.notify_all();
+    }
+    mailbox.clear();
+    errno = err;
+    return ok;
+}
+
+bool Shard::run_epoll() {
+    struct epoll_event events[2];
+    bool ok = true;
+    while (ok && !stopping) {
+        syscalls++;
+        int n = epoll_wait(epoll_fd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == wake_fd) {
+                uint64_t value;
+                syscalls++;
+                if (read(wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                    ok = false;
+                serve();
+                continue;
+            }
+            /* Drain the socket, a batch at a time, before sleeping again. */
+            size_t count;
+            do {
+                count = receive();
+            } while (count == COLLECTOR_BATCH);
+            if (count == (size_t)-1)
+                ok = false;
+        }
+    }
+    return ok;
+}
+
+static bool arm_receive(Uring& uring, int fd, struct msghdr *msg, BufferRing& buffers) {
+    struct io_uring_sqe *sqe = uring.get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffers.group;
+    sqe->user_data = URING_RECV;
+    return true;
+}
+
+static bool arm_wake(Uring& uring, int fd, uint64_t *value) {
+    struct io_uring_sqe *sqe = uring.get_sqe();
+    if (!sqe)
+        return false;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)value;
+    sqe->len = sizeof(*value);
+    sqe->user_data = URING_WAKE;
+    return true;
+}
+
+/**
+ * The io_uring receive loop. One multishot recvmsg keeps delivering
+ * datagrams into buffers picked from a provided buffer ring, so the loop
+ * makes no system call per datagram or per batch beyond the single
+ * io_uring_enter() that waits for completions. Log buffers are registered
+ * and written without waiting.
+ */
+bool Shard::run_uring() {
+    Uring uring;
+    BufferRing buffers;
+    size_t control = CMSG_SPACE(sizeof(uint32_t));
+    if (!uring.setup(URING_ENTRIES))
+        return false;
+    if (!buffers.setup(uring, URING_BUFFERS,
+            sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + control + COLLECTOR_MTU, 0))
+        return false;
+    if (log_fd >= 0) {
+        struct iovec iovecs[2] = {
+            { log_buffers[0], COLLECTOR_LOG_BUFFER },
+            { log_buffers[1], COLLECTOR_LOG_BUFFER }
+        };
+        if (!uring.register_buffers(iovecs, 2))
+            return false;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_controllen = control;
+    uint64_t wake_value;
+    if (!arm_receive(uring, fd, &msg, buffers) || !arm_wake(uring, wake_fd, &wake_value))
+        return false;
+    /* Datagrams held back while both log buffers are busy. */
+    uint16_t deferred[URING_BUFFERS];
+    uint32_t deferred_size[URING_BUFFERS];
+    unsigned deferred_count = 0;
+    size_t worst = (COLLECTOR_MTU / sizeof(Payload)) * sizeof(Reading);
+    while (!stopping) {
+        syscalls++;
+        if (uring.submit(1) < 0)
+            return false;
+        uint64_t ns = now_ns();
+        unsigned count = 0;
+        struct io_uring_cqe *cqe;
+        while (count < COLLECTOR_BATCH && (cqe = uring.peek())) {
+            uint64_t type = cqe->user_data;
+            int32_t res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring.seen();
+            if (type == URING_RECV) {
+                if (res < 0 && res != -ENOBUFS) {
+                    errno = -res;
+                    return false;
+                }
+                if (res >= 0 && (flags & IORING_CQE_F_BUFFER)) {
+                    uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (log_fd >= 0 && (deferred_count || log_used[log_slot] + worst > COLLECTOR_LOG_BUFFER)) {
+                        deferred[deferred_count] = id;
+                        deferred_size[deferred_count++] = res;
+                    }
+                    else
+                        receive_uring(buffers, id, res, ns);
+                    count++;
+                }
+                /* Out of buffers or otherwise ended: go again once some are back. */
+                if (!(flags & IORING_CQE_F_MORE) && !arm_receive(uring, fd, &msg, buffers))
+                    return false;
+            }
+            else if (type == URING_WAKE) {
+                serve();
+                if (!arm_wake(uring, wake_fd, &wake_value))
+                    return false;
+            }
+            else if (type == URING_WRITE || type == URING_SYNC) {
+                if (res < 0) {
+                    errno = -res;
+                    return false;
+                }
+                if (type == URING_SYNC || !config.sync)
+                    log_busy = -1;
+            }
+        }
+        if (count) {
+            datagrams += count;
+            batches++;
+        }
+        flush_wal();
+        if (log_fd >= 0 && log_busy < 0 && log_used[log_slot] > 0) {
+            if (!submit_log(uring))
+                return false;
+            unsigned done = 0;
+            while (done < deferred_count && log_used[log_slot] + worst <= COLLECTOR_LOG_BUFFER) {
+                receive_uring(buffers, deferred[done], deferred_size[done], ns);
+                done++;
+            }
+            memmove(deferred, deferred + done, (deferred_count - done) * sizeof(deferred[0]));
+            memmove(deferred_size, deferred_size + done, (deferred_count - done) * sizeof(deferred_size[0]));
+            deferred_count -= done;
+        }
+        buffers.commit();
+    }
+
+    /* Let the write in flight finish, then write the rest directly. */
+    while (log_busy >= 0) {
+        syscalls++;
+        if (uring.submit(1) < 0)
+            return false;
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring.peek())) {
+            if ((cqe->user_data == URING_WRITE && !config.sync) || cqe->user_data == URING_SYNC)
+                log_busy = -1;
+            uring.seen();
+        }
+    }
+    for (unsigned i = 0; i < deferred_count; i++) {
+        if (log_used[log_slot] + worst > COLLECTOR_LOG_BUFFER && !flush_log())
+            return false;
+        receive_uring(buffers, deferred[i], deferred_size[i], now_ns());
+    }
+    flush_wal();
+    return log_fd < 0 || flush_log();
+}
+
+/** Ingests a datagram received by io_uring and hands its buffer back. */
+void Shard::receive_uring(BufferRing& buffers, uint16_t id, size_t size, uint64_t ns) {
+    uint8_t *buffer = buffers.buffer(id);
+    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buffer;
+    struct sockaddr_in *name = (struct sockaddr_in *)(out + 1);
+    uint8_t *control = (uint8_t *)name + sizeof(struct sockaddr_in);
+    uint8_t *data = control + CMSG_SPACE(sizeof(uint32_t));
+    if (out->flags & MSG_TRUNC)
+        invalid++;
+    else if (out->payloadlen <= size - (data - buffer))
+        ingest(data, out->payloadlen, ntohl(name->sin_addr.s_addr), ns);
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_control = control;
+    hdr.msg_controllen = out->controllen;
+    update_dropped(&hdr);
+    buffers.add(id);
+}
+
+/** Interrupts epoll_wait; safe from another thread or a signal handler. */
+void Shard::wake() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+void Shard::serve() {
+    std::vector<ShardRequest *> requests;
+    {
+        std::lock_guard<std::mutex> guard(mailbox_lock);
+        requests.swap(mailbox);
+    }
+    for (ShardRequest *request : requests) {
+        request->fn(*this);
+        std::lock_guard<std::mutex> guard(request->lock);
+        if (--request->pending == 0)
+            request->done.notify_all();
+    }
+}
+
+/**
+ * Reads one batch of datagrams and ingests it.
+ *
+ * @return number of datagrams, or (size_t)-1 on error
+ */
+size_t Shard::receive() {
+    for (int i = 0; i < COLLECTOR_BATCH; i++) {
+        messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        messages[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint32_t));
+    }
+    syscalls++;
+    int n = recvmmsg(fd, messages, COLLECTOR_BATCH, MSG_DONTWAIT, NULL);
+    if (n < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : (size_t)-1;
+    uint64_t ns = now_ns();
+    for (int i = 0; i < n; i++) {
+        struct msghdr *hdr = &messages[i].msg_hdr;
+        if (hdr->msg_flags & MSG_TRUNC) {
+            invalid++;
+            continue;
+        }
+        ingest(buffers[i], messages[i].msg_len, ntohl(addresses[i].sin_addr.s_addr), ns);
+    }
+    update_dropped(&messages[n - 1].msg_hdr);
+    datagrams += n;
+    batches++;
+    flush_wal();
+    if (log_fd >= 0 && !flush_log())
+        return (size_t)-1;
+    return n;
+}
+
+/**
+ * Hands the readings of the last batch to the write-ahead log, after the
+ * store has them, in one append.
+ */
+void Shard::flush_wal() {
+    if (wal_batch.empty())
+        return;
+    if (!config.wal->append(wal_batch.data(), wal_batch.size()))
+        unlogged += wal_batch.size();
+    wal_batch.clear();
+}
+
+/** The kernel attaches its running drop count to each datagram. */
+void Shard::update_dropped(struct msghdr *hdr) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t total;
+            memcpy(&total, CMSG_DATA(cmsg), sizeof(total));
+            dropped = total;
+        }
+    }
+}
+
+void Shard::ingest(const uint8_t *data, size_t size, uint32_t node, uint64_t ns) {
+    if (size >= sizeof(uint32_t) && *(const uint32_t *)data == TAG_RAWWORD) {
+        ingest_raw(data, size, node, ns);
+        return;
+    }
+    if (size >= sizeof(uint32_t) && *(const uint32_t *)data == TAG_RAWFRAME) {
+        ingest_frame(data, size, node, ns);
+        return;
+    }
+    if (size == 0 || size % sizeof(Payload) != 0) {
+        invalid++;
+        return;
+    }
+    for (size_t offset = 0; offset < size; offset += sizeof(Payload)) {
+        const Payload& payload = *(const Payload *)(data + offset);
+        if (!validate_payload(payload)) {
+            invalid++;
+            continue;
+        }
+        accept(payload, node, ns);
+    }
+}
+
+/**
+ * Hands the raw words of a datagram to the combiner. A reading it recovers
+ * is taken as the node's own, and so stays with this shard.
+ */
+void Shard::ingest_raw(const uint8_t *data, size_t size, uint32_t node, uint64_t ns) {
+    if (!config.combiner || size % sizeof(RawWord) != 0) {
+        invalid++;
+        return;
+    }
+    for (size_t offset = 0; offset < size; offset += sizeof(RawWord)) {
+        const RawWord& raw = *(const RawWord *)(data + offset);
+        Payload payload;
+        if (raw.tag != TAG_RAWWORD) {
+            invalid++;
+            continue;
+        }
+        if (!config.combiner->add(raw, node, ns, payload) || !validate_payload(payload))
+            continue;
+        combined++;
+        accept(payload, node, ns);
+    }
+}
+
+/**
+ * Validates the words of a thin node's frame. Each reading is timed by how
+ * long before the frame's last word the node completed its word, so that the
+ * readings of a frame keep their spacing.
+ */
+void Shard::ingest_frame(const uint8_t *data, size_t size, uint32_t node, uint64_t ns) {
+    const RawFrame& frame = *(const RawFrame *)data;
+    uint16_t count = size >= RAWFRAME_SIZE(0) ? frame.count : 0;
+    if (!config.validator || count == 0 || count > RAWFRAME_WORDS || size != RAWFRAME_SIZE(count)) {
+        invalid++;
+        return;
+    }
+    Payload payloads[RAWFRAME_WORDS];
+    size_t which[RAWFRAME_WORDS];
+    size_t valid = config.validator->validate(node, frame.words, count, payloads, which);
+    uint32_t last = frame.words[count - 1].us;
+    for (size_t i = 0; i < valid; i++) {
+        if (!validate_payload(payloads[i])) {
+            invalid++;
+            continue;
+        }
+        uint64_t behind = (uint64_t)(uint32_t)(last - frame.words[which[i]].us) * 1000;
+        forwarded++;
+        accept(payloads[i], node, behind < ns ? ns - behind : ns);
+    }
+}
+
+/** Takes one valid reading. */
+void Shard::accept(const Payload& payload, uint32_t node, uint64_t ns) {
+    uint64_t key = device_key(node, payload.model, payload.device);
+    if (!latest->update(key, payload, ns))
+        untracked++;
+
+    /* Each node keeps its own latest state; everything else sees one copy,
+       under one key whichever node it came through. */
+    if (config.dedup) {
+        if (config.dedup->seen(payload, ns)) {
+            duplicates++;
+            return;
+        }
+        node = DEDUP_NODE;
+        key = device_key(node, payload.model, payload.device);
+    }
+    if (alert_engine)
+        alerts += alert_engine->update(key, ns, payload);
+    else if (shared_alerts)
+        alerts += shared_alerts->update(key, ns, payload);
+    if (config.store && !config.store->append(key, ns, payload))
+        unstored++;
+    /* Whatever the store did, as WAL replay would. */
+    if (config.rollups && !config.rollups->add(key, ns, payload))
+        unrolled++;
+    readings++;
+    if (log_fd >= 0) {
+        Reading *reading = (Reading *)(log_buffers[log_slot] + log_used[log_slot]);
+        reading->ns = ns;
+        reading->node = node;
+        reading->payload = payload;
+        log_used[log_slot] += sizeof(Reading);
+    }
+    if (config.wal)
+        wal_batch.push_back({ ns, node, payload });
+    if (config.handler)
+        config.handler(node, payload, ns);
+}
+
+/**
+ * Without config.dedup a device's readings all arrive through the shards of
+ * the nodes that hear it, and each shard keeps the alert state of what it
+ * receives. With it, the copy of a reading that survives comes through any
+ * shard, so alert state is shared by all of them.
+ */
+Collector::Collector(const CollectorConfig& config) : latest(config.devices), missing(0), failed(false) {
+    this->config = config;
+    shared_alerts = config.rules && config.dedup ? new SharedAlertEngine(config.rules, config.alert_handler) : NULL;
+    for (int i = 0; i < (config.threads > 0 ? config.threads : 1); i++)
+        shards.push_back(new Shard(config, i, &latest, shared_alerts));
+}
+
+Collector::~Collector() {
+    for (Shard *shard : shards)
+        delete shard;
+    delete shared_alerts;
+}
+
+/** @return true on success, false with errno set on failure */
+bool Collector::open_sockets() {
+    for (Shard *shard : shards) {
+        if (!shard->open_socket())
+            return false;
+    }
+    return true;
+}
+
+/** Starts one receive thread per shard. */
+void Collector::start() {
+    for (Shard *shard : shards) {
+        threads.emplace_back([this, shard]() {
+            ThreadConfig thread;
+            if (config.cpu >= 0)
+                thread.cpu = config.cpu + shard->index;
+            rt_apply_thread(thread, "collector");
+            if (!shard->run()) {
+                perror("collector");
+                failed = true;
+            }
+        });
+    }
+}
+
+/** Makes every shard return; safe from a signal handler. */
+void Collector::stop() {
+    for (Shard *shard : shards) {
+        shard->stopping = true;
+        shard->wake();
+    }
+}
+
+/**
+ * Waits for the receive threads to return.
+ *
+ * @return false if any of them failed
+ */
+bool Collector::wait() {
+    for (std::thread& thread : threads)
+        thread.join();
+    threads.clear();
+    return !failed;
+}
+
+/**
+ * Runs fn on every shard's own thread (or inline once it has stopped) and
+ * waits for all of them. It costs the shards nothing until a request
+ * arrives.
+ */
+void Collector::ask(std::function<void(Shard&)> fn) {
+    ShardRequest request;
+    request.fn = fn;
+    request.pending = shards.size();
+    for (Shard *shard : shards) {
+        std::unique_lock<std::mutex> guard(shard->mailbox_lock);
+        if (shard->closed) {
+            guard.unlock();
+            fn(*shard);
+            std::lock_guard<std::mutex> done(request.lock);
+            request.pending--;
+            continue;
+        }
+        shard->mailbox.push_back(&request);
+        guard.unlock();
+        shard->wake();
+    }
+    std::unique_lock<std::mutex> guard(request.lock);
+    request.done.wait(guard, [&]() { return request.pending == 0; });
+}
+
+/**
+ * Raises the alerts for missing data that are due. Every shard checks its
+ * own devices on its own thread, or shared alert state is checked on this
+ * one; meant to be called every ALERT_TICK_MS.
+ */
+void Collector::check_alerts() {
+    uint64_t ns = now_ns();
+    if (shared_alerts) {
+        missing += shared_alerts->check(ns);
+        return;
+    }
+    ask([ns](Shard& shard) {
+        if (shard.alert_engine)
+            shard.alerts += shard.alert_engine->check(ns);
+    });
+}
+
+/**
+ * Latest state of one device as seen through one node. Lock-free and safe
+ * from any thread, without involving the shards.
+ */
+bool Collector::query(uint32_t node, uint16_t model, uint16_t device, DeviceState& state) {
+    return latest.read(device_key(node, model, device), state);
+}
+
+size_t Collector::device_count() {
+    return latest.count();
+}
+
+CollectorStats Collector::stats() {
+    CollectorStats stats = { };
+    stats.alerts = missing;
+    for (Shard *shard : shards) {
+        stats.datagrams += shard->datagrams;
+        stats.readings += shard->readings;
+        stats.invalid += shard->invalid;
+        stats.combined += shard->combined;
+        stats.forwarded += shard->forwarded;
+        stats.dropped += shard->dropped;
+        stats.batches += shard->batches;
+        stats.syscalls += shard->syscalls;
+        stats.untracked += shard->untracked;
+        stats.duplicates += shard->duplicates;
+        stats.unstored += shard->unstored;
+        stats.unrolled += shard->unrolled;
+        stats.unlogged += shard->unlogged;
+        stats.alerts += shard->alerts;
+    }
+    return stats;
+}
@@ -0,0 +1,197 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../esp32/acumonitor.h"
+#include "alert.h"
+#include "combine.h"
+#include "dedup.h"
+#include "latest.h"
+#include "rollup.h"
+#include "store.h"
+#include "wal.h"
+
+#define COLLECTOR_PORT      38073           // Default UDP port
+#define COLLECTOR_BATCH     64              // Datagrams per recvmmsg
+#define COLLECTOR_MTU       1472            // Largest datagram accepted, in bytes
+#define COLLECTOR_RCVBUF    (4 << 20)       // Socket receive buffer, in bytes
+
+/* Receive loops */
+#define COLLECTOR_EPOLL     0               // recvmmsg on an epoll loop
+#define COLLECTOR_URING     1               // Multishot recvmsg on io_uring
+#define URING_ENTRIES       256             // Submission queue entries
+#define URING_BUFFERS       256             // Provided receive buffers per shard, power of two
+
+/* Plausible reading ranges, in tenths. */
+#define TEMPERATURE_MIN     -400
+#define TEMPERATURE_MAX     800
+#define HUMIDITY_MIN        0
+#define HUMIDITY_MAX        1000
+
+/* One receive batch always fits in one log buffer. */
+#define COLLECTOR_LOG_BUFFER \
+    (COLLECTOR_BATCH * (COLLECTOR_MTU / sizeof(Payload)) * sizeof(Reading))
+
+bool validate_payload(const Payload& payload);
+
+/* Called from the receiving threads for every valid reading. */
+typedef void (*ReadingHandler)(uint32_t node, const Payload& payload, uint64_t ns);
+
+struct CollectorConfig {
+    const char *address = "0.0.0.0";
+    uint16_t port = COLLECTOR_PORT;
+    ReadingHandler handler = NULL;
+    int threads = 1;        // Sockets, each with its own thread and shard
+    int cpu = -1;           // Pin thread i to cpu + i, -1 for any
+    int backend = COLLECTOR_EPOLL;
+    const char *log = NULL; // Append readings to log.<shard>, NULL for none
+    bool sync = false;      // fdatasync the log after every write
+    size_t devices = LATEST_DEVICES;    // Latest-value table size
+    BitstreamValidator *validator = NULL;  // Validate raw frames from thin nodes, NULL to drop them
+    Combiner *combiner = NULL;  // Recover readings from raw words, NULL to drop them
+    DedupSet *dedup = NULL; // Drop copies of readings heard through another node
+    Store *store = NULL;    // Also append readings to this store
+    Rollups *rollups = NULL;    // and these rollups
+    Wal *wal = NULL;        // and then to this write-ahead log
+    const std::vector<AlertRule> *rules = NULL;     // Alert rules, NULL for none
+    AlertHandler alert_handler = NULL;
+};
+
+struct CollectorStats {
+    uint64_t datagrams;
+    uint64_t readings;
+    uint64_t invalid;       // Rejected datagrams and payloads
+    uint64_t combined;      // Readings recovered from raw words, counted in readings
+    uint64_t forwarded;     // Readings validated from raw frames, counted in readings
+    uint64_t dropped;       // Datagrams lost to full socket buffers
+    uint64_t batches;
+    uint64_t syscalls;      // Receive and log system calls, io_uring_enter() counted once
+    uint64_t untracked;     // Readings of new devices with the table full
+    uint64_t duplicates;    // Readings dropped as copies, not counted in readings
+    uint64_t unstored;      // Readings the store failed to write
+    uint64_t unrolled;      // Readings the rollups failed to take
+    uint64_t unlogged;      // Readings the write-ahead log failed to take
+    uint64_t alerts;        // Alerts raised
+};
+
+class Shard;
+class Uring;
+class BufferRing;
+
+/* Work run on a shard's own thread on behalf of another thread. */
+struct ShardRequest {
+    std::function<void(Shard&)> fn;
+    std::mutex lock;
+    std::condition_variable done;
+    size_t pending;
+};
+
+/**
+ * One receive socket. Datagrams are read COLLECTOR_BATCH at a time with
+ * recvmmsg() into fixed buffers and validated where they lie, so a reading
+ * is never copied before it reaches the latest-value table. Anything else a
+ * shard owns is reached from other threads through Collector::ask().
+ */
+class Shard {
+    public:
+        Shard(const CollectorConfig& config, int index, LatestTable *latest, SharedAlertEngine *shared_alerts);
+        ~Shard();
+        bool open_socket();
+        bool run();
+        void wake();
+        int index;
+        std::atomic<uint64_t> datagrams;
+        std::atomic<uint64_t> readings;
+        std::atomic<uint64_t> invalid;
+        std::atomic<uint64_t> combined;
+        std::atomic<uint64_t> forwarded;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> batches;
+        std::atomic<uint64_t> syscalls;
+        std::atomic<uint64_t> untracked;
+        std::atomic<uint64_t> duplicates;
+        std::atomic<uint64_t> unstored;
+        std::atomic<uint64_t> unrolled;
+        std::atomic<uint64_t> unlogged;
+        std::atomic<uint64_t> alerts;
+        std::atomic<bool> stopping;
+    private:
+        CollectorConfig config;
+        LatestTable *latest;
+        int fd;
+        int epoll_fd;
+        int wake_fd;                        // eventfd signalled by wake()
+        uint8_t (*buffers)[COLLECTOR_MTU];
+        struct mmsghdr *messages;
+        struct iovec *iovecs;
+        struct sockaddr_in *addresses;
+        uint8_t (*controls)[CMSG_SPACE(sizeof(uint32_t))];
+        int log_fd;
+        uint8_t *log_buffers[2];
+        size_t log_used[2];
+        int log_slot;                       // Buffer being filled
+        int log_busy;                       // Buffer being written by io_uring, or -1
+        std::vector<Reading> wal_batch;     // Readings of this batch, for config.wal
+        AlertEngine *alert_engine;          // Rules of this shard's devices, NULL for none
+        SharedAlertEngine *shared_alerts;   // Rules of all devices with config.dedup, or NULL
+        std::mutex mailbox_lock;
+        std::vector<ShardRequest *> mailbox;
+        bool closed;                        // Thread has exited, run requests inline
+        bool run_epoll();
+        bool run_uring();
+        size_t receive();
+        void receive_uring(BufferRing& buffers, uint16_t id, size_t size, uint64_t ns);
+        void update_dropped(struct msghdr *hdr);
+        void ingest(const uint8_t *data, size_t size, uint32_t node, uint64_t ns);
+        void ingest_raw(const uint8_t *data, size_t size, uint32_t node, uint64_t ns);
+        void ingest_frame(const uint8_t *data, size_t size, uint32_t node, uint64_t ns);
+        void accept(const Payload& payload, uint32_t node, uint64_t ns);
+        bool open_log();
+        bool flush_log();
+        bool submit_log(Uring& uring);
+        void flush_wal();
+        void serve();
+        friend class Collector;
+};
+
+/**
+ * Receives Payload datagrams from the nodes. Each datagram holds one or more
+ * packed Payloads. With more than one thread, every thread binds its own
+ * socket to the port with SO_REUSEPORT; the kernel hashes each sender to one
+ * socket, so the receive path shares nothing between threads but the
+ * latest-value table, whose entries are written without locks and which
+ * readers query directly.
+ */
+class Collector {
+    public:
+        Collector(const CollectorConfig& config);
+        ~Collector();
+        bool open_sockets();
+        void start();
+        void stop();
+        bool wait();
+        void ask(std::function<void(Shard&)> fn);
+        void check_alerts();
+        bool query(uint32_t node, uint16_t model, uint16_t device, DeviceState& state);
+        size_t device_count();
+        CollectorStats stats();
+        std::vector<Shard *> shards;
+        LatestTable latest;
+    private:
+        CollectorConfig config;
+        SharedAlertEngine *shared_alerts;   // With config.dedup and config.rules
+        std::atomic<uint64_t> missing;      // Alerts raised by shared_alerts->check()
+        std::vector<std::thread> threads;
+        std::atomic<bool> failed;
+};
+
+#endif
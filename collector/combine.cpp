@@ -0,0 +1,81 @@
+#include <string.h>
+#include "combine.h"
+
+Combiner::Combiner(BitstreamValidator *validator, uint64_t window_ms) {
+    memset(groups, 0, sizeof(groups));
+    memset(&counts, 0, sizeof(counts));
+    this->validator = validator;
+    this->window_ns = window_ms * 1000000;
+}
+
+/** @return the group of the transmission raw is a copy of, or a fresh one */
+Combiner::Group *Combiner::find(const RawWord& raw, uint64_t ns) {
+    Group *best = NULL, *victim = NULL;
+    int distance = COMBINE_DISTANCE + 1;
+    uint64_t victim_rank = UINT64_MAX;
+    for (Group& g : groups) {
+        uint64_t age = ns > g.first_ns ? ns - g.first_ns : 0;
+        bool live = g.model != 0 && age <= window_ns;
+        if (live && g.model == raw.model && g.bits == raw.bits) {
+            int d = __builtin_popcountll(g.word ^ raw.word);
+            if (d < distance) {
+                best = &g;
+                distance = d;
+            }
+        }
+
+        /* Free first, then expired, then the oldest. */
+        uint64_t rank = g.model == 0 ? 0 : !live ? 1 : 2 + window_ns - age;
+        if (rank < victim_rank) {
+            victim = &g;
+            victim_rank = rank;
+        }
+    }
+    if (best)
+        return best;
+    memset(victim, 0, sizeof(*victim));
+    victim->model = raw.model;
+    victim->bits = raw.bits;
+    victim->first_ns = ns;
+    victim->word = raw.word;
+    return victim;
+}
+
+/**
+ * Adds one node's copy of a transmission. A majority word it completes is
+ * validated as heard by that node.
+ *
+ * @return true with payload filled in if this copy completed a majority
+ *         word that validates; it is never true twice for a transmission
+ */
+bool Combiner::add(const RawWord& raw, uint32_t node, uint64_t ns, Payload& payload) {
+    if (raw.model == 0 || raw.bits == 0 || raw.bits > COMBINE_BITS)
+        return false;
+    std::lock_guard<std::mutex> guard(lock);
+    counts.words++;
+    Group *g = find(raw, ns);
+    if (g->done) {
+        counts.late++;
+        return false;
+    }
+    uint64_t word = 0;
+    for (int i = 0; i < raw.bits; i++) {
+        int weight = 1 + ((raw.confidence[0] >> i) & 1) + 2 * ((raw.confidence[1] >> i) & 1);
+        g->votes[i] += (raw.word >> i) & 1 ? weight : -weight;
+
+        /* A tie keeps the bit the majority had. */
+        uint64_t bit = g->votes[i] > 0 || (g->votes[i] == 0 && ((g->word >> i) & 1));
+        word |= bit << i;
+    }
+    g->word = word;
+    if (++g->copies < 2 || !validator->validate(node, g->model, word, payload))
+        return false;
+    g->done = true;
+    counts.combined++;
+    return true;
+}
+
+CombineStats Combiner::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    return counts;
+}
@@ -0,0 +1,54 @@
+#ifndef COMBINE_H
+#define COMBINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <mutex>
+#include "../esp32/acumonitor.h"
+#include "bitstream.h"
+
+#define COMBINE_WINDOW_MS   500             // Default time copies of one transmission may span
+#define COMBINE_GROUPS      64              // Transmissions being combined at once
+#define COMBINE_DISTANCE    8               // Most bits a copy may differ from the others by
+#define COMBINE_BITS        64
+
+struct CombineStats {
+    uint64_t words;                 // Raw words taken
+    uint64_t combined;              // Readings recovered
+    uint64_t late;                  // Copies of transmissions already recovered
+};
+
+/**
+ * Recovers readings from the raw words several receivers forwarded for one
+ * transmission when none of them validated it. Copies of a model's word
+ * that arrive within the window and differ in few enough bits are taken
+ * for the same transmission; each copy votes for every bit with the weight
+ * of its confidence in it, and after each copy the majority word is run
+ * through the validator. A fixed table of groups is shared by the receive
+ * threads under one lock, which raw words, being the rare failures, never
+ * contend for.
+ */
+class Combiner {
+    public:
+        Combiner(BitstreamValidator *validator, uint64_t window_ms = COMBINE_WINDOW_MS);
+        bool add(const RawWord& raw, uint32_t node, uint64_t ns, Payload& payload);
+        CombineStats stats();
+    private:
+        struct Group {
+            uint16_t model;                 // 0 while free
+            uint8_t bits;
+            bool done;                      // Already recovered
+            uint32_t copies;
+            uint64_t first_ns;
+            uint64_t word;                  // Majority so far
+            int32_t votes[COMBINE_BITS];    // Weights for 1 less weights for 0
+        };
+        std::mutex lock;
+        Group groups[COMBINE_GROUPS];
+        uint64_t window_ns;
+        BitstreamValidator *validator;
+        CombineStats counts;
+        Group *find(const RawWord& raw, uint64_t ns);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#include <stddef.h>
+#include <string.h>
+#include "dedup.h"
+
+#define FINGERPRINT_MASK    (~(uint64_t)0xffff)
+#define FINGERPRINT_SET     (1ULL << 63)    // Keeps a used slot from reading as 0
+
+/** @return a hash of everything in the payload after its tag */
+static uint64_t payload_hash(const Payload& payload) {
+    const uint8_t *data = (const uint8_t *)&payload + offsetof(Payload, model);
+    uint64_t a;
+    uint16_t b;
+    memcpy(&a, data, sizeof(a));
+    memcpy(&b, data + sizeof(a), sizeof(b));
+    uint64_t h = a * 0x9e3779b97f4a7c15ULL;
+    h = ((h ^ h >> 32) ^ b) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ h >> 29) * 0x94d049bb133111ebULL;
+    return h ^ h >> 32;
+}
+
+/** Rounds slots up to a whole number of lines, a power of two. */
+DedupSet::DedupSet(size_t slots, uint64_t window_ms) {
+    size_t lines = 1;
+    while (lines * DEDUP_WAYS < slots)
+        lines <<= 1;
+    this->lines = new DedupLine[lines];
+    for (size_t i = 0; i < lines; i++) {
+        for (int j = 0; j < DEDUP_WAYS; j++)
+            this->lines[i].slots[j].store(0, std::memory_order_relaxed);
+    }
+    this->mask = lines - 1;
+    this->bucket_ns = window_ms * 1000000 / DEDUP_BUCKETS;
+    if (this->bucket_ns == 0)
+        this->bucket_ns = 1;
+}
+
+DedupSet::~DedupSet() {
+    delete[] lines;
+}
+
+/**
+ * Checks a reading against those heard in the window before it, and
+ * remembers it if it is new. Safe from any number of threads at once;
+ * readings may arrive slightly out of time order across threads.
+ *
+ * @return true if the same payload was heard within the window
+ */
+bool DedupSet::seen(const Payload& payload, uint64_t ns) {
+    uint64_t hash = payload_hash(payload);
+    uint64_t fingerprint = (hash & FINGERPRINT_MASK) | FINGERPRINT_SET;
+    uint16_t bucket = ns / bucket_ns;
+    DedupLine& line = lines[hash & mask];
+    for (;;) {
+        int victim = 0;
+        int victim_age = -1;
+        uint64_t values[DEDUP_WAYS];
+        for (int i = 0; i < DEDUP_WAYS; i++) {
+            uint64_t value = values[i] = line.slots[i].load(std::memory_order_acquire);
+
+            /* Age in buckets either way, as another thread may be a bucket ahead. */
+            uint16_t age = bucket - (uint16_t)value;
+            int distance = age < 0x8000 ? age : 0x10000 - age;
+            bool fresh = value != 0 && distance < DEDUP_BUCKETS;
+            if (fresh && (value & FINGERPRINT_MASK) == fingerprint)
+                return true;
+
+            /* Free first, then stale, then the oldest fresh one. */
+            int rank = value == 0 ? 0x20000 : fresh ? distance : 0x10000;
+            if (rank > victim_age) {
+                victim = i;
+                victim_age = rank;
+            }
+        }
+        if (line.slots[victim].compare_exchange_strong(values[victim], fingerprint | bucket,
+                std::memory_order_acq_rel))
+            return false;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../esp32/acumonitor.h"
+
+#define DEDUP_SLOTS         (1 << 16)       // Default size, a power of two
+#define DEDUP_WINDOW_MS     2000            // Default window
+#define DEDUP_BUCKETS       8               // Time buckets per window
+#define DEDUP_WAYS          8               // Slots per cache line, all probed per reading
+#define DEDUP_NODE          0               // Node the readings that survive are taken from
+
+/* One cache line of slots, each a fingerprint and the time bucket it was last heard in. */
+struct alignas(64) DedupLine {
+    std::atomic<uint64_t> slots[DEDUP_WAYS];
+};
+
+/**
+ * Readings heard lately by any receiver, to drop the copies of one
+ * transmission that several nodes forward. A reading is identified by its
+ * payload alone (model, device, status, battery, temperature, humidity),
+ * never by the node, and is remembered for the window in a fixed table of
+ * 48-bit fingerprints, each stamped with a 16-bit time bucket; entries
+ * older than the window count as free and are overwritten in place. One
+ * cache line is probed per reading, nothing is allocated after
+ * construction, and the table is shared by the receive threads without
+ * locks: a slot is claimed with compare-and-swap, so when two copies race
+ * the loser sees the winner's entry.
+ */
+class DedupSet {
+    public:
+        DedupSet(size_t slots = DEDUP_SLOTS, uint64_t window_ms = DEDUP_WINDOW_MS);
+        ~DedupSet();
+        bool seen(const Payload& payload, uint64_t ns);
+    private:
+        DedupLine *lines;
+        size_t mask;                        // Lines - 1
+        uint64_t bucket_ns;
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include "latest.h"
+
+static_assert(sizeof(DeviceState) % sizeof(uint64_t) == 0, "DeviceState must be whole words");
+static_assert(sizeof(LatestEntry) == 64, "LatestEntry must fill one cache line");
+static_assert(sizeof(LatestHeader) == 64, "entries must start on a cache line");
+
+static size_t hash_key(uint64_t key) {
+    key *= 0x9e3779b97f4a7c15ULL;
+    return key ^ key >> 32;
+}
+
+/** @param capacity most devices kept, rounded up to a power of two */
+LatestTable::LatestTable(size_t capacity) {
+    this->capacity = 1;
+    while (this->capacity < capacity)
+        this->capacity <<= 1;
+    size = sizeof(LatestHeader) + this->capacity * sizeof(LatestEntry);
+    name = NULL;
+    header = (LatestHeader *)::operator new(size, std::align_val_t(alignof(LatestHeader)));
+    memset((void *)header, 0, size);
+    init();
+}
+
+LatestTable::~LatestTable() {
+    if (name) {
+        header->closed.store(1, std::memory_order_release);
+        munmap(header, size);
+        shm_unlink(name);
+        free(name);
+    }
+    else
+        ::operator delete(header, std::align_val_t(alignof(LatestHeader)));
+}
+
+/** Fills in the header of zeroed table memory. */
+void LatestTable::init() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    entries = (LatestEntry *)(header + 1);
+    header->version = LATEST_VERSION;
+    header->entry_size = sizeof(LatestEntry);
+    header->capacity = capacity;
+    header->created_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    header->magic.store(LATEST_MAGIC, std::memory_order_release);
+}
+
+/**
+ * Moves the table into a new POSIX shared memory segment, for LatestReader
+ * in other processes. A segment left by an earlier collector is marked closed
+ * first so that its readers reopen. Call before any update(); calling it
+ * again moves the table to another new segment.
+ *
+ * @param name shared memory name, e.g. LATEST_SHM
+ * @return true on success, false with errno set on failure
+ */
+bool LatestTable::share(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0) {
+        void *old = mmap(NULL, sizeof(LatestHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            ((LatestHeader *)old)->closed.store(1, std::memory_order_release);
+            munmap(old, sizeof(LatestHeader));
+        }
+        close(fd);
+        shm_unlink(name);
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return false;
+    void *shared = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (shared == MAP_FAILED) {
+        shm_unlink(name);
+        errno = error;
+        return false;
+    }
+    if (this->name) {
+        /* Shared before: send the readers of the old segment away, and drop
+           it unless it was just replaced under the same name. */
+        header->closed.store(1, std::memory_order_release);
+        munmap(header, size);
+        if (strcmp(this->name, name) != 0)
+            shm_unlink(this->name);
+        free(this->name);
+    }
+    else
+        ::operator delete(header, std::align_val_t(alignof(LatestHeader)));
+    header = (LatestHeader *)shared;
+    this->name = strdup(name);
+    init();
+    return true;
+}
+
+/** @return index of key, or capacity if it is not in the table */
+size_t latest_find(const LatestEntry *entries, size_t capacity, uint64_t key) {
+    size_t mask = capacity - 1;
+    size_t index = hash_key(key) & mask;
+    for (size_t probes = 0; probes < capacity; probes++) {
+        uint64_t found = entries[index].key.load(std::memory_order_acquire);
+        if (found == key)
+            return index;
+        if (found == 0)
+            break;
+        index = (index + 1) & mask;
+    }
+    return capacity;
+}
+
+/**
+ * Consistent copy of one entry, retrying while a writer is inside it.
+ *
+ * @return false if the entry holds no reading yet
+ */
+bool latest_read(const LatestEntry& entry, uint64_t& key, DeviceState& state) {
+    uint64_t words[LATEST_WORDS];
+    uint32_t sequence;
+    do {
+        sequence = entry.sequence.load(std::memory_order_acquire);
+        key = entry.key.load(std::memory_order_relaxed);
+        for (size_t w = 0; w < LATEST_WORDS; w++)
+            words[w] = entry.words[w].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((sequence & 1) || entry.sequence.load(std::memory_order_relaxed) != sequence);
+    memcpy(&state, words, sizeof(state));
+    return key != 0 && state.readings > 0;
+}
+
+/**
+ * Records a reading, claiming an entry for a new device. Writers of the same
+ * entry from different threads take turns through the sequence.
+ *
+ * @return false if the device is new and the table is full
+ */
+bool LatestTable::update(uint64_t key, const Payload& payload, uint64_t ns) {
+    size_t mask = capacity - 1;
+    size_t index = hash_key(key) & mask;
+    size_t probes = 0;
+    for (;; index = (index + 1) & mask) {
+        if (probes++ == capacity)
+            return false;
+        uint64_t found = entries[index].key.load(std::memory_order_acquire);
+        if (found == 0) {
+            if (entries[index].key.compare_exchange_strong(found, key, std::memory_order_acq_rel))
+                header->used.fetch_add(1, std::memory_order_relaxed);
+            else if (found != key)
+                continue;
+            break;
+        }
+        if (found == key)
+            break;
+    }
+
+    LatestEntry& entry = entries[index];
+    uint32_t sequence;
+    do {
+        sequence = entry.sequence.load(std::memory_order_relaxed);
+    } while ((sequence & 1) || !entry.sequence.compare_exchange_weak(sequence, sequence + 1,
+            std::memory_order_acquire, std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+    uint64_t words[LATEST_WORDS];
+    for (size_t w = 0; w < LATEST_WORDS; w++)
+        words[w] = entry.words[w].load(std::memory_order_relaxed);
+    DeviceState state;
+    memcpy(&state, words, sizeof(state));
+    if (state.readings++ == 0)
+        state.first_ns = ns;
+    state.latest = payload;
+    state.last_ns = ns;
+    memcpy(words, &state, sizeof(state));
+    for (size_t w = 0; w < LATEST_WORDS; w++)
+        entry.words[w].store(words[w], std::memory_order_relaxed);
+    entry.sequence.store(sequence + 2, std::memory_order_release);
+    return true;
+}
+
+/** Consistent copy of the latest state of one device. */
+bool LatestTable::read(uint64_t key, DeviceState& state) const {
+    size_t index = latest_find(entries, capacity, key);
+    uint64_t found;
+    return index < capacity && latest_read(entries[index], found, state);
+}
+
+/** Consistent copy of entry index, for walking the table from 0 to capacity - 1. */
+bool LatestTable::read_entry(size_t index, uint64_t& key, DeviceState& state) const {
+    return latest_read(entries[index], key, state);
+}
@@ -0,0 +1,83 @@
+#ifndef LATEST_H
+#define LATEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../esp32/acumonitor.h"
+
+#define LATEST_DEVICES      4096            // Default table size, power of two
+#define LATEST_SHM          "/acurite-latest"   // Default shared memory name
+#define LATEST_MAGIC        0x4c435341      // "ASCL"
+#define LATEST_VERSION      1               // Layout of LatestHeader and LatestEntry
+
+/* Latest state of one device as seen through one node. */
+struct DeviceState {
+    Payload latest;
+    uint64_t readings;
+    uint64_t first_ns;      // CLOCK_REALTIME of the first and latest reading
+    uint64_t last_ns;
+};
+
+#define LATEST_WORDS        (sizeof(DeviceState) / sizeof(uint64_t))
+
+/*
+ * One device, on its own cache line. The sequence is odd while a writer is
+ * inside; the state is kept as words so that readers copy it with plain
+ * relaxed loads.
+ */
+struct alignas(64) LatestEntry {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint64_t> key;                  // device_key, 0 while free
+    std::atomic<uint64_t> words[LATEST_WORDS];  // DeviceState
+};
+
+/*
+ * Start of the table's memory, followed by capacity entries. The same layout
+ * is used in private memory and in the shared memory segment; magic is
+ * written last, so a reader that sees it sees the rest of the header.
+ */
+struct alignas(64) LatestHeader {
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint32_t entry_size;                // sizeof(LatestEntry)
+    uint32_t capacity;
+    uint64_t created_ns;                // CLOCK_REALTIME
+    std::atomic<uint64_t> used;         // Entries claimed
+    std::atomic<uint32_t> closed;       // Writer has gone, reopen by name
+};
+
+/** Nodes are identified by their IPv4 address. Never 0 for a valid payload. */
+static inline uint64_t device_key(uint32_t node, uint16_t model, uint16_t device) {
+    return (uint64_t)node << 32 | (uint32_t)model << 16 | device;
+}
+
+size_t latest_find(const LatestEntry *entries, size_t capacity, uint64_t key);
+bool latest_read(const LatestEntry& entry, uint64_t& key, DeviceState& state);
+
+/**
+ * Flat open-addressed table of the latest reading of every device, written
+ * by the receive threads and read by any number of other threads without
+ * locks or allocation. Each entry is a seqlock: a reader copies the entry
+ * and retries if the sequence moved or was odd meanwhile. Entries are never
+ * removed, so a key found once stays at the same index.
+ */
+class LatestTable {
+    public:
+        LatestTable(size_t capacity);
+        ~LatestTable();
+        bool share(const char *name);
+        bool update(uint64_t key, const Payload& payload, uint64_t ns);
+        bool read(uint64_t key, DeviceState& state) const;
+        bool read_entry(size_t index, uint64_t& key, DeviceState& state) const;
+        size_t count() const { return header->used.load(std::memory_order_relaxed); }
+        size_t capacity;
+    private:
+        LatestHeader *header;
+        LatestEntry *entries;
+        size_t size;                    // Bytes mapped
+        char *name;                     // Shared memory name, or NULL
+        void init();
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "latestreader.h"
+
+LatestReader::LatestReader() {
+    this->header = NULL;
+    this->entries = NULL;
+    this->size = 0;
+    this->capacity = 0;
+    this->created_ns = 0;
+}
+
+LatestReader::~LatestReader() {
+    close();
+}
+
+/**
+ * Maps the segment read-only and checks that its layout is the one this
+ * reader was built with.
+ *
+ * @param name shared memory name, e.g. LATEST_SHM
+ * @return true on success, false with errno set on failure: ENOENT if there
+ *         is no collector, EAGAIN while it is still setting up, EPROTO if the
+ *         layout differs
+ */
+bool LatestReader::open(const char *name) {
+    close();
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) < 0)
+        st.st_size = 0;
+    else if ((size_t)st.st_size < sizeof(LatestHeader))
+        errno = EAGAIN;
+    else
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    header = (const LatestHeader *)mapping;
+    size = st.st_size;
+    if (header->magic.load(std::memory_order_acquire) != LATEST_MAGIC) {
+        close();
+        errno = EAGAIN;
+        return false;
+    }
+    if (header->version != LATEST_VERSION || header->entry_size != sizeof(LatestEntry) ||
+            size < sizeof(LatestHeader) + (size_t)header->capacity * sizeof(LatestEntry)) {
+        close();
+        errno = EPROTO;
+        return false;
+    }
+    entries = (const LatestEntry *)(header + 1);
+    capacity = header->capacity;
+    created_ns = header->created_ns;
+    return true;
+}
+
+void LatestReader::close() {
+    if (header)
+        munmap((void *)header, size);
+    header = NULL;
+    entries = NULL;
+    capacity = 0;
+}
+
+/** Consistent copy of the latest state of one device. */
+bool LatestReader::read(uint32_t node, uint16_t model, uint16_t device, DeviceState& state) const {
+    size_t index = latest_find(entries, capacity, device_key(node, model, device));
+    uint64_t key;
+    return index < capacity && latest_read(entries[index], key, state);
+}
+
+/** Consistent copy of entry index, for walking the table from 0 to capacity - 1. */
+bool LatestReader::read_entry(size_t index, uint64_t& key, DeviceState& state) const {
+    return latest_read(entries[index], key, state);
+}
@@ -0,0 +1,33 @@
+#ifndef LATESTREADER_H
+#define LATESTREADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "latest.h"
+
+/**
+ * Reads the collector's latest-value table from its shared memory segment
+ * (acucollect -l). After open() every read is a few loads from the mapping:
+ * no system calls, no locks and nothing copied but the entry itself. Once
+ * closed() turns true the collector has gone or restarted, and the segment
+ * has to be opened again by name.
+ */
+class LatestReader {
+    public:
+        LatestReader();
+        ~LatestReader();
+        bool open(const char *name);
+        void close();
+        bool read(uint32_t node, uint16_t model, uint16_t device, DeviceState& state) const;
+        bool read_entry(size_t index, uint64_t& key, DeviceState& state) const;
+        size_t count() const { return header ? header->used.load(std::memory_order_relaxed) : 0; }
+        bool closed() const { return !header || header->closed.load(std::memory_order_acquire) != 0; }
+        size_t capacity;
+        uint64_t created_ns;            // When the collector created the segment
+    private:
+        const LatestHeader *header;
+        const LatestEntry *entries;
+        size_t size;
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "loadgen.h"
+
+/* Room for one IP_PKTINFO control message. */
+union SourceControl {
+    struct cmsghdr align;
+    uint8_t data[CMSG_SPACE(sizeof(struct in_pktinfo))];
+};
+
+/** @return CLOCK_MONOTONIC in ns, the clock of LoadConfig::probes */
+uint64_t load_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sends a message from address, any local one on loopback, without a socket bound to it. */
+static void set_source(struct msghdr *hdr, SourceControl *control, uint32_t address) {
+    memset(control, 0, sizeof(*control));
+    hdr->msg_control = control->data;
+    hdr->msg_controllen = sizeof(control->data);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr);
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_PKTINFO;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+    struct in_pktinfo *info = (struct in_pktinfo *)CMSG_DATA(cmsg);
+    info->ipi_spec_dst.s_addr = htonl(address);
+}
+
+/* Fills in the next reading for each payload of a datagram. */
+static void fill(Payload *payloads, int count, int devices, uint64_t seq) {
+    for (int i = 0; i < count; i++) {
+        uint64_t n = seq * count + i;
+        int device = n % devices;
+        Payload& p = payloads[i];
+        p.tag = TAG_TEMPMONITOR;
+        p.model = device & 1 ? MODEL_ACURITE609 : MODEL_ACURITE523;
+        p.device = 1000 + device;
+        p.status = STATUS_OK;
+        p.battery = 3;
+        p.temperature = (int16_t)(n / devices % 600) - 200;
+        p.humidity = p.model == MODEL_ACURITE609 ? 400 + n / devices % 200 : 0;
+    }
+}
+
+/**
+ * Sends config.datagrams datagrams from one sender, COLLECTOR_BATCH at a time
+ * with sendmmsg(). With a source address, datagram i comes from node
+ * i % config.nodes of the sender, each its own source address set per
+ * message, so one socket stands in for many nodes.
+ *
+ * With config.probes, the sender keeps one probe reading of device
+ * LOAD_PROBE_DEVICE in flight from its first node, and stores when it was
+ * sent in config.probes[sender]; whoever ingests the probe sets it back to 0.
+ *
+ * @param sender index of the sender, times config.nodes added to the source address
+ * @return datagrams sent, or -1 with errno set on error
+ */
+int64_t load_send(const LoadConfig& config, int sender) {
+    struct sockaddr_in to;
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_port = htons(config.port);
+    if (inet_pton(AF_INET, config.address, &to.sin_addr) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    struct in_addr source;
+    if (config.source && inet_pton(AF_INET, config.source, &source) != 1) {
+        errno = EINVAL;
+        return -1;
+    }
+    uint32_t first = config.source ? ntohl(source.s_addr) + sender * config.nodes : 0;
+    int nodes = config.source ? config.nodes : 1;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&to, sizeof(to)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    int count = config.payloads;
+    Payload *payloads = new Payload[COLLECTOR_BATCH * count];
+    struct mmsghdr messages[COLLECTOR_BATCH];
+    struct iovec iovecs[COLLECTOR_BATCH];
+    SourceControl controls[COLLECTOR_BATCH];
+    memset(messages, 0, sizeof(messages));
+    for (int i = 0; i < COLLECTOR_BATCH; i++) {
+        iovecs[i].iov_base = &payloads[i * count];
+        iovecs[i].iov_len = count * sizeof(Payload);
+        messages[i].msg_hdr.msg_iov = &iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    Payload probe;
+    memset(&probe, 0, sizeof(probe));
+    probe.tag = TAG_TEMPMONITOR;
+    probe.model = MODEL_ACURITE523;
+    probe.device = LOAD_PROBE_DEVICE;
+    probe.status = STATUS_OK;
+    probe.battery = 3;
+    struct iovec probe_iovec = { &probe, sizeof(probe) };
+    struct msghdr probe_hdr;
+    SourceControl probe_control;
+    memset(&probe_hdr, 0, sizeof(probe_hdr));
+    probe_hdr.msg_iov = &probe_iovec;
+    probe_hdr.msg_iovlen = 1;
+    if (config.source)
+        set_source(&probe_hdr, &probe_control, first);
+    uint64_t start = load_now_ns();
+    uint64_t sent = 0;
+    while (sent < config.datagrams) {
+        int batch = config.datagrams - sent < COLLECTOR_BATCH ? config.datagrams - sent : COLLECTOR_BATCH;
+        for (int i = 0; i < batch; i++) {
+            uint64_t seq = sent + i;
+            fill(&payloads[i * count], count, config.devices, seq / nodes);
+            if (config.source)
+                set_source(&messages[i].msg_hdr, &controls[i], first + seq % nodes);
+        }
+        int n = sendmmsg(fd, messages, batch, 0);
+        if (n < 0) {
+            /* A full transmit queue is not an error for a node either. */
+            if (errno == ENOBUFS || errno == EAGAIN || errno == EINTR)
+                continue;
+            delete[] payloads;
+            close(fd);
+            return -1;
+        }
+        sent += n;
+        if (config.probes) {
+            std::atomic<uint64_t>& probe_ns = config.probes[sender];
+            uint64_t now = load_now_ns(), sent_ns = probe_ns;
+            if (!sent_ns || now - sent_ns > LOAD_PROBE_TIMEOUT) {
+                probe_ns = now;
+                if (sendmsg(fd, &probe_hdr, 0) < 0)
+                    probe_ns = 0;
+            }
+        }
+        if (config.rate) {
+            uint64_t due = start + sent * 1000000000 / config.rate;
+            uint64_t now = load_now_ns();
+            if (due > now) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000) };
+                nanosleep(&ts, NULL);
+            }
+        }
+    }
+    delete[] payloads;
+    close(fd);
+    return sent;
+}
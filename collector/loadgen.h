@@ -0,0 +1,26 @@
+#ifndef LOADGEN_H
+#define LOADGEN_H
+
+#include <stdint.h>
+#include <atomic>
+#include "collector.h"
+
+#define LOAD_PROBE_DEVICE   999             // Device of the readings that time the load
+#define LOAD_PROBE_TIMEOUT  1000000000      // Probe taken as lost after this long, in ns
+
+struct LoadConfig {
+    const char *address = "127.0.0.1";
+    uint16_t port = COLLECTOR_PORT;
+    const char *source = NULL;      // First source address, NULL for any
+    int nodes = 1;                  // Source addresses per sender, from source + sender * nodes
+    uint64_t datagrams = 1000000;   // Per sender
+    int devices = 8;                // Per node
+    int payloads = 1;               // Per datagram
+    uint64_t rate = 0;              // Datagrams/s per sender, 0 for no limit
+    std::atomic<uint64_t> *probes = NULL;   // Per sender, CLOCK_MONOTONIC of the probe in flight or 0
+};
+
+uint64_t load_now_ns();
+int64_t load_send(const LoadConfig& config, int sender);
+
+#endif
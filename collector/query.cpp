@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include "query.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Selection kernels. keep holds 0xff for every reading still selected and 0
+ * otherwise; each kernel clears the readings that fail its test, 16 at a
+ * time. Columns hold STORE_BLOCK entries, a multiple of 16, so the last
+ * vector never runs past them; lanes beyond count are ignored.
+ */
+#if defined(__SSE2__)
+#define VEC_LANES   16
+static void keep_int16(const int16_t *v, size_t count, int16_t lo, int16_t hi, uint8_t *keep) {
+    __m128i l = _mm_set1_epi16(lo), h = _mm_set1_epi16(hi);
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(v + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(v + i + 8));
+        __m128i out_a = _mm_or_si128(_mm_cmplt_epi16(a, l), _mm_cmpgt_epi16(a, h));
+        __m128i out_b = _mm_or_si128(_mm_cmplt_epi16(b, l), _mm_cmpgt_epi16(b, h));
+        __m128i k = _mm_loadu_si128((const __m128i *)(keep + i));
+        k = _mm_andnot_si128(_mm_packs_epi16(out_a, out_b), k);
+        _mm_storeu_si128((__m128i *)(keep + i), k);
+    }
+}
+static void keep_uint8(const uint8_t *v, size_t count, uint8_t lo, uint8_t hi, uint8_t *keep) {
+    __m128i l = _mm_set1_epi8(lo), h = _mm_set1_epi8(hi);
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        __m128i in = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, l), x), _mm_cmpeq_epi8(_mm_min_epu8(x, h), x));
+        __m128i k = _mm_loadu_si128((const __m128i *)(keep + i));
+        _mm_storeu_si128((__m128i *)(keep + i), _mm_and_si128(k, in));
+    }
+}
+static void keep_statuses(const uint8_t *v, size_t count, uint8_t statuses, uint8_t *keep) {
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(v + i));
+        __m128i in = _mm_setzero_si128();
+        for (int s = 0; s < 8; s++) {
+            if (statuses & (1 << s))
+                in = _mm_or_si128(in, _mm_cmpeq_epi8(x, _mm_set1_epi8(s)));
+        }
+        __m128i k = _mm_loadu_si128((const __m128i *)(keep + i));
+        _mm_storeu_si128((__m128i *)(keep + i), _mm_and_si128(k, in));
+    }
+}
+#elif defined(__ARM_NEON)
+#define VEC_LANES   16
+static void keep_int16(const int16_t *v, size_t count, int16_t lo, int16_t hi, uint8_t *keep) {
+    int16x8_t l = vdupq_n_s16(lo), h = vdupq_n_s16(hi);
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        int16x8_t a = vld1q_s16(v + i), b = vld1q_s16(v + i + 8);
+        uint16x8_t in_a = vandq_u16(vcgeq_s16(a, l), vcleq_s16(a, h));
+        uint16x8_t in_b = vandq_u16(vcgeq_s16(b, l), vcleq_s16(b, h));
+        uint8x16_t in = vcombine_u8(vmovn_u16(in_a), vmovn_u16(in_b));
+        vst1q_u8(keep + i, vandq_u8(vld1q_u8(keep + i), in));
+    }
+}
+static void keep_uint8(const uint8_t *v, size_t count, uint8_t lo, uint8_t hi, uint8_t *keep) {
+    uint8x16_t l = vdupq_n_u8(lo), h = vdupq_n_u8(hi);
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        uint8x16_t x = vld1q_u8(v + i);
+        uint8x16_t in = vandq_u8(vcgeq_u8(x, l), vcleq_u8(x, h));
+        vst1q_u8(keep + i, vandq_u8(vld1q_u8(keep + i), in));
+    }
+}
+static void keep_statuses(const uint8_t *v, size_t count, uint8_t statuses, uint8_t *keep) {
+    for (size_t i = 0; i < count; i += VEC_LANES) {
+        uint8x16_t x = vld1q_u8(v + i), in = vdupq_n_u8(0);
+        for (int s = 0; s < 8; s++) {
+            if (statuses & (1 << s))
+                in = vorrq_u8(in, vceqq_u8(x, vdupq_n_u8(s)));
+        }
+        vst1q_u8(keep + i, vandq_u8(vld1q_u8(keep + i), in));
+    }
+}
+#else
+static void keep_int16(const int16_t *v, size_t count, int16_t lo, int16_t hi, uint8_t *keep) {
+    for (size_t i = 0; i < count; i++)
+        keep[i] &= -(uint8_t)(v[i] >= lo && v[i] <= hi);
+}
+static void keep_uint8(const uint8_t *v, size_t count, uint8_t lo, uint8_t hi, uint8_t *keep) {
+    for (size_t i = 0; i < count; i++)
+        keep[i] &= -(uint8_t)(v[i] >= lo && v[i] <= hi);
+}
+static void keep_statuses(const uint8_t *v, size_t count, uint8_t statuses, uint8_t *keep) {
+    for (size_t i = 0; i < count; i++)
+        keep[i] &= -(uint8_t)(v[i] < 8 && (statuses >> v[i]) & 1);
+}
+#endif
+
+static bool filters_temperature(const QueryFilter& f) {
+    return f.temperature_min > INT16_MIN || f.temperature_max < INT16_MAX;
+}
+
+static bool filters_humidity(const QueryFilter& f) {
+    return f.humidity_min > INT16_MIN || f.humidity_max < INT16_MAX;
+}
+
+static bool filters_battery(const QueryFilter& f) {
+    return f.battery_min > 0 || f.battery_max < UINT8_MAX;
+}
+
+/** @return the statuses a reading may have to match, temperature and humidity ranges included */
+static uint8_t wanted_statuses(const QueryFilter& f) {
+    if (filters_temperature(f) || filters_humidity(f))
+        return f.statuses & (1 << STATUS_OK);
+    return f.statuses;
+}
+
+/** @return true if the header rules out every reading of the block */
+static bool skip_block(const QueryFilter& f, const BlockHeader& h) {
+    if (!(h.statuses & wanted_statuses(f)))
+        return true;
+    if (filters_battery(f) && (h.battery_max < f.battery_min || h.battery_min > f.battery_max))
+        return true;
+    if (filters_temperature(f) && (h.temperature_max < f.temperature_min || h.temperature_min > f.temperature_max))
+        return true;
+    return filters_humidity(f) && (h.humidity_max < f.humidity_min || h.humidity_min > f.humidity_max);
+}
+
+/** @return the columns query_select() reads for a block */
+static unsigned filter_columns(const QueryFilter& f, const BlockHeader& h) {
+    unsigned mask = 0;
+    if (h.min_ns < f.from_ns || h.max_ns > f.to_ns)
+        mask |= 1 << COLUMN_TIME;
+    if (wanted_statuses(f) != 0xff)
+        mask |= 1 << COLUMN_STATUS;
+    if (filters_battery(f))
+        mask |= 1 << COLUMN_BATTERY;
+    if (filters_temperature(f))
+        mask |= 1 << COLUMN_TEMPERATURE;
+    if (filters_humidity(f))
+        mask |= 1 << COLUMN_HUMIDITY;
+    return mask;
+}
+
+/**
+ * Marks the readings of a decoded block that match the filter. Only the
+ * columns the filter needs have to be decoded.
+ *
+ * @param keep set to 0xff for every match and 0 otherwise, STORE_BLOCK bytes
+ * @return number of matches
+ */
+size_t query_select(const QueryFilter& filter, const BlockHeader& header, const BlockColumns& columns,
+        uint8_t *keep) {
+    size_t count = columns.count;
+    memset(keep, 0xff, STORE_BLOCK);
+    if (header.min_ns < filter.from_ns || header.max_ns > filter.to_ns) {
+        for (size_t i = 0; i < count; i++)
+            keep[i] &= -(uint8_t)(columns.ns[i] >= filter.from_ns && columns.ns[i] <= filter.to_ns);
+    }
+    uint8_t statuses = wanted_statuses(filter);
+    if (statuses != 0xff)
+        keep_statuses(columns.status, count, statuses, keep);
+    if (filters_battery(filter))
+        keep_uint8(columns.battery, count, filter.battery_min, filter.battery_max, keep);
+    if (filters_temperature(filter))
+        keep_int16(columns.temperature, count, filter.temperature_min, filter.temperature_max, keep);
+    if (filters_humidity(filter))
+        keep_int16(columns.humidity, count, filter.humidity_min, filter.humidity_max, keep);
+    size_t matches = 0;
+    for (size_t i = 0; i < count; i++)
+        matches += keep[i] & 1;
+    return matches;
+}
+
+/** Starts the pool; threads < 1 runs queries on the calling thread alone. */
+QueryEngine::QueryEngine(Store *store, int threads) {
+    this->store = store;
+    this->current = NULL;
+    this->stopping = false;
+    for (int i = 0; i < threads; i++)
+        this->threads.emplace_back(&QueryEngine::worker, this);
+}
+
+QueryEngine::~QueryEngine() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+/** Scans the blocks of one slice, streaming the matches of each block. */
+bool QueryEngine::scan(Run& run, const Task& task, BlockColumns& columns, std::vector<Reading>& out) {
+    const QueryFilter& f = *run.filter;
+    uint8_t keep[STORE_BLOCK];
+    return store->segment_blocks(task.segment, task.from_ns, task.to_ns, f.key,
+            [&](const BlockHeader& header, const uint8_t *body) {
+        /* A block overlapping several slices belongs to the one it starts in. */
+        if (std::max((uint64_t)header.min_ns, f.from_ns) < task.from_ns)
+            return;
+        run.blocks++;
+        if (skip_block(f, header)) {
+            run.skipped++;
+            return;
+        }
+        unsigned mask = filter_columns(f, header);
+        if (mask) {
+            run.decoded++;
+            if (!decode_block(header, body, columns, mask))
+                return;
+        }
+        columns.count = header.count;
+        size_t matches = query_select(f, header, columns, keep);
+        if (matches == 0)
+            return;
+        if (!mask)
+            run.decoded++;
+        if (!decode_block(header, body, columns, COLUMNS_ALL & ~mask))
+            return;
+        out.clear();
+        uint32_t node = header.key >> 32;
+        for (size_t i = 0; i < columns.count; i++) {
+            if (keep[i])
+                out.push_back({ columns.ns[i], node, block_payload(header, columns, i) });
+        }
+        run.readings += out.size();
+        std::lock_guard<std::mutex> guard(run.output);
+        (*run.fn)(out.data(), out.size());
+    });
+}
+
+void QueryEngine::worker() {
+    BlockColumns *columns = new BlockColumns;
+    std::vector<Reading> out;
+    out.reserve(STORE_BLOCK);
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        work.wait(guard, [&]() { return stopping || (current && current->next < current->tasks.size()); });
+        if (stopping)
+            break;
+        Run& run = *current;
+        const Task task = run.tasks[run.next++];
+        guard.unlock();
+        bool ok = scan(run, task, *columns, out);
+        int error = errno;
+        guard.lock();
+        if (!ok && !run.failed) {
+            run.failed = true;
+            run.error = error;
+        }
+        if (++run.done == run.tasks.size())
+            finished.notify_all();
+    }
+    delete columns;
+}
+
+/**
+ * Runs one query to completion, after any other run() under way. fn is
+ * called for every block with matches, from the pool's threads but never two
+ * at once.
+ *
+ * @return false with errno set if a segment could not be read
+ */
+bool QueryEngine::run(const QueryFilter& filter, std::function<void(const Reading *readings, size_t count)> fn,
+        QueryStats *stats) {
+    std::lock_guard<std::mutex> serial(running);
+    Run run;
+    run.filter = &filter;
+    run.fn = &fn;
+    run.next = 0;
+    run.done = 0;
+    run.failed = false;
+    run.error = 0;
+    run.blocks = run.skipped = run.decoded = run.readings = 0;
+
+    /* Sealed segments are cut into slices of the time range they share with the query. */
+    std::vector<unsigned> segments = store->list_segments();
+    size_t slices = std::max<size_t>(1, (threads.size() * QUERY_TASKS_PER_THREAD + segments.size() - 1) /
+            std::max<size_t>(segments.size(), 1));
+    for (unsigned n : segments) {
+        uint64_t min_ns, max_ns;
+        if (!store->segment_range(n, min_ns, max_ns)) {
+            run.tasks.push_back({ n, filter.from_ns, filter.to_ns });
+            continue;
+        }
+        uint64_t from = std::max(min_ns, filter.from_ns), to = std::min(max_ns, filter.to_ns);
+        if (min_ns > max_ns || from > to)
+            continue;
+        uint64_t width = (to - from) / slices + 1;
+        for (uint64_t start = from; start <= to; start += width) {
+            run.tasks.push_back({ n, start, std::min(to, start + width - 1) });
+            if (to - start < width)
+                break;
+        }
+    }
+
+    bool ok = true;
+    if (threads.empty()) {
+        BlockColumns *columns = new BlockColumns;
+        std::vector<Reading> out;
+        for (const Task& task : run.tasks) {
+            if (!scan(run, task, *columns, out)) {
+                ok = false;
+                break;
+            }
+        }
+        delete columns;
+    }
+    else if (!run.tasks.empty()) {
+        std::unique_lock<std::mutex> guard(lock);
+        current = &run;
+        work.notify_all();
+        finished.wait(guard, [&]() { return run.done == run.tasks.size(); });
+        current = NULL;
+        ok = !run.failed;
+        errno = run.error;
+    }
+    if (stats) {
+        stats->blocks = run.blocks;
+        stats->skipped = run.skipped;
+        stats->decoded = run.decoded;
+        stats->readings = run.readings;
+    }
+    return ok;
+}
@@ -0,0 +1,88 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "store.h"
+#include "wal.h"
+
+#define QUERY_TASKS_PER_THREAD  4           // Time slices per thread, for balance
+
+/*
+ * Readings a query returns. Temperature and humidity ranges only match
+ * STATUS_OK readings, which alone carry them; the defaults match anything.
+ */
+struct QueryFilter {
+    uint64_t from_ns = 0;
+    uint64_t to_ns = UINT64_MAX;            // Inclusive
+    uint64_t key = 0;                       // device_key, 0 for all
+    int16_t temperature_min = INT16_MIN;
+    int16_t temperature_max = INT16_MAX;
+    int16_t humidity_min = INT16_MIN;
+    int16_t humidity_max = INT16_MAX;
+    uint8_t battery_min = 0;
+    uint8_t battery_max = UINT8_MAX;
+    uint8_t statuses = 0xff;                // Bit 1 << status for every status wanted
+};
+
+struct QueryStats {
+    uint64_t blocks;                        // Overlapping the time range
+    uint64_t skipped;                       // Ruled out by their header
+    uint64_t decoded;                       // Of which any column was decoded
+    uint64_t readings;                      // Matched
+};
+
+size_t query_select(const QueryFilter& filter, const BlockHeader& header, const BlockColumns& columns,
+        uint8_t *keep);
+
+/**
+ * Runs range queries over a store on a pool of threads. The time range is
+ * cut into slices across the segments it overlaps, and each thread takes
+ * slices from a queue. A block is ruled out on its header's ranges where
+ * possible; otherwise only the columns a filter needs are decoded and
+ * compared a vector at a time, and the rest only if anything matched.
+ * Matches are handed to the caller in batches as soon as each block is
+ * done, in no particular order.
+ */
+class QueryEngine {
+    public:
+        QueryEngine(Store *store, int threads);
+        ~QueryEngine();
+        bool run(const QueryFilter& filter, std::function<void(const Reading *readings, size_t count)> fn,
+                QueryStats *stats = NULL);
+    private:
+        struct Task {
+            unsigned segment;
+            uint64_t from_ns;               // Of the slice, inclusive
+            uint64_t to_ns;
+        };
+        struct Run {
+            const QueryFilter *filter;
+            std::function<void(const Reading *readings, size_t count)> *fn;
+            std::vector<Task> tasks;
+            size_t next;
+            size_t done;
+            bool failed;
+            int error;
+            std::mutex output;              // Serializes calls to fn
+            std::atomic<uint64_t> blocks, skipped, decoded, readings;
+        };
+        Store *store;
+        std::vector<std::thread> threads;
+        std::mutex running;                 // Held by run(), one query at a time
+        std::mutex lock;
+        std::condition_variable work;
+        std::condition_variable finished;
+        Run *current;
+        bool stopping;
+        void worker();
+        bool scan(Run& run, const Task& task, BlockColumns& columns, std::vector<Reading>& out);
+};
+
+#endif
@@ -0,0 +1,399 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "rollup.h"
+
+const uint64_t rollup_widths[ROLLUP_LEVELS] = {
+    60 * 1000000000ULL, 3600 * 1000000000ULL, 86400 * 1000000000ULL
+};
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static uint64_t partition_of(int level, uint64_t ns) {
+    return ns / rollup_widths[level] / ROLLUP_PARTITION;
+}
+
+/** Empties a bucket starting at start_ns. */
+void aggregate_clear(Aggregate& a, uint64_t start_ns) {
+    memset(&a, 0, sizeof(a));
+    a.start_ns = start_ns;
+    a.temperature_min = INT16_MAX;
+    a.temperature_max = INT16_MIN;
+    a.humidity_min = INT16_MAX;
+    a.humidity_max = INT16_MIN;
+}
+
+void aggregate_add(Aggregate& a, uint64_t ns, const Payload& payload) {
+    if (a.count == 0 || ns >= a.last_ns) {
+        a.last_ns = ns;
+        a.last = payload;
+    }
+    a.count++;
+    if (payload.status != STATUS_OK)
+        return;
+    int16_t temperature = payload.temperature, humidity = payload.humidity;
+    a.valid++;
+    a.temperature_sum += temperature;
+    a.humidity_sum += humidity;
+    if (temperature < a.temperature_min)
+        a.temperature_min = temperature;
+    if (temperature > a.temperature_max)
+        a.temperature_max = temperature;
+    if (humidity < a.humidity_min)
+        a.humidity_min = humidity;
+    if (humidity > a.humidity_max)
+        a.humidity_max = humidity;
+}
+
+/** Adds the readings of b to a, keeping a's start. */
+void aggregate_merge(Aggregate& a, const Aggregate& b) {
+    if (b.count == 0)
+        return;
+    if (a.count == 0 || b.last_ns >= a.last_ns) {
+        a.last_ns = b.last_ns;
+        a.last = b.last;
+    }
+    a.count += b.count;
+    a.valid += b.valid;
+    a.temperature_sum += b.temperature_sum;
+    a.humidity_sum += b.humidity_sum;
+    if (b.temperature_min < a.temperature_min)
+        a.temperature_min = b.temperature_min;
+    if (b.temperature_max > a.temperature_max)
+        a.temperature_max = b.temperature_max;
+    if (b.humidity_min < a.humidity_min)
+        a.humidity_min = b.humidity_min;
+    if (b.humidity_max > a.humidity_max)
+        a.humidity_max = b.humidity_max;
+}
+
+Rollups::Rollups(const char *path) {
+    this->path = path;
+    this->recovering = false;
+    for (Level& level : levels)
+        level.loaded = 0;
+}
+
+Rollups::~Rollups() {
+    flush();
+}
+
+/**
+ * Creates the directory if needed.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Rollups::open() {
+    return mkdir(path, 0755) == 0 || errno == EEXIST;
+}
+
+/** @return numbers of the files of a level, oldest first */
+std::vector<uint64_t> Rollups::list_partitions(int level) {
+    std::vector<uint64_t> partitions;
+    DIR *dir = opendir(path);
+    if (!dir)
+        return partitions;
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "rollup.%llu.", (unsigned long long)(rollup_widths[level] / 1000000000));
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned long long n;
+        char end;
+        if (strncmp(entry->d_name, prefix, strlen(prefix)) == 0 &&
+                sscanf(entry->d_name + strlen(prefix), "%llu%c", &n, &end) == 1)
+            partitions.push_back(n);
+    }
+    closedir(dir);
+    std::sort(partitions.begin(), partitions.end());
+    return partitions;
+}
+
+/**
+ * Reads the records of one file, if it exists. A record cut short by a
+ * crash is left out.
+ *
+ * @return false with errno set on error
+ */
+bool Rollups::read_partition(int level, uint64_t partition, std::vector<RollupRecord>& records) {
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/rollup.%llu.%llu", path,
+            (unsigned long long)(rollup_widths[level] / 1000000000), (unsigned long long)partition);
+    int fd = ::open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return errno == ENOENT;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    size_t base = records.size();
+    records.resize(base + st.st_size / sizeof(RollupRecord));
+    uint8_t *data = (uint8_t *)(records.data() + base);
+    size_t want = (records.size() - base) * sizeof(RollupRecord), have = 0;
+    while (have < want) {
+        ssize_t n = read(fd, data + have, want - have);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        have += n;
+    }
+    close(fd);
+    records.resize(base + have / sizeof(RollupRecord));
+    return true;
+}
+
+/**
+ * While recovering, readings replayed from the write-ahead log may already
+ * be in a record on disk. Records of a level are filed by bucket and a
+ * bucket never spans files, so a device's newest record on disk that could
+ * hold ns is in the file of ns or a later one; those files are read once,
+ * newest first, as replay reaches back to them.
+ *
+ * @return true if the reading is already on disk at this level
+ */
+bool Rollups::seen(int index, uint64_t key, uint64_t ns) {
+    Level& level = levels[index];
+    std::lock_guard<std::mutex> guard(level.lock);
+    uint64_t partition = partition_of(index, ns);
+    std::vector<RollupRecord> records;
+    while (level.loaded > partition) {
+        level.loaded--;
+        records.clear();
+        read_partition(index, level.loaded, records);
+        for (const RollupRecord& r : records) {
+            uint64_t& last = level.durable[r.key];
+            last = std::max(last, (uint64_t)r.aggregate.last_ns);
+        }
+    }
+    auto it = level.durable.find(key);
+    return it != level.durable.end() && ns <= it->second;
+}
+
+/**
+ * Turns recovery on before the write-ahead log is replayed, and off after.
+ * While on, add() skips readings that reached the files before a crash.
+ */
+void Rollups::recover(bool on) {
+    for (int i = 0; i < ROLLUP_LEVELS; i++) {
+        std::lock_guard<std::mutex> guard(levels[i].lock);
+        std::vector<uint64_t> partitions = list_partitions(i);
+        levels[i].loaded = on && !partitions.empty() ? partitions.back() + 1 : 0;
+        levels[i].durable.clear();
+        /* Cut off a record torn by the crash so the next ones line up. */
+        for (uint64_t partition : on ? partitions : std::vector<uint64_t>()) {
+            char name[4096];
+            struct stat st;
+            snprintf(name, sizeof(name), "%s/rollup.%llu.%llu", path,
+                    (unsigned long long)(rollup_widths[i] / 1000000000), (unsigned long long)partition);
+            if (stat(name, &st) == 0 && st.st_size % sizeof(RollupRecord))
+                truncate(name, st.st_size - st.st_size % sizeof(RollupRecord));
+        }
+    }
+    recovering = on;
+}
+
+/**
+ * Queues a closed bucket, writing the queue out once it is large. Called
+ * with the device's stripe locked.
+ *
+ * @return false with errno set if the queue could not be written
+ */
+bool Rollups::emit(int index, uint64_t key, const Aggregate& aggregate) {
+    Level& level = levels[index];
+    std::lock_guard<std::mutex> guard(level.lock);
+    level.pending.push_back({ key, aggregate });
+    return level.pending.size() * sizeof(RollupRecord) < ROLLUP_BUFFER || write_pending(level, index);
+}
+
+/** Appends the queued records to their files. Called with the level locked. */
+bool Rollups::write_pending(Level& level, int index) {
+    std::map<uint64_t, std::vector<RollupRecord>> files;
+    for (const RollupRecord& r : level.pending)
+        files[partition_of(index, r.aggregate.start_ns)].push_back(r);
+    level.pending.clear();
+    for (auto& it : files) {
+        char name[4096];
+        snprintf(name, sizeof(name), "%s/rollup.%llu.%llu", path,
+                (unsigned long long)(rollup_widths[index] / 1000000000), (unsigned long long)it.first);
+        int fd = ::open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+            return false;
+        bool ok = write_all(fd, (const uint8_t *)it.second.data(), it.second.size() * sizeof(RollupRecord));
+        int error = errno;
+        close(fd);
+        if (!ok) {
+            errno = error;
+            return false;
+        }
+        level.dirty.insert(it.first);
+    }
+    return true;
+}
+
+/**
+ * Adds a reading to its device's open bucket at every level, closing the
+ * bucket first if the reading falls outside it.
+ *
+ * @return false with errno set if closed buckets could not be written; the
+ *         reading is counted all the same
+ */
+bool Rollups::add(uint64_t key, uint64_t ns, const Payload& payload) {
+    Stripe& stripe = stripes[(key * 0x9e3779b97f4a7c15ULL) >> 58];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    Device& device = stripe.devices[key];
+    bool ok = true;
+    for (int i = 0; i < ROLLUP_LEVELS; i++) {
+        if (recovering && seen(i, key, ns))
+            continue;
+        Aggregate& a = device.open[i];
+        uint64_t start = ns - ns % rollup_widths[i];
+        if (a.count && a.start_ns != start && !emit(i, key, a))
+            ok = false;
+        if (a.count == 0 || a.start_ns != start)
+            aggregate_clear(a, start);
+        aggregate_add(a, ns, payload);
+    }
+    return ok;
+}
+
+/**
+ * Writes out every open bucket as far as it got and syncs the files.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Rollups::flush() {
+    for (Stripe& stripe : stripes) {
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        for (auto& it : stripe.devices) {
+            for (int i = 0; i < ROLLUP_LEVELS; i++) {
+                Aggregate& a = it.second.open[i];
+                if (a.count == 0)
+                    continue;
+                if (!emit(i, it.first, a))
+                    return false;
+                aggregate_clear(a, a.start_ns);
+            }
+        }
+    }
+    for (int i = 0; i < ROLLUP_LEVELS; i++) {
+        Level& level = levels[i];
+        std::lock_guard<std::mutex> guard(level.lock);
+        if (!write_pending(level, i))
+            return false;
+        for (uint64_t partition : level.dirty) {
+            char name[4096];
+            snprintf(name, sizeof(name), "%s/rollup.%llu.%llu", path,
+                    (unsigned long long)(rollup_widths[i] / 1000000000), (unsigned long long)partition);
+            int fd = ::open(name, O_WRONLY | O_CLOEXEC);
+            if (fd < 0 || fdatasync(fd) < 0) {
+                if (fd >= 0)
+                    close(fd);
+                return false;
+            }
+            close(fd);
+        }
+        level.dirty.clear();
+    }
+    return true;
+}
+
+/**
+ * Picks the coarsest level whose buckets tile the request exactly: from_ns,
+ * to_ns and step_ns must all be multiples of the bucket width.
+ *
+ * @return the level, or ROLLUP_RAW if only the readings themselves will do
+ */
+int Rollups::level_for(uint64_t from_ns, uint64_t to_ns, uint64_t step_ns) {
+    for (int i = ROLLUP_LEVELS - 1; i >= 0; i--) {
+        uint64_t width = rollup_widths[i];
+        if (step_ns >= width && step_ns % width == 0 && from_ns % width == 0 && to_ns % width == 0)
+            return i;
+    }
+    return ROLLUP_RAW;
+}
+
+/**
+ * Calls fn, in time order, for every step_ns bucket of device key between
+ * from_ns and to_ns (exclusive) that has readings, each starting at from_ns
+ * plus a multiple of step_ns. Answered from the coarsest level that fits,
+ * open buckets included, or else from the readings in the store.
+ *
+ * @param level set to the level used, or ROLLUP_RAW
+ * @return false with errno set if the files or the store could not be read
+ */
+bool Rollups::query(Store *store, uint64_t key, uint64_t from_ns, uint64_t to_ns, uint64_t step_ns,
+        std::function<void(const Aggregate& aggregate)> fn, int *level) {
+    if (step_ns == 0 || to_ns <= from_ns) {
+        errno = EINVAL;
+        return false;
+    }
+    int index = level_for(from_ns, to_ns, step_ns);
+    if (level)
+        *level = index;
+    std::map<uint64_t, Aggregate> out;
+    auto bucket = [&](uint64_t ns) -> Aggregate& {
+        uint64_t start = from_ns + (ns - from_ns) / step_ns * step_ns;
+        auto it = out.find(start);
+        if (it == out.end()) {
+            it = out.emplace(start, Aggregate()).first;
+            aggregate_clear(it->second, start);
+        }
+        return it->second;
+    };
+
+    if (index == ROLLUP_RAW) {
+        if (!store) {
+            errno = EINVAL;
+            return false;
+        }
+        bool ok = store->scan(from_ns, to_ns - 1, key, [&](uint64_t, uint64_t ns, const Payload& p) {
+            aggregate_add(bucket(ns), ns, p);
+        });
+        if (!ok)
+            return false;
+    }
+    else {
+        std::vector<RollupRecord> records;
+        for (uint64_t p = partition_of(index, from_ns); p <= partition_of(index, to_ns - 1); p++) {
+            if (!read_partition(index, p, records))
+                return false;
+        }
+        {
+            std::lock_guard<std::mutex> guard(levels[index].lock);
+            records.insert(records.end(), levels[index].pending.begin(), levels[index].pending.end());
+        }
+        {
+            Stripe& stripe = stripes[(key * 0x9e3779b97f4a7c15ULL) >> 58];
+            std::lock_guard<std::mutex> guard(stripe.lock);
+            auto it = stripe.devices.find(key);
+            if (it != stripe.devices.end() && it->second.open[index].count)
+                records.push_back({ key, it->second.open[index] });
+        }
+        for (const RollupRecord& r : records) {
+            uint64_t start = r.aggregate.start_ns;
+            if (r.key == key && start >= from_ns && start < to_ns)
+                aggregate_merge(bucket(start), r.aggregate);
+        }
+    }
+    for (auto& it : out)
+        fn(it.second);
+    return true;
+}
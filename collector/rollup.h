@@ -0,0 +1,96 @@
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "../esp32/acumonitor.h"
+#include "store.h"
+
+#define ROLLUP_LEVELS       3               // 1 minute, 1 hour, 1 day
+#define ROLLUP_PARTITION    1440            // Buckets per file
+#define ROLLUP_BUFFER       (64 << 10)      // Write out closed buckets beyond this, in bytes
+#define ROLLUP_RAW          -1              // Level of a query answered from the store
+
+extern const uint64_t rollup_widths[ROLLUP_LEVELS];
+
+/*
+ * Readings of one device in one bucket. Temperature and humidity only count
+ * STATUS_OK readings, as in the store's block headers.
+ */
+struct Aggregate {
+    uint64_t start_ns;
+    uint64_t last_ns;               // Time of the newest reading
+    uint32_t count;                 // Readings
+    uint32_t valid;                 // STATUS_OK readings
+    int64_t temperature_sum;
+    int64_t humidity_sum;
+    int16_t temperature_min;
+    int16_t temperature_max;
+    int16_t humidity_min;
+    int16_t humidity_max;
+    Payload last;                   // Newest reading
+} __attribute__((packed));
+
+/* A closed bucket as written to rollup.<width>.<partition>. */
+struct RollupRecord {
+    uint64_t key;                   // device_key
+    Aggregate aggregate;
+} __attribute__((packed));
+
+void aggregate_clear(Aggregate& a, uint64_t start_ns);
+void aggregate_add(Aggregate& a, uint64_t ns, const Payload& payload);
+void aggregate_merge(Aggregate& a, const Aggregate& b);
+
+/**
+ * Minute, hour and day rollups of every device, kept up to date as readings
+ * arrive. Each reading updates the open bucket of its device at every level
+ * in O(1); a bucket is written out once a reading falls past it, or by
+ * flush() however far it got, and a later record of the same bucket is
+ * merged with it when read. Records go to one file per ROLLUP_PARTITION
+ * buckets of a level in the store's directory. Safe to add to from several
+ * threads.
+ */
+class Rollups {
+    public:
+        Rollups(const char *path);
+        ~Rollups();
+        bool open();
+        bool add(uint64_t key, uint64_t ns, const Payload& payload);
+        bool flush();
+        void recover(bool on);
+        bool query(Store *store, uint64_t key, uint64_t from_ns, uint64_t to_ns, uint64_t step_ns,
+                std::function<void(const Aggregate& aggregate)> fn, int *level = NULL);
+        static int level_for(uint64_t from_ns, uint64_t to_ns, uint64_t step_ns);
+    private:
+        struct Device {
+            Aggregate open[ROLLUP_LEVELS];
+        };
+        struct Stripe {
+            std::mutex lock;
+            std::unordered_map<uint64_t, Device> devices;
+        };
+        struct Level {
+            std::mutex lock;
+            std::vector<RollupRecord> pending;  // Closed, not written yet
+            std::set<uint64_t> dirty;           // Partitions written since the last flush
+            std::unordered_map<uint64_t, uint64_t> durable;     // key to last_ns on disk, recovering
+            uint64_t loaded;                    // Lowest partition read into durable
+        };
+        const char *path;
+        Stripe stripes[STORE_STRIPES];
+        Level levels[ROLLUP_LEVELS];
+        bool recovering;
+        bool emit(int level, uint64_t key, const Aggregate& aggregate);
+        bool write_pending(Level& level, int index);
+        bool read_partition(int level, uint64_t partition, std::vector<RollupRecord>& records);
+        bool seen(int level, uint64_t key, uint64_t ns);
+        std::vector<uint64_t> list_partitions(int level);
+};
+
+#endif
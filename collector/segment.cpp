@@ -0,0 +1,221 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "segment.h"
+
+static uint32_t fnv1a(const uint8_t *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619;
+    return hash;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+/** @return true if data ends in a trailer whose index checks out */
+static bool read_trailer(const uint8_t *data, size_t size, SegmentTrailer& trailer) {
+    if (size < sizeof(trailer))
+        return false;
+    memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+    if (trailer.magic != SEGMENT_MAGIC || trailer.version != SEGMENT_VERSION)
+        return false;
+    size_t end = size - sizeof(trailer);
+    if (trailer.index_offset > end || trailer.count != (end - trailer.index_offset) / sizeof(IndexEntry) ||
+            (end - trailer.index_offset) % sizeof(IndexEntry))
+        return false;
+    return fnv1a(data + trailer.index_offset, end - trailer.index_offset) == trailer.checksum;
+}
+
+/**
+ * Seals a segment: sorts the index of its blocks, appends it and the
+ * trailer after the last block at size, and syncs the file.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool segment_seal(int fd, size_t size, std::vector<IndexEntry>& index) {
+    std::sort(index.begin(), index.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        if (a.key != b.key)
+            return a.key < b.key;
+        return a.max_ns != b.max_ns ? a.max_ns < b.max_ns : a.min_ns < b.min_ns;
+    });
+    SegmentTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.index_offset = size;
+    trailer.count = index.size();
+    trailer.min_ns = UINT64_MAX;
+    for (const IndexEntry& entry : index) {
+        trailer.min_ns = std::min(trailer.min_ns, (uint64_t)entry.min_ns);
+        trailer.max_ns = std::max(trailer.max_ns, (uint64_t)entry.max_ns);
+    }
+    trailer.checksum = fnv1a((const uint8_t *)index.data(), index.size() * sizeof(IndexEntry));
+    trailer.version = SEGMENT_VERSION;
+    trailer.magic = SEGMENT_MAGIC;
+    if (!write_all(fd, (const uint8_t *)index.data(), index.size() * sizeof(IndexEntry)) ||
+            !write_all(fd, (const uint8_t *)&trailer, sizeof(trailer)))
+        return false;
+    return fdatasync(fd) == 0;
+}
+
+/**
+ * Seals a segment left unsealed by a crash, after cutting off a torn last
+ * block. Does nothing to a sealed segment.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool segment_recover(const char *path) {
+    int fd = ::open(path, O_RDWR | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        int error = errno;
+        if (fd >= 0)
+            close(fd);
+        errno = error;
+        return false;
+    }
+    uint8_t *data = NULL;
+    if (st.st_size > 0) {
+        data = (uint8_t *)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            errno = error;
+            return false;
+        }
+    }
+    SegmentTrailer trailer;
+    bool ok = true;
+    if (!read_trailer(data, st.st_size, trailer)) {
+        std::vector<IndexEntry> index;
+        size_t offset = 0;
+        while (offset + sizeof(BlockHeader) <= (size_t)st.st_size) {
+            BlockHeader header;
+            memcpy(&header, data + offset, sizeof(header));
+            if (!block_valid(header, data + offset + sizeof(header), st.st_size - offset - sizeof(header)))
+                break;
+            index.push_back({ header.key, header.min_ns, header.max_ns, offset });
+            offset += block_size(header);
+        }
+        ok = ftruncate(fd, offset) == 0 && lseek(fd, offset, SEEK_SET) >= 0 && segment_seal(fd, offset, index);
+    }
+    int error = errno;
+    if (data)
+        munmap(data, st.st_size);
+    close(fd);
+    errno = error;
+    return ok;
+}
+
+Segment::Segment() {
+    this->data = NULL;
+    this->size = 0;
+    this->index = NULL;
+    memset(&trailer, 0, sizeof(trailer));
+}
+
+Segment::~Segment() {
+    if (data)
+        munmap(data, size);
+}
+
+/**
+ * Maps a segment and checks that it is sealed.
+ *
+ * @return true on success, false with errno set on failure, EINVAL if the
+ *         segment is not sealed
+ */
+bool Segment::open(const char *path) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        int error = errno;
+        if (fd >= 0)
+            close(fd);
+        errno = error;
+        return false;
+    }
+    if (st.st_size < (off_t)sizeof(SegmentTrailer)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (map == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    if (!read_trailer((const uint8_t *)map, st.st_size, trailer)) {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return false;
+    }
+    data = (uint8_t *)map;
+    size = st.st_size;
+    index = (const IndexEntry *)(data + trailer.index_offset);
+    return true;
+}
+
+bool Segment::overlaps(uint64_t from_ns, uint64_t to_ns) const {
+    return trailer.count > 0 && trailer.max_ns >= from_ns && trailer.min_ns <= to_ns;
+}
+
+/** @return the first entry from begin on of key, or after it, that ends at from_ns or later */
+size_t Segment::first(size_t begin, uint64_t key, uint64_t from_ns) const {
+    size_t lo = begin, hi = trailer.count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t k = index[mid].key;
+        if (k < key || (k == key && index[mid].max_ns < from_ns))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Calls fn for every intact block of device key (0 for all) whose time range
+ * overlaps from_ns to to_ns. Binary search skips a device's blocks that end
+ * before from_ns. Those after it are all checked against to_ns, since
+ * readings that arrive out of order (back-dated frames, copies won on
+ * another shard, clock steps) make a device's blocks overlap in time, and
+ * a block starting after to_ns can be followed by one that does not.
+ */
+void Segment::blocks(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+        std::function<void(const BlockHeader& header, const uint8_t *columns)> fn) const {
+    size_t i = first(0, key, 0);
+    while (i < trailer.count && (!key || index[i].key == key)) {
+        uint64_t k = index[i].key;
+        for (i = first(i, k, from_ns); i < trailer.count && index[i].key == k; i++) {
+            BlockHeader header;
+            if (index[i].min_ns > to_ns)
+                continue;
+            const uint8_t *block = data + index[i].offset;
+            if (index[i].offset + sizeof(header) > trailer.index_offset)
+                continue;
+            memcpy(&header, block, sizeof(header));
+            if (block_valid(header, block + sizeof(header), trailer.index_offset - index[i].offset - sizeof(header)))
+                fn(header, block + sizeof(header));
+        }
+        if (key || k == UINT64_MAX)
+            break;
+        i = first(i, k + 1, 0);
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "store.h"
+
+#define SEGMENT_MAGIC       0x58495341      // "ASIX"
+#define SEGMENT_VERSION     1
+
+/* One block of a sealed segment, as listed in its index. */
+struct IndexEntry {
+    uint64_t key;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t offset;                // Of the block header, from the start of the file
+} __attribute__((packed));
+
+/*
+ * The last bytes of a sealed segment. The index, sorted by key, then max_ns,
+ * then min_ns, follows the last block and precedes the trailer.
+ */
+struct SegmentTrailer {
+    uint64_t index_offset;
+    uint64_t count;                 // Index entries
+    uint64_t min_ns;                // Of all blocks, min > max when there are none
+    uint64_t max_ns;
+    uint32_t checksum;              // FNV-1a of the index
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t reserved2;
+    uint32_t magic;
+} __attribute__((packed));
+
+bool segment_seal(int fd, size_t size, std::vector<IndexEntry>& index);
+bool segment_recover(const char *path);
+
+/**
+ * A sealed segment mapped read-only. Opening it reads the trailer and checks
+ * the index, nothing more; blocks are paged in only when a query reaches
+ * them, and a device's blocks are found by binary search on their end time.
+ */
+class Segment {
+    public:
+        Segment();
+        ~Segment();
+        bool open(const char *path);
+        bool overlaps(uint64_t from_ns, uint64_t to_ns) const;
+        void blocks(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+                std::function<void(const BlockHeader& header, const uint8_t *columns)> fn) const;
+        SegmentTrailer trailer;
+    private:
+        uint8_t *data;
+        size_t size;
+        const IndexEntry *index;
+        size_t first(size_t begin, uint64_t key, uint64_t from_ns) const;
+};
+
+#endif
@@ -0,0 +1,603 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "segment.h"
+#include "store.h"
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619;
+    return hash;
+}
+
+/* Timestamps: delta of delta, zigzagged, in Gorilla's buckets. */
+static void write_dod(BitWriter& out, int64_t dod) {
+    uint64_t z = zigzag(dod);
+    if (z == 0)
+        out.write(0, 1);
+    else if (z < (1 << 7))
+        out.write(0x2 << 7 | z, 9);
+    else if (z < (1 << 9))
+        out.write(0x6 << 9 | z, 12);
+    else if (z < (1 << 12))
+        out.write(0xe << 12 | z, 16);
+    else {
+        out.write(0xf, 4);
+        out.write64(z);
+    }
+}
+
+static int64_t read_dod(BitReader& in) {
+    if (!in.read(1))
+        return 0;
+    if (!in.read(1))
+        return unzigzag(in.read(7));
+    if (!in.read(1))
+        return unzigzag(in.read(9));
+    if (!in.read(1))
+        return unzigzag(in.read(12));
+    return unzigzag(in.read64());
+}
+
+/* Temperature and humidity: zigzagged delta in a variable number of bits. */
+static void write_delta(BitWriter& out, int32_t delta) {
+    uint64_t z = zigzag(delta);
+    if (z == 0)
+        out.write(0, 1);
+    else if (z < (1 << 3))
+        out.write(0x2 << 3 | z, 5);
+    else if (z < (1 << 7))
+        out.write(0x6 << 7 | z, 10);
+    else
+        out.write(0x7ULL << 17 | z, 20);
+}
+
+static int32_t read_delta(BitReader& in) {
+    if (!in.read(1))
+        return 0;
+    if (!in.read(1))
+        return unzigzag(in.read(3));
+    if (!in.read(1))
+        return unzigzag(in.read(7));
+    return unzigzag(in.read(17));
+}
+
+/* Status and battery: XOR with the previous value, one bit if unchanged. */
+static void write_xor(BitWriter& out, uint8_t x) {
+    if (x == 0)
+        out.write(0, 1);
+    else
+        out.write(0x100 | x, 9);
+}
+
+static uint8_t read_xor(BitReader& in) {
+    return in.read(1) ? in.read(8) : 0;
+}
+
+/** @return bytes taken by the block, header included */
+size_t block_size(const BlockHeader& header) {
+    size_t size = sizeof(BlockHeader);
+    for (int c = 0; c < COLUMN_COUNT; c++)
+        size += header.sizes[c];
+    return size;
+}
+
+/**
+ * Checks a block read back from a segment; a block cut short by a crash
+ * fails here.
+ *
+ * @param available bytes from columns to the end of the data
+ */
+bool block_valid(const BlockHeader& header, const uint8_t *columns, size_t available) {
+    if (header.magic != BLOCK_MAGIC || header.version != BLOCK_VERSION)
+        return false;
+    if (header.count == 0 || header.count > STORE_BLOCK || header.resolution_ns == 0)
+        return false;
+    size_t size = block_size(header) - sizeof(BlockHeader);
+    return size <= available && fnv1a(2166136261u, columns, size) == header.checksum;
+}
+
+/**
+ * Decodes the columns selected by mask (1 << COLUMN_...) of a block.
+ *
+ * @return false if a column is shorter than its count says
+ */
+bool decode_block(const BlockHeader& header, const uint8_t *columns, BlockColumns& out, unsigned mask) {
+    out.count = header.count;
+    const uint8_t *column = columns;
+    for (int c = 0; c < COLUMN_COUNT; c++) {
+        const uint8_t *data = column;
+        column += header.sizes[c];
+        if (!(mask & (1 << c)))
+            continue;
+        BitReader in(data, header.sizes[c]);
+        switch (c) {
+            case COLUMN_TIME: {
+                int64_t time = in.read64(), delta = 0;
+                out.ns[0] = time * header.resolution_ns;
+                for (size_t i = 1; i < out.count; i++) {
+                    delta += read_dod(in);
+                    time += delta;
+                    out.ns[i] = time * header.resolution_ns;
+                }
+                break;
+            }
+            case COLUMN_TEMPERATURE:
+            case COLUMN_HUMIDITY: {
+                int16_t *values = c == COLUMN_TEMPERATURE ? out.temperature : out.humidity;
+                int16_t value = 0;
+                for (size_t i = 0; i < out.count; i++)
+                    values[i] = value += read_delta(in);
+                break;
+            }
+            case COLUMN_STATUS:
+            case COLUMN_BATTERY: {
+                uint8_t *values = c == COLUMN_STATUS ? out.status : out.battery;
+                uint8_t value = 0;
+                for (size_t i = 0; i < out.count; i++)
+                    values[i] = value ^= read_xor(in);
+                break;
+            }
+        }
+        if (in.overrun())
+            return false;
+    }
+    return true;
+}
+
+/** Reading i of a decoded block as the payload that was received. */
+Payload block_payload(const BlockHeader& header, const BlockColumns& columns, size_t i) {
+    Payload p;
+    p.tag = TAG_TEMPMONITOR;
+    p.model = header.key >> 16;
+    p.device = header.key;
+    p.status = columns.status[i];
+    p.battery = columns.battery[i];
+    p.temperature = columns.temperature[i];
+    p.humidity = columns.humidity[i];
+    return p;
+}
+
+BlockEncoder::BlockEncoder(uint64_t key, uint64_t resolution_ns) {
+    memset(&header, 0, sizeof(header));
+    header.magic = BLOCK_MAGIC;
+    header.version = BLOCK_VERSION;
+    header.key = key;
+    header.resolution_ns = resolution_ns;
+    clear();
+}
+
+/** Starts the next block of the same device. */
+void BlockEncoder::clear() {
+    header.count = 0;
+    header.min_ns = UINT64_MAX;
+    header.max_ns = 0;
+    header.temperature_min = INT16_MAX;
+    header.temperature_max = INT16_MIN;
+    header.humidity_min = INT16_MAX;
+    header.humidity_max = INT16_MIN;
+    header.battery_min = UINT8_MAX;
+    header.battery_max = 0;
+    header.statuses = 0;
+    for (int c = 0; c < COLUMN_COUNT; c++)
+        columns[c].clear();
+    time = 0;
+    delta = 0;
+    temperature = 0;
+    humidity = 0;
+    status = 0;
+    battery = 0;
+}
+
+/** Appends one reading to the open block; call write() once count() reaches STORE_BLOCK. */
+void BlockEncoder::add(uint64_t ns, const Payload& payload) {
+    int64_t t = ns / header.resolution_ns;
+    if (header.count == 0)
+        columns[COLUMN_TIME].write64(t);
+    else {
+        int64_t d = t - time;
+        write_dod(columns[COLUMN_TIME], d - delta);
+        delta = d;
+    }
+    time = t;
+    write_delta(columns[COLUMN_TEMPERATURE], payload.temperature - temperature);
+    write_delta(columns[COLUMN_HUMIDITY], payload.humidity - humidity);
+    write_xor(columns[COLUMN_STATUS], payload.status ^ status);
+    write_xor(columns[COLUMN_BATTERY], payload.battery ^ battery);
+    temperature = payload.temperature;
+    humidity = payload.humidity;
+    status = payload.status;
+    battery = payload.battery;
+
+    ns = t * header.resolution_ns;
+    if (ns < header.min_ns)
+        header.min_ns = ns;
+    if (ns > header.max_ns)
+        header.max_ns = ns;
+    if (status == STATUS_OK) {
+        if (temperature < header.temperature_min)
+            header.temperature_min = temperature;
+        if (temperature > header.temperature_max)
+            header.temperature_max = temperature;
+        if (humidity < header.humidity_min)
+            header.humidity_min = humidity;
+        if (humidity > header.humidity_max)
+            header.humidity_max = humidity;
+    }
+    if (battery < header.battery_min)
+        header.battery_min = battery;
+    if (battery > header.battery_max)
+        header.battery_max = battery;
+    if (status < 8)
+        header.statuses |= 1 << status;
+    header.count++;
+}
+
+/**
+ * Writes the block, header first, with a single write().
+ *
+ * @param written set to the bytes written
+ * @return true on success, false with errno set on failure
+ */
+bool BlockEncoder::write(int fd, size_t& written) {
+    std::vector<uint8_t> block(sizeof(BlockHeader));
+    uint32_t checksum = 2166136261u;
+    for (int c = 0; c < COLUMN_COUNT; c++) {
+        columns[c].finish();
+        header.sizes[c] = columns[c].size();
+        checksum = fnv1a(checksum, columns[c].data(), columns[c].size());
+        block.insert(block.end(), columns[c].data(), columns[c].data() + columns[c].size());
+    }
+    header.checksum = checksum;
+    memcpy(block.data(), &header, sizeof(header));
+    written = 0;
+    while (written < block.size()) {
+        ssize_t n = ::write(fd, block.data() + written, block.size() - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+Store::Store(const StoreConfig& config) : readings(0), blocks(0), bytes(0), lost(0) {
+    this->config = config;
+    this->fd = -1;
+    this->segment = 0;
+    this->segment_bytes = 0;
+}
+
+Store::~Store() {
+    if (fd >= 0 && flush())
+        seal_segment();
+    for (Stripe& stripe : stripes) {
+        for (auto& it : stripe.blocks)
+            delete it.second;
+    }
+    if (fd >= 0)
+        close(fd);
+    for (auto& it : mapped)
+        delete it.second;
+}
+
+/** @return numbers of the segment files in the store, oldest first */
+std::vector<unsigned> Store::list_segments() {
+    std::vector<unsigned> segments;
+    DIR *dir = opendir(config.path);
+    if (!dir)
+        return segments;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned n;
+        char end;
+        if (sscanf(entry->d_name, "segment.%u%c", &n, &end) == 1)
+            segments.push_back(n);
+    }
+    closedir(dir);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+/**
+ * Creates the directory if needed, seals the segments an earlier run left
+ * unsealed and starts a new segment after the existing ones.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Store::open() {
+    if (mkdir(config.path, 0755) < 0 && errno != EEXIST)
+        return false;
+    std::vector<unsigned> segments = list_segments();
+    for (unsigned n : segments) {
+        if (map_segment(n))
+            continue;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/segment.%08u", config.path, n);
+        if (!segment_recover(path))
+            return false;
+    }
+    segment = segments.empty() ? 0 : segments.back();
+    return open_segment();
+}
+
+bool Store::open_segment() {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment.%08u", config.path, ++segment);
+    fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    segment_bytes = 0;
+    index.clear();
+    return fd >= 0;
+}
+
+/** Writes the index of the current segment after its blocks. */
+bool Store::seal_segment() {
+    return segment_seal(fd, segment_bytes, index);
+}
+
+/** @return the sealed segment n, mapped, or NULL if it is not sealed */
+Segment *Store::map_segment(unsigned n) {
+    std::lock_guard<std::mutex> guard(mapped_lock);
+    auto it = mapped.find(n);
+    if (it != mapped.end())
+        return it->second;
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment.%08u", config.path, n);
+    Segment *s = new Segment;
+    if (!s->open(path)) {
+        delete s;
+        return NULL;
+    }
+    mapped[n] = s;
+    return s;
+}
+
+/**
+ * Adds a reading to its device's open block and writes the block out once
+ * it is full.
+ *
+ * @return false with errno set if a block could not be written, and its
+ *         readings were lost
+ */
+bool Store::append(uint64_t key, uint64_t ns, const Payload& payload) {
+    Stripe& stripe = stripes[(key * 0x9e3779b97f4a7c15ULL) >> 58];
+    std::lock_guard<std::mutex> guard(stripe.lock);
+    BlockEncoder *&block = stripe.blocks[key];
+    if (!block)
+        block = new BlockEncoder(key, config.resolution_ns);
+    block->add(ns, payload);
+    readings++;
+    return block->count() < STORE_BLOCK || write_block(block);
+}
+
+/**
+ * Appends a block to the current segment, starting a new one if it is full.
+ * A block that cannot be written is counted as lost and cleared all the
+ * same, so that it never grows past STORE_BLOCK, and anything a failed
+ * write left of it is cut off the segment.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Store::write_block(BlockEncoder *block) {
+    std::lock_guard<std::mutex> guard(segment_lock);
+    size_t written;
+    bool ok = true;
+    if (segment_bytes >= config.segment_size) {
+        ok = seal_segment();
+        if (ok) {
+            close(fd);
+            ok = open_segment();
+        }
+    }
+    if (ok && !block->write(fd, written)) {
+        /* A torn block would shift every later block from its index entry. */
+        int error = errno;
+        if (ftruncate(fd, segment_bytes) == 0)
+            errno = error;
+        ok = false;
+    }
+    if (!ok) {
+        lost += block->count();
+        block->clear();
+        return false;
+    }
+    const BlockHeader& header = block->block_header();
+    index.push_back({ header.key, header.min_ns, header.max_ns, segment_bytes });
+    segment_bytes += written;
+    bytes += written;
+    blocks++;
+    block->clear();
+    return true;
+}
+
+/**
+ * Writes out every open block, however few readings it holds, and syncs the
+ * segment.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Store::flush() {
+    for (Stripe& stripe : stripes) {
+        std::lock_guard<std::mutex> guard(stripe.lock);
+        for (auto& it : stripe.blocks) {
+            if (it.second->count() && !write_block(it.second))
+                return false;
+        }
+    }
+    std::lock_guard<std::mutex> guard(segment_lock);
+    return fdatasync(fd) == 0;
+}
+
+StoreStats Store::stats() {
+    StoreStats stats = { readings, blocks, bytes, lost };
+    return stats;
+}
+
+/**
+ * Calls fn for every written reading of device key (0 for all) between
+ * from_ns and to_ns inclusive, segment by segment and, within a sealed
+ * segment, device by device. Blocks whose time range
+ * does not overlap are skipped without decoding. Readings still in open
+ * blocks are not seen until flush().
+ *
+ * @return false with errno set if a segment could not be read
+ */
+bool Store::scan(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+        std::function<void(uint64_t key, uint64_t ns, const Payload& payload)> fn) {
+    BlockColumns *columns = new BlockColumns;
+    bool ok = blocks_of(from_ns, to_ns, key, [&](const BlockHeader& header, const uint8_t *body) {
+        if (!decode_block(header, body, *columns))
+            return;
+        for (size_t i = 0; i < columns->count; i++) {
+            if (columns->ns[i] >= from_ns && columns->ns[i] <= to_ns)
+                fn(header.key, columns->ns[i], block_payload(header, *columns, i));
+        }
+    });
+    delete columns;
+    return ok;
+}
+
+/**
+ * Finds the newest written time of every device, and how many of its
+ * readings have that time, from the block headers and the time columns of
+ * the newest blocks alone.
+ *
+ * @return false with errno set if a segment could not be read
+ */
+bool Store::tails(std::unordered_map<uint64_t, StoreTail>& tails) {
+    struct Newest {
+        uint64_t ns = 0;
+        std::vector<std::pair<BlockHeader, std::vector<uint8_t>>> blocks;  // Ending at ns
+    };
+    std::unordered_map<uint64_t, Newest> newest;
+    bool ok = blocks_of(0, UINT64_MAX, 0, [&](const BlockHeader& header, const uint8_t *body) {
+        Newest& device = newest[header.key];
+        if (header.max_ns < device.ns)
+            return;
+        if (header.max_ns > device.ns)
+            device.blocks.clear();
+        device.ns = header.max_ns;
+        device.blocks.push_back({ header, std::vector<uint8_t>(body, body + header.sizes[COLUMN_TIME]) });
+    });
+    if (!ok)
+        return false;
+    BlockColumns *columns = new BlockColumns;
+    for (auto& it : newest) {
+        StoreTail& tail = tails[it.first];
+        tail.ns = it.second.ns;
+        tail.count = 0;
+        for (auto& block : it.second.blocks) {
+            if (!decode_block(block.first, block.second.data(), *columns, 1 << COLUMN_TIME))
+                continue;
+            for (size_t i = 0; i < columns->count; i++)
+                tail.count += columns->ns[i] == tail.ns;
+        }
+    }
+    delete columns;
+    return true;
+}
+
+/**
+ * Calls fn for every intact block of device key (0 for all) that overlaps
+ * from_ns to to_ns, segment by segment.
+ *
+ * @return false with errno set if a segment could not be read
+ */
+bool Store::blocks_of(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+        std::function<void(const BlockHeader& header, const uint8_t *columns)> fn) {
+    for (unsigned n : list_segments()) {
+        if (!segment_blocks(n, from_ns, to_ns, key, fn))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Calls fn for every intact block of segment n, of device key (0 for all),
+ * that overlaps from_ns to to_ns. A sealed segment outside the range is
+ * skipped on its trailer alone, and otherwise searched through its index;
+ * a segment not sealed yet is read through. Safe to call from several
+ * threads at once.
+ *
+ * @return false with errno set if the segment could not be read
+ */
+bool Store::segment_blocks(unsigned n, uint64_t from_ns, uint64_t to_ns, uint64_t key,
+        std::function<void(const BlockHeader& header, const uint8_t *columns)> fn) {
+    Segment *sealed = map_segment(n);
+    if (sealed) {
+        if (sealed->overlaps(from_ns, to_ns))
+            sealed->blocks(from_ns, to_ns, key, fn);
+        return true;
+    }
+    std::vector<uint8_t> data;
+    if (!read_segment(n, data))
+        return false;
+
+    /* A torn block can only be the last one written. */
+    size_t offset = 0;
+    while (offset + sizeof(BlockHeader) <= data.size()) {
+        BlockHeader header;
+        memcpy(&header, data.data() + offset, sizeof(header));
+        const uint8_t *body = data.data() + offset + sizeof(header);
+        if (!block_valid(header, body, data.size() - offset - sizeof(header)))
+            break;
+        offset += block_size(header);
+        if ((key && header.key != key) || header.max_ns < from_ns || header.min_ns > to_ns)
+            continue;
+        fn(header, body);
+    }
+    return true;
+}
+
+/**
+ * Finds the time range of segment n from its trailer.
+ *
+ * @return false if the segment is not sealed
+ */
+bool Store::segment_range(unsigned n, uint64_t& min_ns, uint64_t& max_ns) {
+    Segment *sealed = map_segment(n);
+    if (!sealed)
+        return false;
+    min_ns = sealed->trailer.min_ns;
+    max_ns = sealed->trailer.max_ns;
+    return true;
+}
+
+/**
+ * Reads a whole segment. A segment being written may end in a torn block.
+ *
+ * @return false with errno set on error
+ */
+bool Store::read_segment(unsigned n, std::vector<uint8_t>& data) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment.%08u", config.path, n);
+    int in = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (in < 0 || fstat(in, &st) < 0) {
+        if (in >= 0)
+            close(in);
+        return false;
+    }
+    data.resize(st.st_size);
+    size_t size = 0;
+    while (size < data.size()) {
+        ssize_t r = read(in, data.data() + size, data.size() - size);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        size += r;
+    }
+    close(in);
+    data.resize(size);
+    return true;
+}
@@ -0,0 +1,168 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "../esp32/acumonitor.h"
+#include "bits.h"
+
+#define STORE_BLOCK         1024            // Readings per block, at most 65535
+#define STORE_SEGMENT_SIZE  (64 << 20)      // Start a new segment file beyond this size, in bytes
+#define STORE_RESOLUTION    1000000000ULL   // Default timestamp resolution, in ns
+#define STORE_STRIPES       64              // Locks over the open blocks
+#define BLOCK_MAGIC         0x4b425341      // "ASBK"
+#define BLOCK_VERSION       1
+
+/* Columns of a block, each encoded on its own. */
+#define COLUMN_TIME         0               // Delta of delta, Gorilla buckets
+#define COLUMN_TEMPERATURE  1               // Zigzag delta, bucketed
+#define COLUMN_HUMIDITY     2
+#define COLUMN_STATUS       3               // XOR with the previous value
+#define COLUMN_BATTERY      4
+#define COLUMN_COUNT        5
+#define COLUMNS_ALL         ((1 << COLUMN_COUNT) - 1)
+
+/*
+ * Precedes the columns of every block. Min and max let scans skip a block
+ * without decoding it; temperature and humidity only count STATUS_OK
+ * readings, and min > max when there are none.
+ */
+struct BlockHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;                 // Readings
+    uint64_t key;                   // device_key
+    uint64_t min_ns;                // CLOCK_REALTIME, rounded down to resolution
+    uint64_t max_ns;
+    uint64_t resolution_ns;
+    int16_t temperature_min;
+    int16_t temperature_max;
+    int16_t humidity_min;
+    int16_t humidity_max;
+    uint8_t battery_min;
+    uint8_t battery_max;
+    uint8_t statuses;               // Bit 1 << status for every status present
+    uint8_t reserved;
+    uint32_t sizes[COLUMN_COUNT];   // Bytes of each column, in order
+    uint32_t checksum;              // FNV-1a of the columns
+} __attribute__((packed));
+
+/* A block decoded into one array per column. */
+struct BlockColumns {
+    size_t count;
+    uint64_t ns[STORE_BLOCK];
+    int16_t temperature[STORE_BLOCK];
+    int16_t humidity[STORE_BLOCK];
+    uint8_t status[STORE_BLOCK];
+    uint8_t battery[STORE_BLOCK];
+};
+
+size_t block_size(const BlockHeader& header);
+bool block_valid(const BlockHeader& header, const uint8_t *columns, size_t available);
+bool decode_block(const BlockHeader& header, const uint8_t *columns, BlockColumns& out,
+        unsigned mask = COLUMNS_ALL);
+Payload block_payload(const BlockHeader& header, const BlockColumns& columns, size_t i);
+
+/**
+ * The open block of one device. Each reading is appended to the columns as
+ * it arrives, in O(1), so a block is ready to write the moment it fills.
+ */
+class BlockEncoder {
+    public:
+        BlockEncoder(uint64_t key, uint64_t resolution_ns);
+        void add(uint64_t ns, const Payload& payload);
+        size_t count() const { return header.count; }
+        const BlockHeader& block_header() const { return header; }
+        bool write(int fd, size_t& written);
+        void clear();
+    private:
+        BlockHeader header;
+        BitWriter columns[COLUMN_COUNT];
+        int64_t time;                   // Previous timestamp, in resolution units
+        int64_t delta;                  // Previous timestamp delta
+        int16_t temperature;
+        int16_t humidity;
+        uint8_t status;
+        uint8_t battery;
+};
+
+struct StoreConfig {
+    const char *path = NULL;            // Directory of segment files
+    uint64_t resolution_ns = STORE_RESOLUTION;
+    size_t segment_size = STORE_SEGMENT_SIZE;
+};
+
+struct StoreStats {
+    uint64_t readings;
+    uint64_t blocks;
+    uint64_t bytes;                     // Written to segments, headers included
+    uint64_t lost;                      // Readings dropped with blocks that could not be written
+};
+
+/* The newest written time of a device, and how many of its readings have it. */
+struct StoreTail {
+    uint64_t ns;
+    uint32_t count;
+};
+
+struct IndexEntry;
+class Segment;
+
+/**
+ * Append-only columnar store of readings. Every device has an open block in
+ * memory; full blocks are appended to the current segment file, and a new
+ * segment is started once it grows past segment_size. Segments are named
+ * segment.<n> and sealed with an index of their blocks when a newer one is
+ * started or the store is closed; open() seals any a crash left unsealed.
+ * Queries map sealed segments and go through their index, and only read
+ * the segment being written. Safe to append to from several threads.
+ */
+class Store {
+    public:
+        Store(const StoreConfig& config);
+        ~Store();
+        bool open();
+        bool append(uint64_t key, uint64_t ns, const Payload& payload);
+        bool flush();
+        StoreStats stats();
+        bool scan(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+                std::function<void(uint64_t key, uint64_t ns, const Payload& payload)> fn);
+        bool tails(std::unordered_map<uint64_t, StoreTail>& tails);
+        std::vector<unsigned> list_segments();
+        bool segment_blocks(unsigned n, uint64_t from_ns, uint64_t to_ns, uint64_t key,
+                std::function<void(const BlockHeader& header, const uint8_t *columns)> fn);
+        bool segment_range(unsigned n, uint64_t& min_ns, uint64_t& max_ns);
+    private:
+        struct Stripe {
+            std::mutex lock;
+            std::unordered_map<uint64_t, BlockEncoder *> blocks;
+        };
+        StoreConfig config;
+        Stripe stripes[STORE_STRIPES];
+        std::mutex segment_lock;            // Guards fd, segment, segment_bytes and index
+        int fd;
+        unsigned segment;
+        size_t segment_bytes;
+        std::vector<IndexEntry> index;      // Blocks of the current segment
+        std::mutex mapped_lock;
+        std::map<unsigned, Segment *> mapped;   // Sealed segments opened so far
+        std::atomic<uint64_t> readings;
+        std::atomic<uint64_t> blocks;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> lost;
+        bool write_block(BlockEncoder *block);
+        bool open_segment();
+        bool seal_segment();
+        bool read_segment(unsigned n, std::vector<uint8_t>& data);
+        Segment *map_segment(unsigned n);
+        bool blocks_of(uint64_t from_ns, uint64_t to_ns, uint64_t key,
+                std::function<void(const BlockHeader& header, const uint8_t *columns)> fn);
+};
+
+#endif
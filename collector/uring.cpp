@@ -0,0 +1,196 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void *arg, unsigned count) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+Uring::Uring() {
+    this->fd = -1;
+    this->features = 0;
+    this->sq_ring = MAP_FAILED;
+    this->cq_ring = MAP_FAILED;
+    this->sqes = (struct io_uring_sqe *)MAP_FAILED;
+    this->sqe_tail = 0;
+}
+
+Uring::~Uring() {
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    if (fd >= 0)
+        close(fd);
+}
+
+/**
+ * Creates the rings and maps them. Completions are only run when the thread
+ * enters the kernel to wait (IORING_SETUP_DEFER_TASKRUN) where supported.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool Uring::setup(unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    fd = io_uring_setup(entries, &params);
+    if (fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof(params));
+        fd = io_uring_setup(entries, &params);
+    }
+    if (fd < 0)
+        return false;
+    features = params.features;
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_ring_size > sq_ring_size)
+            sq_ring_size = cq_ring_size;
+        cq_ring_size = sq_ring_size;
+    }
+    sq_ring = mmap(NULL, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+        return false;
+    if (features & IORING_FEAT_SINGLE_MMAP)
+        cq_ring = sq_ring;
+    else
+        cq_ring = mmap(NULL, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+        return false;
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    uint8_t *sq = (uint8_t *)sq_ring, *cq = (uint8_t *)cq_ring;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    sq_entries = params.sq_entries;
+    sqe_tail = *sq_tail;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+/** @return a cleared SQE, or NULL if the submission ring is full */
+struct io_uring_sqe *Uring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (sqe_tail - head >= sq_entries)
+        return NULL;
+    unsigned index = sqe_tail++ & *sq_mask;
+    sq_array[index] = index;
+    memset(&sqes[index], 0, sizeof(struct io_uring_sqe));
+    return &sqes[index];
+}
+
+/**
+ * Submits the SQEs filled since the last call and waits for completions.
+ *
+ * @param wait completions to wait for, 0 to return at once
+ * @return SQEs submitted, or -1 with errno set on error
+ */
+int Uring::submit(unsigned wait) {
+    __atomic_store_n(sq_tail, sqe_tail, __ATOMIC_RELEASE);
+    int ret;
+    do {
+        unsigned count = sqe_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        ret = io_uring_enter(fd, count, wait, wait ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+/** @return the oldest unseen completion, or NULL */
+struct io_uring_cqe *Uring::peek() {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &cqes[head & *cq_mask];
+}
+
+/** Releases the completion returned by peek(). */
+void Uring::seen() {
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/** Registers buffers for IORING_OP_READ_FIXED/WRITE_FIXED, by index. */
+bool Uring::register_buffers(const struct iovec *iovecs, unsigned count) {
+    return io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs, count) == 0;
+}
+
+BufferRing::BufferRing() {
+    this->ring = (struct io_uring_buf_ring *)MAP_FAILED;
+    this->buffers = NULL;
+    this->tail = 0;
+}
+
+BufferRing::~BufferRing() {
+    if (ring != MAP_FAILED)
+        munmap(ring, ring_size);
+    delete[] buffers;
+}
+
+/**
+ * Allocates entries buffers of size bytes each and hands them all to the
+ * kernel as buffer group group. entries must be a power of two.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool BufferRing::setup(Uring& uring, unsigned entries, size_t size, uint16_t group) {
+    this->entries = entries;
+    this->size = size;
+    this->group = group;
+    ring_size = entries * sizeof(struct io_uring_buf);
+    ring = (struct io_uring_buf_ring *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    buffers = new uint8_t[entries * size];
+    for (unsigned i = 0; i < entries; i++)
+        add(i);
+    commit();
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)ring;
+    reg.ring_entries = entries;
+    reg.bgid = group;
+    return io_uring_register(uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+}
+
+/*
+ * The bufs flexible array in io_uring_buf_ring is declared after an empty
+ * struct, which takes space in C++, so the ring is indexed directly. The
+ * tail overlays the resv field of the first entry.
+ */
+static struct io_uring_buf *ring_entry(struct io_uring_buf_ring *ring, unsigned index) {
+    return (struct io_uring_buf *)ring + index;
+}
+
+/** Queues buffer id for the kernel; visible after commit(). */
+void BufferRing::add(uint16_t id) {
+    struct io_uring_buf *buf = ring_entry(ring, tail & (entries - 1));
+    buf->addr = (uint64_t)buffer(id);
+    buf->len = size;
+    buf->bid = id;
+    tail++;
+}
+
+void BufferRing::commit() {
+    __atomic_store_n(&ring_entry(ring, 0)->resv, tail, __ATOMIC_RELEASE);
+}
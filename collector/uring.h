@@ -0,0 +1,82 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Multishot receive and provided buffer rings came with the Linux 6.0 headers. */
+#ifndef IORING_RECV_MULTISHOT
+#error "io_uring headers from Linux 6.0 or later are needed"
+#endif
+
+/* Setup flags that only change how completions are run, from Linux 6.0 and
+   6.1; kernels without them reject them and setup() retries without. */
+#ifndef IORING_SETUP_SINGLE_ISSUER
+#define IORING_SETUP_SINGLE_ISSUER  (1U << 12)
+#endif
+#ifndef IORING_SETUP_DEFER_TASKRUN
+#define IORING_SETUP_DEFER_TASKRUN  (1U << 13)
+#endif
+
+/**
+ * Just enough io_uring for the collector, over the raw system calls so that
+ * liburing is not needed: one submission and one completion ring, fixed
+ * buffers and provided buffer rings. Used from a single thread.
+ */
+class Uring {
+    public:
+        Uring();
+        ~Uring();
+        bool setup(unsigned entries);
+        struct io_uring_sqe *get_sqe();
+        int submit(unsigned wait);
+        struct io_uring_cqe *peek();
+        void seen();
+        bool register_buffers(const struct iovec *iovecs, unsigned count);
+        int fd;
+        unsigned features;
+    private:
+        void *sq_ring;
+        void *cq_ring;
+        size_t sq_ring_size;
+        size_t cq_ring_size;
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_mask;
+        unsigned *sq_array;
+        unsigned sq_entries;
+        unsigned sqe_tail;          // Next free SQE, ahead of *sq_tail until submit
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned *cq_mask;
+        struct io_uring_cqe *cqes;
+};
+
+/**
+ * Ring of receive buffers registered with IORING_REGISTER_PBUF_RING. The
+ * kernel picks a buffer for each completion (IOSQE_BUFFER_SELECT) and the
+ * buffer goes back with add() and commit() once it has been consumed.
+ */
+class BufferRing {
+    public:
+        BufferRing();
+        ~BufferRing();
+        bool setup(Uring& uring, unsigned entries, size_t size, uint16_t group);
+        uint8_t *buffer(uint16_t id) { return buffers + (size_t)id * size; }
+        void add(uint16_t id);
+        void commit();
+        unsigned entries;
+        size_t size;                // Bytes per buffer
+        uint16_t group;
+    private:
+        struct io_uring_buf_ring *ring;
+        size_t ring_size;
+        uint8_t *buffers;
+        uint16_t tail;
+};
+
+#endif
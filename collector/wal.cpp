@@ -0,0 +1,337 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include "wal.h"
+
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ data[i]) * 16777619;
+    return hash;
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+Wal::Wal(const WalConfig& config) {
+    this->config = config;
+    this->fd = -1;
+    this->file = 0;
+    this->file_bytes = 0;
+    this->active_since = 0;
+    this->appended = 0;
+    this->durable = 0;
+    this->stopping = false;
+    this->failed = false;
+    this->error = 0;
+    memset(&counters, 0, sizeof(counters));
+}
+
+Wal::~Wal() {
+    close();
+}
+
+/** @return numbers of the WAL files in the directory, oldest first */
+std::vector<unsigned> Wal::list_files() {
+    std::vector<unsigned> files;
+    DIR *dir = opendir(config.path);
+    if (!dir)
+        return files;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        unsigned n;
+        char end;
+        if (sscanf(entry->d_name, "wal.%u%c", &n, &end) == 1)
+            files.push_back(n);
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void Wal::remove_files(unsigned below) {
+    for (unsigned n : list_files()) {
+        if (n >= below)
+            break;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/wal.%08u", config.path, n);
+        unlink(path);
+    }
+}
+
+bool Wal::open_file() {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/wal.%08u", config.path, ++file);
+    fd = ::open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+    file_bytes = 0;
+    return fd >= 0;
+}
+
+/**
+ * Replays the readings of every intact frame. Frames are checked in one
+ * pass, then replay_threads threads go through all of them, each taking the
+ * devices that hash to it, so every device is replayed in order.
+ */
+bool Wal::replay_files(const std::vector<unsigned>& files, std::function<void(const Reading&)> fn) {
+    struct Mapping {
+        void *data;
+        size_t size;
+    };
+    std::vector<Mapping> mappings;
+    std::vector<std::pair<const Reading *, size_t>> frames;
+    bool ok = true;
+    for (unsigned n : files) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/wal.%08u", config.path, n);
+        int in = ::open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (in < 0 || fstat(in, &st) < 0) {
+            ok = false;
+            if (in >= 0)
+                ::close(in);
+            break;
+        }
+        if (st.st_size == 0) {
+            ::close(in);
+            continue;
+        }
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, in, 0);
+        ::close(in);
+        if (data == MAP_FAILED) {
+            ok = false;
+            break;
+        }
+        mappings.push_back({ data, (size_t)st.st_size });
+
+        /* Only the last frame can be torn, by a crash during its commit. */
+        const uint8_t *p = (const uint8_t *)data, *end = p + st.st_size;
+        while (p + sizeof(WalFrame) <= end) {
+            WalFrame frame;
+            memcpy(&frame, p, sizeof(frame));
+            size_t size = (size_t)frame.count * sizeof(Reading);
+            if (frame.magic != WAL_MAGIC || size > (size_t)(end - p) - sizeof(frame) ||
+                    fnv1a(p + sizeof(frame), size) != frame.checksum)
+                break;
+            frames.push_back({ (const Reading *)(p + sizeof(frame)), (size_t)frame.count });
+            p += sizeof(frame) + size;
+        }
+    }
+
+    int threads = std::max(config.replay_threads, 1);
+    std::vector<std::thread> workers;
+    std::atomic<uint64_t> replayed(0);
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]() {
+            uint64_t n = 0;
+            for (auto& frame : frames) {
+                for (size_t i = 0; i < frame.second; i++) {
+                    const Reading& r = frame.first[i];
+                    uint64_t key = device_key(r.node, r.payload.model, r.payload.device);
+                    if ((key * 0x9e3779b97f4a7c15ULL >> 32) % threads != (uint64_t)t)
+                        continue;
+                    fn(r);
+                    n++;
+                }
+            }
+            replayed += n;
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    for (Mapping& m : mappings)
+        munmap(m.data, m.size);
+    counters.replayed = replayed;
+    return ok;
+}
+
+/** @return true if an earlier run left files for open() to replay */
+bool Wal::pending() {
+    return !list_files().empty();
+}
+
+/**
+ * Replays whatever earlier runs left, checkpoints it, removes the old files
+ * and starts the committer on a new file.
+ *
+ * @param replay receives each reading found; called from several threads
+ * @param checkpoint makes every reading handed to the store so far durable
+ * @return true on success, false with errno set on failure
+ */
+bool Wal::open(std::function<void(const Reading&)> replay, std::function<bool()> checkpoint) {
+    this->checkpoint = checkpoint;
+    if (mkdir(config.path, 0755) < 0 && errno != EEXIST)
+        return false;
+    std::vector<unsigned> files = list_files();
+    file = files.empty() ? 0 : files.back();
+    if (!files.empty()) {
+        if (!replay_files(files, replay) || !checkpoint())
+            return false;
+        remove_files(file + 1);
+    }
+    if (!open_file())
+        return false;
+    committer = std::thread(&Wal::run, this);
+    return true;
+}
+
+/**
+ * Adds readings to the next commit. Waits only if the committer is far
+ * behind.
+ *
+ * @param sequence set to the number to wait() on for these readings
+ * @return false with errno set if the WAL has failed
+ */
+bool Wal::append(const Reading *readings, size_t count, uint64_t *sequence) {
+    std::unique_lock<std::mutex> guard(lock);
+    space.wait(guard, [&]() { return failed || stopping || active.size() < 4 * config.commit_bytes; });
+    if (failed) {
+        errno = error;
+        return false;
+    }
+    bool first = active.empty();
+    if (first)
+        active_since = monotonic_ns();
+    const uint8_t *data = (const uint8_t *)readings;
+    active.insert(active.end(), data, data + count * sizeof(Reading));
+    appended += count;
+    if (sequence)
+        *sequence = appended;
+    if (first || active.size() >= config.commit_bytes)
+        ready.notify_one();
+    return true;
+}
+
+/**
+ * Waits until the readings up to sequence are durable.
+ *
+ * @return false with errno set if the WAL failed first
+ */
+bool Wal::wait(uint64_t sequence) {
+    std::unique_lock<std::mutex> guard(lock);
+    durable_cv.wait(guard, [&]() { return failed || durable >= sequence; });
+    if (durable >= sequence)
+        return true;
+    errno = error;
+    return false;
+}
+
+/** Writes one frame and syncs it, starting a new file and checkpointing when full. */
+bool Wal::commit(const uint8_t *data, size_t size, uint64_t sequence) {
+    WalFrame frame;
+    frame.magic = WAL_MAGIC;
+    frame.count = size / sizeof(Reading);
+    frame.sequence = sequence;
+    frame.checksum = fnv1a(data, size);
+    frame.reserved = 0;
+    if (!write_all(fd, (const uint8_t *)&frame, sizeof(frame)) || !write_all(fd, data, size))
+        return false;
+    if (fdatasync(fd) < 0)
+        return false;
+    file_bytes += sizeof(frame) + size;
+    if (file_bytes < config.file_size)
+        return true;
+    ::close(fd);
+    if (!open_file() || !checkpoint())
+        return false;
+    remove_files(file);
+    return true;
+}
+
+/** The committer thread. */
+void Wal::run() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        ready.wait(guard, [&]() { return stopping || !active.empty(); });
+        if (active.empty())
+            break;
+        auto deadline = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(active_since)) +
+            std::chrono::microseconds(config.commit_us);
+        ready.wait_until(guard, deadline, [&]() { return stopping || active.size() >= config.commit_bytes; });
+        active.swap(committing);
+        uint64_t since = active_since;
+        uint64_t sequence = appended - committing.size() / sizeof(Reading);
+        uint64_t count = committing.size() / sizeof(Reading);
+        space.notify_all();
+        guard.unlock();
+        bool ok = commit(committing.data(), committing.size(), sequence);
+        int commit_error = errno;
+        uint64_t latency = monotonic_ns() - since;
+        guard.lock();
+        committing.clear();
+        if (!ok) {
+            failed = true;
+            error = commit_error;
+            space.notify_all();
+            durable_cv.notify_all();
+            break;
+        }
+        durable = sequence + count;
+        counters.readings += count;
+        counters.commits++;
+        counters.bytes += sizeof(WalFrame) + count * sizeof(Reading);
+        counters.latency_ns += latency;
+        counters.max_latency_ns = std::max(counters.max_latency_ns, latency);
+        durable_cv.notify_all();
+    }
+}
+
+/**
+ * Commits what is left and stops the committer, then checkpoints and removes
+ * every file, so the next open() has nothing to replay.
+ *
+ * @return false with errno set if any commit or the checkpoint failed
+ */
+bool Wal::close() {
+    if (!committer.joinable())
+        return !failed;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    ready.notify_all();
+    space.notify_all();
+    committer.join();
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+    if (!failed && !checkpoint()) {
+        failed = true;
+        error = errno;
+    }
+    if (failed) {
+        errno = error;
+        return false;
+    }
+    remove_files(file + 1);
+    return true;
+}
+
+WalStats Wal::stats() {
+    std::lock_guard<std::mutex> guard(lock);
+    return counters;
+}
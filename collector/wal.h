@@ -0,0 +1,107 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../esp32/acumonitor.h"
+#include "latest.h"
+
+#define WAL_COMMIT_US       10000           // Default longest wait before a commit, in us
+#define WAL_COMMIT_BYTES    (256 << 10)     // Default commit size, in bytes
+#define WAL_FILE_SIZE       (64 << 20)      // Checkpoint and start a new file beyond this size
+#define WAL_MAGIC           0x46575341      // "ASWF"
+
+/* A reading as appended to the log and the WAL. */
+struct Reading {
+    uint64_t ns;
+    uint32_t node;
+    Payload payload;
+} __attribute__((packed));
+
+/* One group commit: a header and count readings. */
+struct WalFrame {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t sequence;              // Readings appended before this frame
+    uint32_t checksum;              // FNV-1a of the readings
+    uint32_t reserved;
+} __attribute__((packed));
+
+struct WalConfig {
+    const char *path = NULL;        // Directory of wal.<n> files
+    uint32_t commit_us = WAL_COMMIT_US;
+    size_t commit_bytes = WAL_COMMIT_BYTES;
+    size_t file_size = WAL_FILE_SIZE;
+    int replay_threads = 1;
+};
+
+struct WalStats {
+    uint64_t readings;              // Committed
+    uint64_t commits;
+    uint64_t bytes;
+    uint64_t latency_ns;            // Sum over commits, from first append to durable
+    uint64_t max_latency_ns;
+    uint64_t replayed;              // Readings replayed by open()
+};
+
+/**
+ * Write-ahead log in front of the store. Any number of threads append
+ * readings to one shared buffer; a committer thread writes and syncs the
+ * buffer as one frame once commit_us has passed since its first reading or
+ * commit_bytes have gathered, whichever is first, so the cost of fdatasync
+ * is shared by everything that arrived meanwhile. Appenders never wait for
+ * a commit unless the buffer grows to four times commit_bytes.
+ *
+ * Readings must be in the store (in memory is enough) before they are
+ * appended here. Then, when a file fills, a new one is started and the
+ * checkpoint callback (a store flush) makes every earlier file redundant.
+ * A reading may then be both in the store and in a newer file, and blocks
+ * written since the last checkpoint may have survived a crash, so replay
+ * must skip what the store already holds. close() checkpoints and removes
+ * every file.
+ */
+class Wal {
+    public:
+        Wal(const WalConfig& config);
+        ~Wal();
+        bool pending();
+        bool open(std::function<void(const Reading&)> replay, std::function<bool()> checkpoint);
+        bool append(const Reading *readings, size_t count, uint64_t *sequence = NULL);
+        bool wait(uint64_t sequence);
+        bool close();
+        WalStats stats();
+    private:
+        WalConfig config;
+        std::function<bool()> checkpoint;
+        int fd;
+        unsigned file;                      // Number of the file being written
+        size_t file_bytes;
+        std::mutex lock;
+        std::condition_variable ready;      // Signals the committer
+        std::condition_variable space;      // Signals appenders waiting for room
+        std::condition_variable durable_cv;
+        std::vector<uint8_t> active;        // Readings appended since the last swap
+        std::vector<uint8_t> committing;
+        uint64_t active_since;              // CLOCK_MONOTONIC of the first reading in active
+        uint64_t appended;                  // Readings appended
+        uint64_t durable;                   // Readings committed
+        bool stopping;
+        bool failed;
+        int error;                          // errno of the failure
+        std::thread committer;
+        WalStats counters;
+        void run();
+        bool commit(const uint8_t *data, size_t size, uint64_t sequence);
+        bool open_file();
+        bool replay_files(const std::vector<unsigned>& files, std::function<void(const Reading&)> fn);
+        std::vector<unsigned> list_files();
+        void remove_files(unsigned below);
+};
+
+#endif
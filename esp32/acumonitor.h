@@ -1,8 +1,18 @@
+#ifndef ACUMONITOR_H
+#define ACUMONITOR_H
+
 #include <stdint.h>
 #include <vector>
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include "hostserial.h"
+#endif
 
 /* All network packets must be prefixed with this value. */
 #define TAG_TEMPMONITOR 0x38073162
+#define TAG_RAWWORD     0x38073163      // RawWord instead of Payload
+#define TAG_RAWFRAME    0x38073164      // RawFrame instead of Payload
 
 /* Models */
 #define MODEL_ACURITE523  1592
@@ -31,6 +41,83 @@ struct Payload {
     int16_t humidity;
 } __attribute__((packed));
 
+/*
+ * A word parse_rf completed but no device validated, forwarded for the
+ * collector to combine with other receivers' copies of the transmission.
+ * Each bit's confidence runs from 0 (its pulses were on a window edge) to 3
+ * (centred); bit i of confidence[0] and confidence[1] are its low and high
+ * bits.
+ */
+struct RawWord {
+    uint32_t tag;
+    uint16_t model;
+    uint8_t bits;           // ACURITE523_SIGNAL_BIT_LENGTH or ACURITE609_SIGNAL_BIT_LENGTH
+    uint8_t reserved;
+    uint64_t word;
+    uint64_t confidence[2];
+} __attribute__((packed));
+
+/*
+ * Every word parse_rf completed, unvalidated, from a node that leaves all
+ * validation to the collector. Only the first count entries are sent, so a
+ * frame is 8 + 14 * count bytes on the wire.
+ */
+#define RAWFRAME_WORDS 32
+
+struct RawFrameWord {
+    uint64_t word;
+    uint32_t us;            // Node clock when parse_rf returned the word
+    uint16_t model;
+} __attribute__((packed));
+
+struct RawFrame {
+    uint32_t tag;
+    uint16_t count;
+    uint16_t reserved;
+    RawFrameWord words[RAWFRAME_WORDS];
+} __attribute__((packed));
+
+#define RAWFRAME_SIZE(count) (sizeof(RawFrame) - sizeof(RawFrameWord) * (RAWFRAME_WORDS - (count)))
+
+/* get_rfs_type windows, in microseconds. thresholds.h, generated from
+   recorded pulses by rpi/acutune, replaces the defaults below. */
+#if __has_include("thresholds.h")
+#include "thresholds.h"
+#endif
+#ifndef ACURITE523_OFF_WINDOWS
+#define ACURITE523_OFF_WINDOWS      { 100, 300, 500, 700 }
+#define ACURITE523_ON_WINDOWS       { 100, 300, 500, 700 }
+#define ACURITE523_CHUNK_END_WINDOW { 20000, 60000 }
+#endif
+#ifndef ACURITE609_OFF_MAX
+#define ACURITE609_OFF_MAX          1200
+#define ACURITE609_ON_WINDOWS       { 300, 1200, 3000 }
+#define ACURITE609_START_WINDOW     { 8700, 9000 }
+#define ACURITE609_END_WINDOW       { 10000, 20000 }
+#define ACURITE609_CHUNK_END_WINDOW { 20000, 40000 }
+#endif
+
+/* A single contiguous RF level as passed to parse_rf. */
+struct Pulse {
+    uint32_t duration;      // Microseconds
+    uint8_t rfs;            // Signal level, inverted pin value
+};
+
+/** @return how well duration sits inside the window from lo to hi, 0 (at an edge) to 3 */
+static inline uint8_t window_confidence(uint32_t duration, uint32_t lo, uint32_t hi) {
+    if (duration < lo || duration >= hi)
+        return 0;
+    uint32_t margin = duration - lo < hi - duration ? duration - lo : hi - duration;
+    uint32_t level = margin * 8 / (hi - lo);
+    return level > 3 ? 3 : level;
+}
+
+/** Sets the 2-bit confidence of bit in the two planes of a RawWord's confidence. */
+static inline void set_confidence(uint64_t *planes, int bit, uint8_t confidence) {
+    planes[0] |= (uint64_t)(confidence & 1) << bit;
+    planes[1] |= (uint64_t)(confidence >> 1) << bit;
+}
+
 class Acurite {
     public:
         Acurite() { }
@@ -47,6 +134,8 @@ class Acurite {
                 std::vector<Device> devices;
                 virtual void clear() = 0;
                 virtual uint64_t parse_rf(uint32_t duration, uint8_t rfs) = 0;
+                virtual bool is_noise(uint32_t duration, uint8_t rfs) = 0;
+                virtual bool is_preamble(uint32_t duration, uint8_t rfs) = 0;
         };
 };
 
@@ -65,6 +154,12 @@ class Acurite {
 
 class Acurite523 : public Acurite {
     public:
+        /* Signal types are delimited by consecutive window edges. */
+        struct Windows {
+            uint32_t off[4];        // BIT_0_OFF, BIT_1_OFF, BITSTREAM_OFF
+            uint32_t on[4];         // BIT_1_ON, BIT_0_ON, BITSTREAM_ON
+            uint32_t chunk_end[2];
+        };
         class Device : public Acurite::Device {
             public:
                 Device(uint16_t device);
@@ -83,10 +178,16 @@ class Acurite523 : public Acurite {
                 Model(std::vector<Device> devices);
                 void clear() override;
                 uint64_t parse_rf(uint32_t duration, uint8_t rfs) override;
+                bool is_noise(uint32_t duration, uint8_t rfs) override;
+                bool is_preamble(uint32_t duration, uint8_t rfs) override;
+                Windows windows;
+                uint64_t confidence[2]; // Of the last word parse_rf returned, as in RawWord
             private:
                 bool is_acurite;
                 bool chunk_open;
                 uint64_t bitstream;     // Will contain all bits received in a single bitstream
+                uint64_t bitstream_confidence[2];
+                uint32_t last_duration;
                 int bitstream_size;     // Size in bits of current bitstream
                 bool bitstream_open;
                 /* 4 contiguous opener signals mark the start of a bitstream. */
@@ -115,6 +216,13 @@ class Acurite523 : public Acurite {
 
 class Acurite609 : public Acurite {
     public:
+        struct Windows {
+            uint32_t off_max;       // Any shorter rfs=0 pulse is SIGNAL_OFF
+            uint32_t on[3];         // Upper edges of CHUNK_START, BIT_0, BIT_1
+            uint32_t start[2];
+            uint32_t end[2];
+            uint32_t chunk_end[2];
+        };
         class Device : public Acurite::Device {
             public:
                 Device(uint16_t device);
@@ -133,8 +241,13 @@ class Acurite609 : public Acurite {
                 Model(std::vector<Device> devices);
                 void clear() override;
                 uint64_t parse_rf(uint32_t duration, uint8_t rfs) override;
+                bool is_noise(uint32_t duration, uint8_t rfs) override;
+                bool is_preamble(uint32_t duration, uint8_t rfs) override;
+                Windows windows;
+                uint64_t confidence[2]; // Of the last word parse_rf returned, as in RawWord
             private:
                 uint64_t bitstream;     // Will contain all bits received in a single bitstream
+                uint64_t bitstream_confidence[2];
                 int bitstream_size;     // Size in bits of current bitstream
                 int last_rfs_type;
                 bool is_acurite;
@@ -149,3 +262,4 @@ class Acurite609 : public Acurite {
         };
 };
 
+#endif
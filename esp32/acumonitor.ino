@@ -1,4 +1,5 @@
 #include "acumonitor.h"
+#include "pipeline.h"
 
 #define PIN_RX 10
 
@@ -13,66 +14,56 @@ Acurite609::Model acurite609({ outdoor });
 int prevRfs = -1;
 uint32_t start = micros(); // Start time of contiguous pulse
 
-void setup() {
+void updateStats(Payload& payload) {
+  /* ... do something with payload ... */
 }
 
-void updateStats(Acurite::Device& device) {
-  Payload *payload = device.create_payload(STATUS_OK);
-  /* ... do something with payload ... */
-  delete payload;
+void forwardRaw(RawWord& word) {
+  /* ... send to the collector along with the payloads, or drop ... */
 }
 
-bool parseRf(uint32_t duration, uint8_t rfs) {
-  uint64_t result;
-  if (result = acurite523.parse_rf(duration, rfs)) {
-    for (Acurite523::Device device : acurite523.devices) {
-      if (device.validate_bitstream(result)) {
-        updateStats(device);
-        return true;
-      }
-    }
-  }
-  if (result = acurite609.parse_rf(duration, rfs)) {
-    for (Acurite609::Device device : acurite609.devices) {
-      if (device.validate_bitstream(result)) {
-        updateStats(device);
-        return true;
-      }
-    }
-  }
-  return false;
+void forwardFrame(RawFrame& frame) {
+  /* ... send the first RAWFRAME_SIZE(frame.count) bytes to the collector ... */
 }
 
-void resetRf() {
-  acurite523.clear();
-  acurite609.clear();
-  start = micros();
+void printHistogram(PulseHistogram& histogram) {
+  histogram.print(Serial);
+}
+
+// Decoding and publishing run as tasks on the other core. For a thin node
+// that leaves validation to the collector, construct it with forwardFrame
+// alone: Pipeline pipeline(acurite523, acurite609, forwardFrame);
+Pipeline pipeline(acurite523, acurite609, updateStats, forwardRaw);
+
+void setup() {
+  Serial.begin(115200);
+  pipeline.start();
 }
 
 void loop() {
-  /* Read a continous stream of RF pulses until valid temperature data is
-     received. Performs analog to digital conversion in each read via the 
-     model-specific parsing function. The parsing function attempts to 
-     filter out any noise and build a valid bitstream of binary data comprising 
-     the temperature, humidity, etc.
+  /* Read a continous stream of RF pulses and queue them for the decode task,
+     which performs analog to digital conversion via the model-specific 
+     parsing function. The parsing function attempts to filter out any noise 
+     and build a valid bitstream of binary data comprising the temperature, 
+     humidity, etc.
      */
   int rfs = 0;
   uint32_t now = 0;
   uint32_t duration = 0;
 
-  // Read until a valid bitstream is received
   rfs = digitalRead(PIN_RX) ^ 1;
   now = micros();
   if (prevRfs >= 0 && rfs != prevRfs) {
     duration = now - start;
-    if (duration >= 100) {
-      // Parse model-specific RF pulses
-      if (parseRf(duration, prevRfs))
-        resetRf();
-    }
+    if (duration >= 100)
+      pipeline.capture(duration, prevRfs);
   }
   if (rfs != prevRfs)
     start = now;
   prevRfs = rfs;
-}
 
+  // Send 'h' over serial for a pulse width histogram, printed by the publish
+  // task so that capture never waits on Serial
+  if (Serial.available() && Serial.read() == 'h')
+    pipeline.request_histogram(printHistogram);
+}
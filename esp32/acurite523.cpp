@@ -1,3 +1,4 @@
+#include <string.h>
 #include "acumonitor.h"
 
 /**
@@ -5,6 +6,11 @@
  */
 Acurite523::Model::Model(std::vector<Acurite523::Device> devices) {
     this->devices = devices;
+    this->windows = { ACURITE523_OFF_WINDOWS, ACURITE523_ON_WINDOWS, ACURITE523_CHUNK_END_WINDOW };
+    this->chunk_open = false;
+    this->confidence[0] = 0;
+    this->confidence[1] = 0;
+    clear();
 }
 
 void Acurite523::Model::clear() {
@@ -13,6 +19,9 @@ void Acurite523::Model::clear() {
     this->last_rfs_type = ACURITE523_SIGNAL_INV;
     this->bitstream_open = false;
     this->bitstream_opener_count = 0;
+    this->bitstream_confidence[0] = 0;
+    this->bitstream_confidence[1] = 0;
+    this->last_duration = 0;
     // Do not reset chunk variables
 }
 
@@ -24,21 +33,21 @@ int Acurite523::Model::get_rfs_type(uint8_t rfs, uint32_t duration) {
        :rtype: int
        */
     if (rfs == 0) {
-        if (duration >= 100 && duration < 300)
+        if (duration >= windows.off[0] && duration < windows.off[1])
             return ACURITE523_SIGNAL_BIT_0_OFF;
-        else if (duration >= 300 && duration < 500)
+        else if (duration >= windows.off[1] && duration < windows.off[2])
             return ACURITE523_SIGNAL_BIT_1_OFF;
-        else if (duration >= 500 && duration < 700)
+        else if (duration >= windows.off[2] && duration < windows.off[3])
             return ACURITE523_SIGNAL_BITSTREAM_OFF;
     }
     else if (rfs == 1) {
-        if (duration >= 100 && duration < 300)
+        if (duration >= windows.on[0] && duration < windows.on[1])
             return ACURITE523_SIGNAL_BIT_1_ON;
-        else if (duration >= 300 && duration < 500)
+        else if (duration >= windows.on[1] && duration < windows.on[2])
             return ACURITE523_SIGNAL_BIT_0_ON;
-        else if (duration >= 500 && duration < 700)
+        else if (duration >= windows.on[2] && duration < windows.on[3])
             return ACURITE523_SIGNAL_BITSTREAM_ON;
-        else if (duration >= 20000 && duration < 60000)
+        else if (duration >= windows.chunk_end[0] && duration < windows.chunk_end[1])
             return ACURITE523_SIGNAL_CHUNK_END;
     }
     return ACURITE523_SIGNAL_INV;
@@ -52,13 +61,28 @@ bool Acurite523::Model::is_bit_signal(int rfs_type) {
         rfs_type == ACURITE523_SIGNAL_BIT_1_ON;
 }
 
+/** True if the pulse fits none of this model's signal windows. */
+bool Acurite523::Model::is_noise(uint32_t duration, uint8_t rfs) {
+    return get_rfs_type(rfs, duration) == ACURITE523_SIGNAL_INV;
+}
+
+/** True if the pulse could belong to the 4 opener pairs of a bitstream. */
+bool Acurite523::Model::is_preamble(uint32_t duration, uint8_t rfs) {
+    int rfs_type = get_rfs_type(rfs, duration);
+    return rfs_type == ACURITE523_SIGNAL_BITSTREAM_OFF || rfs_type == ACURITE523_SIGNAL_BITSTREAM_ON;
+}
+
 void Acurite523::Model::open_bitstream() {
+    bitstream_confidence[0] = 0;
+    bitstream_confidence[1] = 0;
     bitstream_open = true;
     bitstream_size = 0;
     bitstream = 0;
 }
 
 void Acurite523::Model::close_bitstream() {
+    bitstream_confidence[0] = 0;
+    bitstream_confidence[1] = 0;
     bitstream_open = false;
     bitstream_size = 0;
     bitstream = 0;
@@ -91,36 +115,48 @@ uint64_t Acurite523::Model::parse_rf(uint32_t duration, uint8_t rfs) {
     }
     else if (last_rfs_type == ACURITE523_SIGNAL_BIT_0_OFF && chunk_open) {
         if (rfs_type == ACURITE523_SIGNAL_BIT_0_ON && bitstream_size < ACURITE523_SIGNAL_BIT_LENGTH) {
+            uint8_t c0 = window_confidence(last_duration, windows.off[0], windows.off[1]);
+            uint8_t c1 = window_confidence(duration, windows.on[1], windows.on[2]);
+            set_confidence(bitstream_confidence, ACURITE523_SIGNAL_BIT_LENGTH - bitstream_size - 1, c0 < c1 ? c0 : c1);
             bitstream_size += 1;
             if (bitstream_size == ACURITE523_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
                 close_bitstream();
             }
         }
         else if (rfs_type == ACURITE523_SIGNAL_BIT_1_ON && bitstream_size == ACURITE523_SIGNAL_BIT_LENGTH) {
             // Bitstream end
             result = bitstream;
+            memcpy(confidence, bitstream_confidence, sizeof(confidence));
             close_bitstream();
         }
         else if (rfs_type == ACURITE523_SIGNAL_CHUNK_END) {
             // Chunk end
-            if (bitstream_size == ACURITE523_SIGNAL_BIT_LENGTH)
+            if (bitstream_size == ACURITE523_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
+            }
             close_chunk();
         }
         bitstream_opener_count = 0;
     }
     else if (last_rfs_type == ACURITE523_SIGNAL_BIT_1_OFF && chunk_open) {
         if (rfs_type == ACURITE523_SIGNAL_BIT_1_ON && bitstream_size < ACURITE523_SIGNAL_BIT_LENGTH) {
+            uint8_t c0 = window_confidence(last_duration, windows.off[1], windows.off[2]);
+            uint8_t c1 = window_confidence(duration, windows.on[0], windows.on[1]);
             bitstream |= ((uint64_t)1L << (ACURITE523_SIGNAL_BIT_LENGTH - bitstream_size - 1));
+            set_confidence(bitstream_confidence, ACURITE523_SIGNAL_BIT_LENGTH - bitstream_size - 1, c0 < c1 ? c0 : c1);
             bitstream_size += 1;
             if (bitstream_size == ACURITE523_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
                 close_bitstream();
             }
         }
     }
     last_rfs_type = rfs_type;
+    last_duration = duration;
 
     // Done
     return result;
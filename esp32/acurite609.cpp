@@ -1,3 +1,4 @@
+#include <string.h>
 #include "acumonitor.h"
 
 /**
@@ -5,6 +6,14 @@
  */
 Acurite609::Model::Model(std::vector<Acurite609::Device> devices) {
     this->devices = devices;
+    this->windows = {
+        ACURITE609_OFF_MAX, ACURITE609_ON_WINDOWS, ACURITE609_START_WINDOW,
+        ACURITE609_END_WINDOW, ACURITE609_CHUNK_END_WINDOW
+    };
+    this->chunk_open = false;
+    this->confidence[0] = 0;
+    this->confidence[1] = 0;
+    clear();
 }
 
 void Acurite609::Model::clear() {
@@ -12,6 +21,8 @@ void Acurite609::Model::clear() {
     bitstream_size = 0; // Size in bits of current bitstream
     last_rfs_type = ACURITE609_SIGNAL_INV;
     bitstream_open = false;
+    bitstream_confidence[0] = 0;
+    bitstream_confidence[1] = 0;
     // Only manually reset chunk status in parse_rf
 }
 
@@ -24,21 +35,21 @@ int Acurite609::Model::get_rfs_type(uint8_t rfs, uint32_t duration) {
     :rtype: int
     */
     if (rfs == 0) {
-        if (duration < 1200)
+        if (duration < windows.off_max)
             return ACURITE609_SIGNAL_OFF;
     }
     else if (rfs == 1) {
-        if (duration < 300)
+        if (duration < windows.on[0])
             return ACURITE609_SIGNAL_CHUNK_START;
-        else if (duration >= 300 && duration < 1200)
+        else if (duration >= windows.on[0] && duration < windows.on[1])
             return ACURITE609_SIGNAL_BIT_0;
-        else if (duration >= 1200 && duration < 3000)
+        else if (duration >= windows.on[1] && duration < windows.on[2])
             return ACURITE609_SIGNAL_BIT_1;
-        else if (duration >= 8700 && duration < 9000)
+        else if (duration >= windows.start[0] && duration < windows.start[1])
             return ACURITE609_SIGNAL_BITSTREAM_START;
-        else if (duration >= 10000 && duration < 20000)
+        else if (duration >= windows.end[0] && duration < windows.end[1])
             return ACURITE609_SIGNAL_BITSTREAM_END;
-        else if (duration >= 20000 && duration < 40000)
+        else if (duration >= windows.chunk_end[0] && duration < windows.chunk_end[1])
             return ACURITE609_SIGNAL_CHUNK_END;
     }
     return ACURITE609_SIGNAL_INV;
@@ -48,13 +59,27 @@ bool Acurite609::Model::is_bit_signal(int rfs_type) {
     return rfs_type == ACURITE609_SIGNAL_BIT_0 || rfs_type == ACURITE609_SIGNAL_BIT_1;
 }
 
+/** True if the pulse fits none of this model's signal windows. */
+bool Acurite609::Model::is_noise(uint32_t duration, uint8_t rfs) {
+    return get_rfs_type(rfs, duration) == ACURITE609_SIGNAL_INV;
+}
+
+/** True if the pulse could be the long start pulse of a block. */
+bool Acurite609::Model::is_preamble(uint32_t duration, uint8_t rfs) {
+    return get_rfs_type(rfs, duration) == ACURITE609_SIGNAL_BITSTREAM_START;
+}
+
 void Acurite609::Model::open_bitstream() {
+    bitstream_confidence[0] = 0;
+    bitstream_confidence[1] = 0;
     bitstream_open = true;
     bitstream_size = 0;
     bitstream = 0;
 }
 
 void Acurite609::Model::close_bitstream() {
+    bitstream_confidence[0] = 0;
+    bitstream_confidence[1] = 0;
     bitstream_open = false;
     bitstream_size = 0;
     bitstream = 0;
@@ -83,27 +108,39 @@ uint64_t Acurite609::Model::parse_rf(uint32_t duration, uint8_t rfs) {
     }
     else if (last_rfs_type == ACURITE609_SIGNAL_OFF && chunk_open) {
         if (rfs_type == ACURITE609_SIGNAL_BITSTREAM_START && !bitstream_open) {
-            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH)
+            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
+            }
             open_bitstream();
         }
         else if (rfs_type == ACURITE609_SIGNAL_BITSTREAM_END && bitstream_open) {
-            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH)
+            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
+            }
             close_bitstream();
         }
         else if (rfs_type == ACURITE609_SIGNAL_CHUNK_END) {
             last_rfs_type = rfs_type;
-            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH)
+            if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
+            }
             close_chunk();
         }
         else if (is_bit_signal(rfs_type) && bitstream_open) {
-            if (rfs_type == ACURITE609_SIGNAL_BIT_1 && bitstream_size < ACURITE609_SIGNAL_BIT_LENGTH)
-                bitstream |= ((uint64_t)1L << (ACURITE609_SIGNAL_BIT_LENGTH - bitstream_size - 1));
+            int bit = ACURITE609_SIGNAL_BIT_LENGTH - bitstream_size - 1;
+            if (rfs_type == ACURITE609_SIGNAL_BIT_1 && bitstream_size < ACURITE609_SIGNAL_BIT_LENGTH) {
+                bitstream |= ((uint64_t)1L << bit);
+                set_confidence(bitstream_confidence, bit, window_confidence(duration, windows.on[1], windows.on[2]));
+            }
+            else if (bitstream_size < ACURITE609_SIGNAL_BIT_LENGTH)
+                set_confidence(bitstream_confidence, bit, window_confidence(duration, windows.on[0], windows.on[1]));
             bitstream_size += 1;
             if (bitstream_size == ACURITE609_SIGNAL_BIT_LENGTH) {
                 result = bitstream;
+                memcpy(confidence, bitstream_confidence, sizeof(confidence));
                 close_bitstream();
             }
         }
@@ -0,0 +1,111 @@
+/**
+ * Runs the ESP32 capture/decode/publish pipeline on std::threads and reports
+ * throughput and queue depths. Unless pulses are dropped, exits with an
+ * error if either model decoded other than every reading in the stream.
+ *
+ * Usage: pipeline_bench [-n pulses] [-g gap] [-d] [-t]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../pipeline.h"
+#include "synth.h"
+
+static uint64_t published = 0;
+static uint64_t published_523 = 0;
+static uint64_t frames = 0;
+
+static void count_payload(Payload& payload) {
+    published++;
+    if (payload.model == MODEL_ACURITE523)
+        published_523++;
+}
+
+static void count_frame(RawFrame& frame) {
+    frames++;
+    published += frame.count;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t count = 10000000;
+    size_t gap = 2000;
+    bool drop = false;
+    bool thin = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:g:dt")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                gap = strtoul(optarg, NULL, 10);
+                break;
+            case 'd':
+                drop = true;
+                break;
+            case 't':
+                thin = true;
+                break;
+            default:
+                fprintf(stderr, "usage: pipeline_bench [-n pulses] [-g gap] [-d] [-t]\n"
+                        "  -d   drop pulses when decode is behind instead of waiting\n"
+                        "  -t   forward raw frames instead of validating on the node\n");
+                return 1;
+        }
+    }
+    Serial.out = NULL;
+    SynthCounts chunks;
+    std::vector<Pulse> pulses = synth_stream(count, gap, 1, &chunks);
+
+    Acurite523::Model acurite523({ Acurite523::Device(DEVICE_FREEZER), Acurite523::Device(DEVICE_FRIDGE) });
+    Acurite609::Model acurite609({ Acurite609::Device(DEVICE_OUTDOOR) });
+    Pipeline thin_pipeline(acurite523, acurite609, count_frame);
+    Pipeline full_pipeline(acurite523, acurite609, count_payload);
+    Pipeline& pipeline = thin ? thin_pipeline : full_pipeline;
+    pipeline.start();
+    uint64_t stalls = 0;
+    double t0 = now();
+    for (Pulse& p : pulses) {
+        // Wait for room rather than drop, unless measuring loss
+        while (!drop && pipeline.pulses.size() == PIPELINE_PULSE_QUEUE)
+            stalls++;
+        pipeline.capture(p.duration, p.rfs);
+    }
+    pipeline.stop();
+    double secs = now() - t0;
+
+    printf("pulses      %zu in %.3fs, %.2f Mpulses/s\n", pulses.size(), secs, pulses.size() / secs / 1e6);
+    printf("decoded     %u\n", pipeline.pulses_decoded.load());
+    if (thin)
+        printf("forwarded   %llu words in %llu frames, %u frames dropped\n", (unsigned long long)published,
+                (unsigned long long)frames, pipeline.frames_dropped.load());
+    else
+        printf("published   %llu, %llu 00523 and %llu 00609\n", (unsigned long long)published,
+                (unsigned long long)published_523, (unsigned long long)(published - published_523));
+    printf("dropped     %u pulses, %u payloads\n", pipeline.pulses_dropped.load(), pipeline.payloads_dropped.load());
+    printf("max depth   %u/%d pulses, %u/%d payloads\n",
+            pipeline.pulse_depth_max.load(), PIPELINE_PULSE_QUEUE,
+            pipeline.payload_depth_max.load(), PIPELINE_PAYLOAD_QUEUE);
+    printf("noise       %u edges/s, %u.%u%% invalid, %u mode switches, %u dropped\n",
+            pipeline.noise.edge_rate, pipeline.noise.inv_ratio / 10, pipeline.noise.inv_ratio % 10,
+            pipeline.noise.mode_switches, pipeline.noise.dropped);
+    printf("shed        %u out of window, %u in window in %u overloaded slices\n",
+            pipeline.noise_shed.load(), pipeline.pulses_shed.load(), pipeline.overloads.load());
+    if (!drop)
+        printf("stalls      %llu\n", (unsigned long long)stalls);
+    uint64_t expected_523 = chunks.chunks_523 * SYNTH_READINGS_523;
+    uint64_t expected_609 = chunks.chunks_609 * SYNTH_READINGS_609;
+    if (!drop && !thin && (published_523 != expected_523 || published - published_523 != expected_609)) {
+        fprintf(stderr, "expected %llu 00523 and %llu 00609 readings\n",
+                (unsigned long long)expected_523, (unsigned long long)expected_609);
+        return 1;
+    }
+    return 0;
+}
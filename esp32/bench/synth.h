@@ -0,0 +1,113 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "../acumonitor.h"
+
+/**
+ * Synthetic pulse streams for host benchmarks, following the timings in
+ * docs/acurite523.md and docs/acurite609.md.
+ */
+
+/* Freezer at -18.5C and the outdoor sample block from the docs. */
+#define SYNTH_BITS_523  0xc049c98b3c99ULL
+#define SYNTH_BITS_609  0xc0a15b25e1ULL
+
+/* Readings one chunk gives, one per block, as the models are cleared after each. */
+#define SYNTH_READINGS_523  3
+#define SYNTH_READINGS_609  2
+
+/* Counted by synth_stream(). */
+struct SynthCounts {
+    size_t chunks_523;
+    size_t chunks_609;
+};
+
+static inline void synth_push(std::vector<Pulse>& out, uint8_t rfs, uint32_t duration) {
+    Pulse pulse;
+    pulse.duration = duration;
+    pulse.rfs = rfs;
+    out.push_back(pulse);
+}
+
+/** A 00523 chunk: three identical bitstreams followed by the chunk end. */
+static inline void synth_523(std::vector<Pulse>& out, uint64_t bits = SYNTH_BITS_523) {
+    for (int block = 0; block < 3; block++) {
+        for (int i = 0; i < 4; i++) {
+            synth_push(out, 0, 600);
+            synth_push(out, 1, 600);
+        }
+        for (int i = ACURITE523_SIGNAL_BIT_LENGTH - 1; i >= 0; i--) {
+            bool bit = (bits >> i) & 1;
+            synth_push(out, 0, bit ? 400 : 200);
+            synth_push(out, 1, bit ? 200 : 400);
+        }
+    }
+    synth_push(out, 0, 200);
+    synth_push(out, 1, 30000);
+}
+
+/** A 00609 chunk of two blocks. */
+static inline void synth_609(std::vector<Pulse>& out, uint64_t bits = SYNTH_BITS_609) {
+    for (int block = 0; block < 2; block++) {
+        synth_push(out, 0, 500);
+        synth_push(out, 1, 8800);
+        for (int i = ACURITE609_SIGNAL_BIT_LENGTH - 1; i >= 0; i--) {
+            synth_push(out, 0, 500);
+            synth_push(out, 1, (bits >> i) & 1 ? 2000 : 500);
+        }
+        synth_push(out, 0, 500);
+        synth_push(out, 1, 15000);
+    }
+    synth_push(out, 0, 500);
+    synth_push(out, 1, 30000);
+}
+
+/**
+ * The carrier a receiver settles on before a transmission. Noise opens a
+ * 00523 chunk whenever it happens to hold four openers, and only a chunk end
+ * closes it again, which noise of 100-1100us never holds; without this the
+ * 00523 parser would stay misaligned for good.
+ */
+static inline void synth_lead_in(std::vector<Pulse>& out) {
+    synth_push(out, 0, 200);
+    synth_push(out, 1, 30000);
+}
+
+/** Random pulses of 100-1100us, like an RXB12 with nothing to receive. */
+static inline void synth_noise(std::vector<Pulse>& out, size_t count, unsigned int *seed) {
+    for (size_t i = 0; i < count; i++)
+        synth_push(out, i & 1, 100 + rand_r(seed) % 1000);
+}
+
+/**
+ * Noise with a transmission from each model every `gap` noise pulses.
+ *
+ * @param counts if set, receives the number of chunks of each model that
+ *        fit whole in the stream
+ */
+static inline std::vector<Pulse> synth_stream(size_t count, size_t gap, unsigned int seed = 1,
+        SynthCounts *counts = NULL) {
+    std::vector<Pulse> out;
+    SynthCounts whole = { 0, 0 };
+    while (out.size() < count) {
+        synth_noise(out, gap, &seed);
+        synth_lead_in(out);
+        synth_523(out);
+        if (out.size() <= count)
+            whole.chunks_523++;
+        synth_noise(out, gap, &seed);
+        synth_lead_in(out);
+        synth_609(out);
+        if (out.size() <= count)
+            whole.chunks_609++;
+    }
+    out.resize(count);
+    if (counts)
+        *counts = whole;
+    return out;
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include "acumonitor.h"
+
+#define HIST_SUB_BITS       3       // 8 buckets per power of two (~12% wide)
+#define HIST_BUCKETS        240     // Covers every uint32_t duration
+#define HIST_RECENT         128     // Recent pulses remembered for accept()
+
+/* Pulses in one validated block, from the first opener to the last bit. */
+#define HIST_BLOCK_523      (8 + 2 * ACURITE523_SIGNAL_BIT_LENGTH)
+#define HIST_BLOCK_609      (2 + 2 * ACURITE609_SIGNAL_BIT_LENGTH)
+
+/**
+ * Fixed-size, log-bucketed histogram of pulse widths for tuning the
+ * get_rfs_type windows, split by level and by whether the pulse was part of
+ * a block that validated.
+ *
+ * record() is a single increment plus a store into a small ring of recent
+ * buckets. When a reading validates, accept() moves that block's pulses from
+ * the rejected to the accepted counts, so the extra work only happens on the
+ * rare successful reading.
+ */
+class PulseHistogram {
+    public:
+        uint32_t counts[2][2][HIST_BUCKETS];    // [rfs][accepted][bucket]
+
+        PulseHistogram() { clear(); }
+
+        void clear() {
+            memset(counts, 0, sizeof(counts));
+            memset(recent, 0, sizeof(recent));
+            recorded = 0;
+        }
+
+        static int bucket(uint32_t duration) {
+            if (duration < (1u << HIST_SUB_BITS))
+                return duration;
+            int octave = 31 - __builtin_clz(duration);
+            int sub = (duration >> (octave - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+            return ((octave - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | sub;
+        }
+
+        /** Smallest duration, in microseconds, that falls in bucket b. */
+        static uint32_t bucket_floor(int b) {
+            if (b < (1 << HIST_SUB_BITS))
+                return b;
+            int octave = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+            uint32_t sub = b & ((1 << HIST_SUB_BITS) - 1);
+            return (1u << octave) | (sub << (octave - HIST_SUB_BITS));
+        }
+
+        void record(uint32_t duration, uint8_t rfs) {
+            uint8_t b = bucket(duration);
+            counts[rfs & 1][0][b]++;
+            recent[recorded++ & (HIST_RECENT - 1)] = (b << 1) | (rfs & 1);
+        }
+
+        /** Marks the last `pulses` recorded pulses as part of an accepted block. */
+        void accept(int pulses) {
+            if (pulses > HIST_RECENT)
+                pulses = HIST_RECENT;
+            if ((uint32_t)pulses > recorded)
+                pulses = recorded;
+            for (int i = 1; i <= pulses; i++) {
+                uint16_t entry = recent[(recorded - i) & (HIST_RECENT - 1)];
+                int rfs = entry & 1, b = entry >> 1;
+                if (counts[rfs][0][b]) {
+                    counts[rfs][0][b]--;
+                    counts[rfs][1][b]++;
+                }
+            }
+        }
+
+        /**
+         * Writes non-empty buckets as CSV lines "rfs,accepted,floor_us,count"
+         * to anything with Arduino-style print()/println().
+         */
+        template<class Out>
+        void print(Out& out) {
+            out.println("rfs,accepted,floor_us,count");
+            for (int rfs = 0; rfs < 2; rfs++) {
+                for (int accepted = 0; accepted < 2; accepted++) {
+                    for (int b = 0; b < HIST_BUCKETS; b++) {
+                        if (!counts[rfs][accepted][b])
+                            continue;
+                        out.print(rfs);
+                        out.print(",");
+                        out.print(accepted);
+                        out.print(",");
+                        out.print(bucket_floor(b));
+                        out.print(",");
+                        out.println(counts[rfs][accepted][b]);
+                    }
+                }
+            }
+        }
+
+    private:
+        uint16_t recent[HIST_RECENT];   // (bucket << 1) | rfs
+        uint32_t recorded;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef HOSTSERIAL_H
+#define HOSTSERIAL_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Minimal stand-in for the Arduino Serial object so the model parsers in this
+ * directory can be compiled and run on Linux hosts. Output goes to stderr;
+ * set out to NULL to silence it.
+ */
+#ifndef DEC
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+#endif
+
+class HostSerial {
+    public:
+        FILE *out = stderr;
+        void print(const char *s) { if (out) fputs(s, out); }
+        void print(char c) { if (out) fputc(c, out); }
+        void print(int n, int base = DEC) { print((long long)n, base); }
+        void print(long n, int base = DEC) { print((long long)n, base); }
+        void print(unsigned int n, int base = DEC) { print((unsigned long long)n, base); }
+        void print(unsigned long n, int base = DEC) { print((unsigned long long)n, base); }
+        void print(long long n, int base = DEC) {
+            if (n < 0 && base == DEC) {
+                print('-');
+                n = -n;
+            }
+            print((unsigned long long)n, base);
+        }
+        void print(unsigned long long n, int base = DEC) {
+            char buf[65];
+            int i = sizeof(buf) - 1;
+            buf[i] = 0;
+            if (base < 2)
+                base = DEC;
+            do {
+                buf[--i] = "0123456789ABCDEF"[n % base];
+                n /= base;
+            } while (n);
+            print(&buf[i]);
+        }
+        void print(double n, int digits = 2) { if (out) fprintf(out, "%.*f", digits, n); }
+        template<typename T> void println(T v) { print(v); print('\n'); }
+        template<typename T> void println(T v, int f) { print(v, f); print('\n'); }
+        void println() { print('\n'); }
+};
+
+inline HostSerial Serial;
+
+#endif
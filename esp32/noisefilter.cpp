@@ -0,0 +1,62 @@
+#include "noisefilter.h"
+
+NoiseFilter::NoiseFilter(std::vector<Acurite::Model *> models) {
+    this->models = models;
+    this->edge_rate = 0;
+    this->inv_ratio = 0;
+    this->protective = false;
+    this->mode_switches = 0;
+    this->dropped = 0;
+    this->window_us = 0;
+    this->window_edges = 0;
+    this->window_inv = 0;
+}
+
+void NoiseFilter::update() {
+    /* Fold the window into the averages (weight 1/4) and switch modes with
+       hysteresis. */
+    int32_t rate = (uint64_t)window_edges * 1000000 / window_us;
+    int32_t inv = window_inv * 1000 / window_edges;
+    edge_rate += (rate - (int32_t)edge_rate) / 4;
+    inv_ratio += (inv - (int32_t)inv_ratio) / 4;
+    window_us = 0;
+    window_edges = 0;
+    window_inv = 0;
+    bool noisy = protective ?
+        edge_rate >= NOISE_RATE_LOW || inv_ratio >= NOISE_INV_LOW :
+        edge_rate > NOISE_RATE_HIGH || inv_ratio > NOISE_INV_HIGH;
+    if (noisy == protective)
+        return;
+    protective = noisy;
+    mode_switches++;
+    Serial.print(protective ? "noise: protective mode on, " : "noise: protective mode off, ");
+    Serial.print(edge_rate);
+    Serial.print(" edges/s, ");
+    Serial.print(inv_ratio / 10);
+    Serial.println("% invalid");
+}
+
+/**
+ * Updates the estimator with one pulse.
+ *
+ * @return false if the pulse should be dropped
+ */
+bool NoiseFilter::accept(uint32_t duration, uint8_t rfs) {
+    bool noise = true;
+    for (Acurite::Model *model : models) {
+        if (!model->is_noise(duration, rfs)) {
+            noise = false;
+            break;
+        }
+    }
+    window_edges++;
+    window_inv += noise;
+    window_us += duration < NOISE_WINDOW_US ? duration : NOISE_WINDOW_US;
+    if (window_us >= NOISE_WINDOW_US)
+        update();
+    if (noise && protective) {
+        dropped++;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef NOISEFILTER_H
+#define NOISEFILTER_H
+
+#include <stdint.h>
+#include <vector>
+#include "acumonitor.h"
+
+#define NOISE_WINDOW_US         100000  // Pulse time per estimator update
+#define NOISE_RATE_HIGH         8000    // Edges/s that start protective mode
+#define NOISE_RATE_LOW          4000    // Edges/s below which it may end
+#define NOISE_INV_HIGH          500     // Permille of noise pulses that start it
+#define NOISE_INV_LOW           250     // Permille below which it may end
+
+/**
+ * Online noise estimator in front of the model parsers. Tracks the edge rate
+ * and the share of pulses that fit no model's signal windows (SIGNAL_INV for
+ * every model) as moving averages over NOISE_WINDOW_US of pulse time, so no
+ * clock is needed. While either is high the filter is in protective mode and
+ * drops those pulses before they reach the models.
+ */
+class NoiseFilter {
+    public:
+        NoiseFilter(std::vector<Acurite::Model *> models);
+        bool accept(uint32_t duration, uint8_t rfs);
+        uint32_t edge_rate;     // Edges per second, averaged
+        uint32_t inv_ratio;     // Noise pulses, permille, averaged
+        bool protective;
+        uint32_t mode_switches;
+        uint32_t dropped;       // Pulses dropped in protective mode
+    private:
+        std::vector<Acurite::Model *> models;
+        uint32_t window_us;     // Pulse time in the current window
+        uint32_t window_edges;
+        uint32_t window_inv;
+        void update();
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "acumonitor.h"
+
+/** Validates a word against each device of a model, filling payload for the first that takes it. */
+template<class Devices>
+static inline bool validate_word(Devices& devices, uint64_t word, Payload& payload) {
+    for (auto& device : devices) {
+        if (device.validate_bitstream(word)) {
+            Payload *p = device.create_payload(STATUS_OK);
+            payload = *p;
+            delete p;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Parses a single pulse with every model, as parse_rf in acumonitor.py.
+ * Shared by the ESP32 pipeline and the native decoders in rpi/.
+ *
+ * @param duration pulse duration, in microseconds
+ * @param rfs pulse level
+ * @param payload receives the reading when a device validates a word
+ * @param unvalidated called as unvalidated(model, bits, word, confidence)
+ *        for a word a model completed that no device validated
+ * @return true if a valid reading was decoded
+ */
+template<class Unvalidated>
+static inline bool parse_models(Acurite523::Model& acurite523, Acurite609::Model& acurite609,
+        uint32_t duration, uint8_t rfs, Payload& payload, Unvalidated unvalidated) {
+    uint64_t result;
+    if ((result = acurite523.parse_rf(duration, rfs))) {
+        if (validate_word(acurite523.devices, result, payload))
+            return true;
+        unvalidated(MODEL_ACURITE523, ACURITE523_SIGNAL_BIT_LENGTH, result, acurite523.confidence);
+    }
+    if ((result = acurite609.parse_rf(duration, rfs))) {
+        if (validate_word(acurite609.devices, result, payload))
+            return true;
+        unvalidated(MODEL_ACURITE609, ACURITE609_SIGNAL_BIT_LENGTH, result, acurite609.confidence);
+    }
+    return false;
+}
+
+#endif
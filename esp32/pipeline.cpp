@@ -0,0 +1,329 @@
+#include "parse.h"
+#include "pipeline.h"
+#ifndef ARDUINO
+#include <chrono>
+
+static uint32_t pipeline_micros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#else
+#define pipeline_micros micros
+#endif
+
+Pipeline::Pipeline(Acurite523::Model& acurite523, Acurite609::Model& acurite609, Publisher publisher,
+        RawPublisher raw_publisher) :
+    noise({ &acurite523, &acurite609 }),
+    acurite523(acurite523), acurite609(acurite609), publisher(publisher), raw_publisher(raw_publisher),
+    frame_publisher(NULL), guard(0), histogram_publisher(NULL),
+    histogram_state(PIPELINE_HISTOGRAM_IDLE), running(false) {
+    frame.count = 0;
+    reset_stats();
+}
+
+Pipeline::Pipeline(Acurite523::Model& acurite523, Acurite609::Model& acurite609, FramePublisher frame_publisher) :
+    noise({ &acurite523, &acurite609 }),
+    acurite523(acurite523), acurite609(acurite609), publisher(NULL), raw_publisher(NULL),
+    frame_publisher(frame_publisher), guard(0), histogram_publisher(NULL),
+    histogram_state(PIPELINE_HISTOGRAM_IDLE), running(false) {
+    frame.count = 0;
+    reset_stats();
+}
+
+void Pipeline::reset_stats() {
+    pulses_dropped = 0;
+    payloads_dropped = 0;
+    raw_dropped = 0;
+    frames_dropped = 0;
+    words_forwarded = 0;
+    pulse_depth_max = 0;
+    payload_depth_max = 0;
+    pulses_decoded = 0;
+    payloads_published = 0;
+    noise_shed = 0;
+    pulses_shed = 0;
+    overloads = 0;
+}
+
+/**
+ * Capture stage. Queues one pulse for decoding.
+ *
+ * @return false if the pulse was dropped because decode is behind
+ */
+bool Pipeline::capture(uint32_t duration, uint8_t rfs) {
+    if (!noise.accept(duration, rfs))
+        return true;
+    Pulse pulse;
+    pulse.duration = duration;
+    pulse.rfs = rfs;
+    if (!pulses.push(pulse)) {
+        pulses_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint32_t depth = pulses.size();
+    if (depth > pulse_depth_max.load(std::memory_order_relaxed))
+        pulse_depth_max.store(depth, std::memory_order_relaxed);
+    return true;
+}
+
+bool Pipeline::parse_rf(uint32_t duration, uint8_t rfs, Payload& payload) {
+    return parse_models(acurite523, acurite609, duration, rfs, payload,
+            [this](uint16_t model, uint8_t bits, uint64_t word, const uint64_t *confidence) {
+        queue_raw(model, bits, word, confidence);
+    });
+}
+
+void Pipeline::queue_payload(Payload& payload) {
+    if (!payloads.push(payload)) {
+        payloads_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t depth = payloads.size();
+    if (depth > payload_depth_max.load(std::memory_order_relaxed))
+        payload_depth_max.store(depth, std::memory_order_relaxed);
+}
+
+/** Queues a word no device validated, if there is a raw publisher. */
+void Pipeline::queue_raw(uint16_t model, uint8_t bits, uint64_t word, const uint64_t *confidence) {
+    if (!raw_publisher)
+        return;
+    RawWord raw;
+    raw.tag = TAG_RAWWORD;
+    raw.model = model;
+    raw.bits = bits;
+    raw.reserved = 0;
+    raw.word = word;
+    raw.confidence[0] = confidence[0];
+    raw.confidence[1] = confidence[1];
+    if (!raw_words.push(raw))
+        raw_dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+/** Queues the frame being filled for publishing and starts a new one. */
+void Pipeline::queue_frame() {
+    frame.tag = TAG_RAWFRAME;
+    frame.reserved = 0;
+    if (!frames.push(frame))
+        frames_dropped.fetch_add(1, std::memory_order_relaxed);
+    frame.count = 0;
+}
+
+/** Adds a completed word to the frame, queueing the frame once it is full. */
+void Pipeline::forward_word(uint16_t model, uint64_t word) {
+    RawFrameWord& entry = frame.words[frame.count];
+    entry.word = word;
+    entry.us = pipeline_micros();
+    entry.model = model;
+    if (frame.count++ == 0)
+        frame_began = entry.us;
+    words_forwarded.fetch_add(1, std::memory_order_relaxed);
+    if (frame.count == RAWFRAME_WORDS)
+        queue_frame();
+}
+
+/**
+ * Runs a pulse through the parsers and forwards any word they complete.
+ * Without validation the node cannot tell a reading from noise, so only the
+ * model that completed a word is cleared, not both as after a reading.
+ */
+void Pipeline::forward_rf(uint32_t duration, uint8_t rfs) {
+    uint64_t word;
+    if ((word = acurite523.parse_rf(duration, rfs))) {
+        acurite523.clear();
+        forward_word(MODEL_ACURITE523, word);
+    }
+    if ((word = acurite609.parse_rf(duration, rfs))) {
+        acurite609.clear();
+        forward_word(MODEL_ACURITE609, word);
+    }
+}
+
+/**
+ * Decode stage. Runs one slice: queued pulses go through the model parsers
+ * until either budget is spent or the queue is empty, and every validated
+ * reading is queued for publishing. With a frame publisher every completed
+ * word is queued instead, unvalidated.
+ *
+ * @param budget maximum number of pulses to consume
+ * @param budget_us maximum time to spend, checked every PIPELINE_BATCH pulses
+ * @return number of pulses consumed, including shed ones
+ */
+size_t Pipeline::decode(size_t budget, uint32_t budget_us) {
+    Pulse batch[PIPELINE_BATCH];
+    uint32_t began = pipeline_micros();
+    size_t done = 0, shed = 0;
+    bool shedding = pulses.size() > PIPELINE_SHED_HIGH;
+    if (histogram_state.load(std::memory_order_acquire) == PIPELINE_HISTOGRAM_WANTED) {
+        memcpy(snapshot.counts, histogram.counts, sizeof(histogram.counts));
+        histogram_state.store(PIPELINE_HISTOGRAM_READY, std::memory_order_release);
+    }
+    if (shedding)
+        overloads.fetch_add(1, std::memory_order_relaxed);
+    while (done < budget) {
+        size_t want = budget - done < PIPELINE_BATCH ? budget - done : PIPELINE_BATCH;
+        size_t count = pulses.pop(batch, want);
+        if (count == 0)
+            break;
+        Payload payload;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t duration = batch[i].duration;
+            uint8_t rfs = batch[i].rfs;
+            if (acurite523.is_preamble(duration, rfs) || acurite609.is_preamble(duration, rfs)) {
+                guard = PIPELINE_SHED_GUARD;
+            }
+            else if (guard > 0) {
+                guard--;
+            }
+            else if (shedding) {
+                bool fits523 = !acurite523.is_noise(duration, rfs);
+                bool fits609 = !acurite609.is_noise(duration, rfs);
+                if (!fits523 && !fits609) {
+                    noise_shed.fetch_add(1, std::memory_order_relaxed);
+                    shed++;
+                    continue;
+                }
+                if (pulses.size() > PIPELINE_SHED_HIGH) {
+                    /* The model would otherwise pair the pulses either side of the gap. */
+                    if (fits523)
+                        acurite523.clear();
+                    if (fits609)
+                        acurite609.clear();
+                    pulses_shed.fetch_add(1, std::memory_order_relaxed);
+                    shed++;
+                    continue;
+                }
+            }
+            histogram.record(duration, rfs);
+            if (frame_publisher) {
+                forward_rf(duration, rfs);
+                continue;
+            }
+            if (!parse_rf(duration, rfs, payload))
+                continue;
+            histogram.accept(payload.model == MODEL_ACURITE523 ? HIST_BLOCK_523 : HIST_BLOCK_609);
+            acurite523.clear();
+            acurite609.clear();
+            queue_payload(payload);
+        }
+        done += count;
+        if (pipeline_micros() - began >= budget_us)
+            break;
+    }
+    if (frame.count > 0 && pipeline_micros() - frame_began >= PIPELINE_FRAME_LINGER_US)
+        queue_frame();
+    pulses_decoded.fetch_add(done - shed, std::memory_order_relaxed);
+    return done;
+}
+
+/**
+ * Publish stage. Hands up to max readings to the publisher callback, then
+ * any raw words to the raw publisher and raw frames to the frame publisher.
+ *
+ * @return number of readings, raw words and frames published
+ */
+size_t Pipeline::publish(size_t max) {
+    size_t count = 0;
+    Payload payload;
+    while (count < max && payloads.pop(payload)) {
+        publisher(payload);
+        count++;
+    }
+    payloads_published.fetch_add(count, std::memory_order_relaxed);
+    RawWord raw;
+    while (count < max && raw_words.pop(raw)) {
+        raw_publisher(raw);
+        count++;
+    }
+    RawFrame next;
+    while (count < max && frames.pop(next)) {
+        frame_publisher(next);
+        count++;
+    }
+    if (histogram_state.load(std::memory_order_acquire) == PIPELINE_HISTOGRAM_READY) {
+        histogram_publisher(snapshot);
+        histogram_state.store(PIPELINE_HISTOGRAM_IDLE, std::memory_order_release);
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Asks for a copy of the pulse histogram, which decode takes at the start of
+ * its next slice and publish then hands to publisher on its own task. Call
+ * from the capture thread.
+ *
+ * @return false if the last copy asked for has not been handed over yet
+ */
+bool Pipeline::request_histogram(HistogramPublisher publisher) {
+    if (histogram_state.load(std::memory_order_acquire) != PIPELINE_HISTOGRAM_IDLE)
+        return false;
+    histogram_publisher = publisher;
+    histogram_state.store(PIPELINE_HISTOGRAM_WANTED, std::memory_order_release);
+    return true;
+}
+
+#ifdef ARDUINO
+static void decode_task(void *arg) {
+    Pipeline *pipeline = (Pipeline *)arg;
+    while (true) {
+        // Always give up the core between slices so the idle task can feed
+        // the watchdog
+        pipeline->decode();
+        vTaskDelay(1);
+    }
+}
+
+static void publish_task(void *arg) {
+    Pipeline *pipeline = (Pipeline *)arg;
+    while (true) {
+        if (pipeline->publish(PIPELINE_PAYLOAD_QUEUE) == 0)
+            vTaskDelay(10);
+    }
+}
+
+/** Starts the decode task on the other core and a low priority publish task. */
+void Pipeline::start() {
+    if (running.exchange(true))
+        return;
+    xTaskCreatePinnedToCore(decode_task, "decode", PIPELINE_STACK_SIZE, this,
+            PIPELINE_DECODE_PRIORITY, NULL, PIPELINE_DECODE_CORE);
+    xTaskCreatePinnedToCore(publish_task, "publish", PIPELINE_STACK_SIZE, this,
+            PIPELINE_PUBLISH_PRIORITY, NULL, PIPELINE_DECODE_CORE);
+}
+
+void Pipeline::stop() {
+    // Tasks run for the lifetime of the sketch
+}
+#else
+/** Starts the decode and publish stages on their own threads. */
+void Pipeline::start() {
+    if (running.exchange(true))
+        return;
+    decoder = std::thread([this] {
+        while (running.load(std::memory_order_relaxed)) {
+            if (decode() == 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            else
+                std::this_thread::yield();
+        }
+        while (decode() > 0) { }
+    });
+    publisher_thread = std::thread([this] {
+        while (running.load(std::memory_order_relaxed)) {
+            if (publish(PIPELINE_PAYLOAD_QUEUE) == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+}
+
+/** Drains the pulse queue and any partial frame, then stops and joins both stages. */
+void Pipeline::stop() {
+    if (!running.exchange(false))
+        return;
+    decoder.join();
+    publisher_thread.join();
+    if (frame.count > 0)
+        queue_frame();
+    while (publish(PIPELINE_PAYLOAD_QUEUE) > 0) { }
+}
+#endif
@@ -0,0 +1,135 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <atomic>
+#include "acumonitor.h"
+#include "histogram.h"
+#include "noisefilter.h"
+#include "ringbuffer.h"
+#ifndef ARDUINO
+#include <thread>
+#endif
+
+#define PIPELINE_PULSE_QUEUE    1024    // Pulses between capture and decode
+#define PIPELINE_PAYLOAD_QUEUE  16      // Readings between decode and publish
+#define PIPELINE_RAW_QUEUE      16      // Raw words between decode and publish
+#define PIPELINE_FRAME_QUEUE    4       // Raw frames between decode and publish
+#define PIPELINE_FRAME_LINGER_US 250000 // Longest a word waits in a frame that is not full
+#define PIPELINE_BATCH          64      // Pulses popped at a time
+#define PIPELINE_SLICE_PULSES   256     // Pulse budget of one decode slice
+#define PIPELINE_SLICE_US       2000    // Time budget of one decode slice
+#define PIPELINE_SHED_HIGH      (PIPELINE_PULSE_QUEUE * 3 / 4)  // Backlog that triggers shedding
+#define PIPELINE_SHED_GUARD     128     // Pulses never shed after a preamble, a whole 523 bitstream
+
+/* histogram_state */
+#define PIPELINE_HISTOGRAM_IDLE     0
+#define PIPELINE_HISTOGRAM_WANTED   1   // Set by request_histogram()
+#define PIPELINE_HISTOGRAM_READY    2   // Copied by decode, for publish to hand over
+
+/* ESP32 task placement. Capture runs in loop() on the Arduino core (1). */
+#define PIPELINE_DECODE_CORE        0
+#define PIPELINE_DECODE_PRIORITY    2
+#define PIPELINE_PUBLISH_PRIORITY   1
+#define PIPELINE_STACK_SIZE         4096
+
+/**
+ * Three-stage capture -> decode/validate -> publish pipeline connected by
+ * bounded single-producer/single-consumer lock-free queues.
+ *
+ * Capture calls capture() for every pulse from a single thread. decode() and
+ * publish() each run on their own task (FreeRTOS on the ESP32, std::thread
+ * elsewhere) once start() is called, so the same stage code can be
+ * benchmarked on a host.
+ *
+ * Decoding is cooperative: each call to decode() is a slice bounded by a pulse
+ * and a time budget, and the task yields between slices so a noise storm
+ * cannot starve WiFi or the watchdog. When a slice starts with the backlog
+ * past PIPELINE_SHED_HIGH, pulses that fit no model's windows are shed for
+ * the rest of the slice, and in-window pulses too while the backlog stays
+ * past it. A model that loses an in-window pulse is cleared, so that it
+ * cannot stitch a word together across the gap. A pulse that looks like a
+ * preamble, and the PIPELINE_SHED_GUARD pulses after it, are never shed,
+ * even when the block runs on into the next slice.
+ *
+ * Capture also runs every pulse through a NoiseFilter, which drops pulses
+ * that fit no model while the band is flooded with noise.
+ *
+ * Decode keeps a PulseHistogram of the pulses that reach the models. A copy
+ * asked for with request_histogram() is taken by decode between slices and
+ * handed over by publish, so neither capture nor decode waits on its output.
+ *
+ * With a raw publisher, every word a model completes that no device
+ * validates is published too, with the confidence of each bit, so that a
+ * collector can combine it with other receivers' copies.
+ *
+ * Built with a frame publisher instead, the node is a thin capture front
+ * end: decode runs the parsers but validates nothing, and every word they
+ * complete is batched into a RawFrame for the collector to validate. A frame
+ * is published once full, or PIPELINE_FRAME_LINGER_US after its first word.
+ */
+class Pipeline {
+    public:
+        typedef void (*Publisher)(Payload& payload);
+        typedef void (*RawPublisher)(RawWord& word);
+        typedef void (*FramePublisher)(RawFrame& frame);
+        typedef void (*HistogramPublisher)(PulseHistogram& histogram);
+
+        RingBuffer<Pulse, PIPELINE_PULSE_QUEUE> pulses;
+        RingBuffer<Payload, PIPELINE_PAYLOAD_QUEUE> payloads;
+        RingBuffer<RawWord, PIPELINE_RAW_QUEUE> raw_words;
+        RingBuffer<RawFrame, PIPELINE_FRAME_QUEUE> frames;
+
+        /* Counters; each is written by one stage only. */
+        std::atomic<uint32_t> pulses_dropped;   // Capture found the pulse queue full
+        std::atomic<uint32_t> payloads_dropped; // Decode found the payload queue full
+        std::atomic<uint32_t> raw_dropped;      // Decode found the raw word queue full
+        std::atomic<uint32_t> frames_dropped;   // Decode found the frame queue full
+        std::atomic<uint32_t> words_forwarded;  // Words queued in frames
+        std::atomic<uint32_t> pulse_depth_max;
+        std::atomic<uint32_t> payload_depth_max;
+        std::atomic<uint32_t> pulses_decoded;   // Pulses that reached the models
+        std::atomic<uint32_t> payloads_published;
+        std::atomic<uint32_t> noise_shed;       // Pulses out of every model's windows discarded under overload
+        std::atomic<uint32_t> pulses_shed;      // In-window pulses discarded under overload
+        std::atomic<uint32_t> overloads;        // Slices that started over PIPELINE_SHED_HIGH
+        NoiseFilter noise;                      // Updated by capture only
+        PulseHistogram histogram;               // Updated by decode only
+
+        Pipeline(Acurite523::Model& acurite523, Acurite609::Model& acurite609, Publisher publisher,
+                RawPublisher raw_publisher = NULL);
+        Pipeline(Acurite523::Model& acurite523, Acurite609::Model& acurite609, FramePublisher frame_publisher);
+        bool capture(uint32_t duration, uint8_t rfs);
+        size_t decode(size_t budget = PIPELINE_SLICE_PULSES, uint32_t budget_us = PIPELINE_SLICE_US);
+        size_t backlog() { return pulses.size(); }
+        size_t publish(size_t max);
+        bool request_histogram(HistogramPublisher publisher);
+        void start();
+        void stop();
+        void reset_stats();
+
+    private:
+        Acurite523::Model& acurite523;
+        Acurite609::Model& acurite609;
+        Publisher publisher;
+        RawPublisher raw_publisher;
+        FramePublisher frame_publisher;
+        RawFrame frame;                         // Being filled by decode
+        uint32_t frame_began;
+        uint32_t guard;                         // Pulses left that must not be shed
+        PulseHistogram snapshot;                // Copy of histogram for histogram_publisher
+        HistogramPublisher histogram_publisher;
+        std::atomic<int> histogram_state;
+        std::atomic<bool> running;
+        bool parse_rf(uint32_t duration, uint8_t rfs, Payload& payload);
+        void queue_payload(Payload& payload);
+        void queue_raw(uint16_t model, uint8_t bits, uint64_t word, const uint64_t *confidence);
+        void forward_rf(uint32_t duration, uint8_t rfs);
+        void forward_word(uint16_t model, uint64_t word);
+        void queue_frame();
+#ifndef ARDUINO
+        std::thread decoder;
+        std::thread publisher_thread;
+#endif
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ * Capacity must be a power of two. Head and tail live on separate cache lines
+ * so the two sides do not contend.
+ */
+template<typename T, size_t N>
+class RingBuffer {
+    static_assert(N && (N & (N - 1)) == 0, "capacity must be a power of two");
+    public:
+        RingBuffer() : head(0), tail(0) { }
+
+        /** Producer side. Returns false if the queue is full. */
+        bool push(const T& item) {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h - tail.load(std::memory_order_acquire) == N)
+                return false;
+            items[h & (N - 1)] = item;
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** Consumer side. Returns false if the queue is empty. */
+        bool pop(T& item) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire))
+                return false;
+            item = items[t & (N - 1)];
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /** Consumer side. Pops up to max items, returns the number popped. */
+        size_t pop(T *out, size_t max) {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t count = head.load(std::memory_order_acquire) - t;
+            if (count > max)
+                count = max;
+            for (size_t i = 0; i < count; i++)
+                out[i] = items[(t + i) & (N - 1)];
+            tail.store(t + count, std::memory_order_release);
+            return count;
+        }
+
+        /** Approximate number of queued items; exact from either side. */
+        size_t size() {
+            size_t t = tail.load(std::memory_order_acquire);
+            return head.load(std::memory_order_acquire) - t;
+        }
+
+        size_t capacity() { return N; }
+
+    private:
+        alignas(64) std::atomic<size_t> head;   // Written by producer only
+        alignas(64) std::atomic<size_t> tail;   // Written by consumer only
+        alignas(64) T items[N];
+};
+
+#endif
@@ -0,0 +1,191 @@
+/**
+ * Native capture daemon. Reads pulses from GPIO edge events, a sampled level
+ * register or a pulse file and runs the C++ model parsers, writing each valid
+ * reading to stdout.
+ *
+ * Usage: acucapture [-c chip] [-p pin] [-f file] [-m] [-k cpu[:prio]]
+ *                   [-d cpu[:prio]] [-l] [-S secs] [-H file] [-w file] [-b] [-q]
+ */
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "acudecoder.h"
+#include "capture.h"
+
+#define PULSE_BATCH 256
+
+static PulseSource *source;
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acucapture [-c chip] [-p pin] [-f file] [-m] [-k cpu[:prio]]\n"
+        "                  [-d cpu[:prio]] [-l] [-S secs] [-H file] [-w file] [-b] [-q]\n"
+        "  -c chip   GPIO character device (default /dev/gpiochip0)\n"
+        "  -p pin    line offset of the receiver data pin (default 17)\n"
+        "  -f file   read \"rfs duration\" pulses from file instead, - for stdin\n"
+        "  -m        sample the level register via /dev/gpiomem instead of edge events;\n"
+        "            with -f, play the file through a simulated register\n"
+        "  -k cpu[:prio]  pin the capture thread (the -m sampler, or the event reader)\n"
+        "            to a core, -1 for any, with an optional SCHED_FIFO priority\n"
+        "  -d cpu[:prio]  same for the decode thread with -m\n"
+        "  -l        lock all memory (mlockall)\n"
+        "  -S secs   report capture jitter every secs seconds\n"
+        "  -H file   write a pulse width histogram (CSV) to file on exit and every -S\n"
+        "  -w file   record pulses to file in the format read by -f\n"
+        "  -b        write raw 14-byte payloads instead of text\n"
+        "  -q        do not log bitstreams\n");
+    exit(1);
+}
+
+/* Ends the capture loop so that the histogram, stats and recording are
+   written; a second signal kills as usual. */
+static void on_signal(int sig) {
+    signal(sig, SIG_DFL);
+    source->interrupt();
+}
+
+static void parse_thread(const char *arg, ThreadConfig& thread) {
+    if (sscanf(arg, "%d:%d", &thread.cpu, &thread.priority) < 1)
+        usage();
+}
+
+static uint64_t now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void write_histogram(const char *path, AcuDecoder& decoder) {
+    HostSerial out;
+    if (!(out.out = fopen(path, "w"))) {
+        perror(path);
+        return;
+    }
+    decoder.histogram.print(out);
+    fclose(out.out);
+}
+
+static void report_stats(JitterStats& jitter, AcuDecoder& decoder) {
+    jitter.report(stderr);
+    jitter.reset();
+    fprintf(stderr, "# noise: %u edges/s, %u%% invalid, protective=%d, switches=%u, dropped=%u\n",
+            decoder.noise.edge_rate, decoder.noise.inv_ratio / 10, decoder.noise.protective,
+            decoder.noise.mode_switches, decoder.noise.dropped);
+}
+
+int main(int argc, char **argv) {
+    CaptureConfig config;
+    JitterStats jitter("capture");
+    const char *histogram = NULL;
+    FILE *record = NULL;
+    bool binary = false;
+    int report = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:p:f:mk:d:lS:H:w:bq")) != -1) {
+        switch (opt) {
+            case 'c':
+                config.chip = optarg;
+                break;
+            case 'p':
+                config.pin = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                config.path = optarg;
+                break;
+            case 'm':
+                config.sampled = true;
+                break;
+            case 'k':
+                parse_thread(optarg, config.capture);
+                break;
+            case 'd':
+                parse_thread(optarg, config.decode);
+                break;
+            case 'l':
+                config.lock_memory = true;
+                break;
+            case 'S':
+                report = atoi(optarg);
+                config.jitter = &jitter;
+                break;
+            case 'H':
+                histogram = optarg;
+                break;
+            case 'w':
+                if (!(record = fopen(optarg, "w"))) {
+                    perror(optarg);
+                    return 1;
+                }
+                break;
+            case 'b':
+                binary = true;
+                break;
+            case 'q':
+                Serial.out = NULL;
+                break;
+            default:
+                usage();
+        }
+    }
+
+    source = open_source(config);
+    if (!source) {
+        if (config.path)
+            perror(config.path);
+        else if (config.sampled)
+            perror("/dev/gpiomem");
+        else
+            fprintf(stderr, "%s line %u: %s\n", config.chip, config.pin, strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    apply_reader_thread(config);
+    AcuDecoder decoder;
+    Pulse pulses[PULSE_BATCH];
+    std::vector<Payload> payloads;
+    uint64_t reported = now_s();
+    ssize_t n;
+    while ((n = source->read_pulses(pulses, PULSE_BATCH)) > 0) {
+        if (report > 0 && now_s() - reported >= (uint64_t)report) {
+            report_stats(jitter, decoder);
+            if (histogram)
+                write_histogram(histogram, decoder);
+            reported = now_s();
+        }
+        if (record) {
+            /* Flushed after every batch, so a capture that is killed loses
+               little more than the batch in progress. stdio may still write
+               part of a batch early, and a kill can cut its last line short. */
+            for (ssize_t i = 0; i < n; i++)
+                fprintf(record, "%u %u\n", pulses[i].rfs, pulses[i].duration);
+            fflush(record);
+        }
+        decoder.parse_pulses(pulses, n, payloads);
+        for (Payload& p : payloads) {
+            if (binary)
+                fwrite(&p, sizeof(p), 1, stdout);
+            else
+                printf("model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f\n",
+                        p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0);
+        }
+        if (!payloads.empty())
+            fflush(stdout);
+        payloads.clear();
+    }
+    if (n < 0)
+        perror("read");
+    if (report > 0)
+        report_stats(jitter, decoder);
+    if (histogram)
+        write_histogram(histogram, decoder);
+    if (record)
+        fclose(record);
+    delete source;
+    return n < 0 ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#include "../esp32/parse.h"
+#include "acudecoder.h"
+
+AcuDecoder::AcuDecoder() :
+    acurite523({ Acurite523::Device(DEVICE_FREEZER), Acurite523::Device(DEVICE_FRIDGE) }),
+    acurite609({ Acurite609::Device(DEVICE_OUTDOOR) }),
+    noise({ &acurite523, &acurite609 }) {
+}
+
+void AcuDecoder::reset_rf() {
+    acurite523.clear();
+    acurite609.clear();
+}
+
+/**
+ * Parses a single pulse with every model.
+ *
+ * @param duration pulse duration, in microseconds
+ * @param rfs pulse level
+ * @param payload receives the reading when a device validates a bitstream
+ * @return true if a valid reading was decoded
+ */
+bool AcuDecoder::parse_rf(uint32_t duration, uint8_t rfs, Payload& payload) {
+    return parse_models(acurite523, acurite609, duration, rfs, payload,
+            [](uint16_t, uint8_t, uint64_t, const uint64_t *) { });
+}
+
+/**
+ * Parses a batch of pulses, dropping glitches (and noise while the noise
+ * filter is protective) and resetting the models after each valid reading.
+ *
+ * @return number of payloads appended
+ */
+size_t AcuDecoder::parse_pulses(const Pulse *pulses, size_t count, std::vector<Payload>& payloads) {
+    size_t found = 0;
+    Payload payload;
+    for (size_t i = 0; i < count; i++) {
+        if (pulses[i].duration < PULSE_MIN_DURATION)
+            continue;
+        if (!noise.accept(pulses[i].duration, pulses[i].rfs))
+            continue;
+        histogram.record(pulses[i].duration, pulses[i].rfs);
+        if (parse_rf(pulses[i].duration, pulses[i].rfs, payload)) {
+            payloads.push_back(payload);
+            histogram.accept(payload.model == MODEL_ACURITE523 ? HIST_BLOCK_523 : HIST_BLOCK_609);
+            reset_rf();
+            found++;
+        }
+    }
+    return found;
+}
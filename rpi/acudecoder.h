@@ -0,0 +1,30 @@
+#ifndef ACUDECODER_H
+#define ACUDECODER_H
+
+#include <stddef.h>
+#include <vector>
+#include "../esp32/acumonitor.h"
+#include "../esp32/histogram.h"
+#include "../esp32/noisefilter.h"
+
+/* Pulses shorter than this are treated as glitches, as in the GPIO loops. */
+#define PULSE_MIN_DURATION  100
+
+/**
+ * Runs the C++ model parsers over a stream of pulses. Mirrors parse_rf and
+ * reset_rf in acumonitor.py so that native capture paths behave the same as
+ * the Python one.
+ */
+class AcuDecoder {
+    public:
+        AcuDecoder();
+        Acurite523::Model acurite523;
+        Acurite609::Model acurite609;
+        NoiseFilter noise;
+        PulseHistogram histogram;
+        void reset_rf();
+        bool parse_rf(uint32_t duration, uint8_t rfs, Payload& payload);
+        size_t parse_pulses(const Pulse *pulses, size_t count, std::vector<Payload>& payloads);
+};
+
+#endif
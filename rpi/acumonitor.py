@@ -8,6 +8,11 @@ import struct
 import threading
 import time
 
+try:
+    import acunative
+except ImportError:
+    acunative = None
+
 """
 Sniffs 433MHz RF signals from supported Acurite models.
 """
@@ -19,12 +24,24 @@ DEVICE_FRIDGE    = 7784
 DEVICE_OUTDOOR   = 8501
 
 class Acumonitor:
-    def __init__(self, pin_rx, verbosity=0):
+    def __init__(self, pin_rx, verbosity=0, native=None, ring=None):
+        """:param bool native: capture and decode with the acunative extension;
+        None to use it whenever it is installed
+        :param str ring: with native capture, also share readings with other
+        processes as shared memory of this name, for acunative.Reader
+        """
         self.updated = datetime.now()
         self.pin_rx = pin_rx
         self.waiters = []
         self.print_verbose = print if verbosity > 1 else lambda *a, **k: None
         self.print_debug = print if verbosity > 2 else lambda *a, **k: None
+        self.capture = None
+        if native is None:
+            native = acunative is not None
+        if native:
+            # Pulses never reach Python; only finished payloads do
+            self.capture = acunative.Capture(pin=pin_rx, verbosity=verbosity, ring=ring)
+            return
 
         GPIO.setmode(GPIO.BCM)
         GPIO.setup(pin_rx, GPIO.IN)
@@ -42,8 +59,9 @@ class Acumonitor:
                 Acurite609.Model(acurite609)]
 
     def update_stats(self, device):
-        payload = device.create_payload(STATUS_OK)
+        self.publish(device.create_payload(STATUS_OK))
 
+    def publish(self, payload):
         # Notify other threads
         for waiter in self.waiters:
             waiter.put(payload)
@@ -97,6 +115,11 @@ class Acumonitor:
         :return: True if successful, False on timeout
         :rtype: bool
         """
+        if self.capture:
+            # Native payloads are in a broadcast ring; each caller reads it
+            # with a cursor of its own, starting from now
+            return self.capture.reader().get(timeout=timeout)
+
         data = None
         waiter = Queue()
         self.waiters.append(waiter)
@@ -112,10 +135,16 @@ class Acumonitor:
         """Start listening for signals from the RF module.
         """
         self.print_verbose('# started script')
+        if self.capture:
+            self.capture.start()
+            return
         threading.Thread(target=self.read_rf, daemon=True).start()
 
     def stop(self):
         """Stop listening for signals.
         """
+        if self.capture:
+            self.capture.stop()
+            return
         GPIO.remove_event_detect(self.pin_rx)
 
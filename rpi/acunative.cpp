@@ -0,0 +1,506 @@
+/**
+ * CPython extension running native capture and the C++ model parsers on a
+ * background thread. Python only ever sees finished readings, as the same
+ * 14-byte payloads that create_payload returns in acurite523.py/acurite609.py.
+ * Readings are published once to a broadcast ring; every Reader has its own
+ * cursor on it, so adding readers costs the capture thread nothing.
+ *
+ *     from acunative import Capture
+ *     capture = Capture(pin=17)
+ *     capture.start()
+ *     payload = capture.get(timeout=70)   # bytes, or None on timeout
+ *     reader = capture.reader()           # or Reader('/name') with Capture(ring='/name')
+ *     payload = reader.get(timeout=70)
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <errno.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "acudecoder.h"
+#include "broadcast.h"
+#include "capture.h"
+
+#define CAPTURE_BATCH       256
+#define CAPTURE_WAIT_SLICE  100     // ms between signal checks in get()
+#define HISTOGRAM_WAIT      500     // Longest wait, in ms, for the capture thread to copy its histogram
+
+/* histogram_state */
+#define HISTOGRAM_IDLE      0
+#define HISTOGRAM_WANTED    1       // Set by histogram()
+#define HISTOGRAM_COPYING   2       // Taken by the capture thread
+
+struct CaptureObject {
+    PyObject_HEAD
+    CaptureConfig config;
+    PyObject *chip;             // Keep the strings in config alive
+    PyObject *path;
+    PulseSource *source;
+    AcuDecoder *decoder;        // Of the capture thread, kept once it stops
+    std::thread *thread;
+    std::mutex *lock;           // One histogram() request at a time
+    BroadcastRing *ring;        // Closed once capture stops
+    BroadcastCursor *cursor;    // Read by get()
+    std::mutex *cursor_lock;
+    size_t readers;             // Reader objects with a cursor on ring
+    JitterStats *jitter;
+    PulseHistogram *histogram;  // Copied from decoder on request while decoding
+    std::atomic<int> *histogram_state;
+    std::atomic<bool> *decoding;            // Capture thread is using decoder
+};
+
+/* One consumer of a capture's ring, in this process or another. */
+struct ReaderObject {
+    PyObject_HEAD
+    PyObject *capture;          // Keeps an in-process ring alive, or NULL
+    BroadcastCursor *cursor;
+    std::mutex *lock;
+};
+
+/* Zeroed as statics are, and filled in by PyInit_acunative(): the fields of
+   PyTypeObject differ between Python versions. */
+static PyTypeObject ReaderType;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void capture_run(CaptureObject *self) {
+    apply_reader_thread(self->config);
+    AcuDecoder& decoder = *self->decoder;
+    Pulse pulses[CAPTURE_BATCH];
+    std::vector<Payload> payloads;
+    ssize_t n;
+    while ((n = self->source->read_pulses(pulses, CAPTURE_BATCH)) > 0) {
+        size_t found = decoder.parse_pulses(pulses, n, payloads);
+        /* Copied only when asked for, without a lock Python could hold. */
+        int wanted = HISTOGRAM_WANTED;
+        if (self->histogram_state->load(std::memory_order_relaxed) == HISTOGRAM_WANTED &&
+                self->histogram_state->compare_exchange_strong(wanted, HISTOGRAM_COPYING,
+                    std::memory_order_acquire)) {
+            memcpy(self->histogram->counts, decoder.histogram.counts, sizeof(decoder.histogram.counts));
+            self->histogram_state->store(HISTOGRAM_IDLE, std::memory_order_release);
+        }
+        if (found == 0)
+            continue;
+        uint64_t ns = now_ns();
+        for (Payload& p : payloads)
+            self->ring->publish(p, ns);
+        payloads.clear();
+    }
+    self->decoding->store(false, std::memory_order_release);
+    self->ring->close();
+}
+
+/**
+ * Waits for the next record on a cursor, giving up the GIL meanwhile. Shared
+ * by Capture.get() and Reader.get().
+ *
+ * @return payload bytes, None on timeout or once the ring is closed and read
+ */
+static PyObject *cursor_get(BroadcastCursor *cursor, std::mutex *lock, PyObject *args, PyObject *kwds) {
+    static const char *kwlist[] = { "timeout", NULL };
+    PyObject *timeout_obj = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", (char **)kwlist, &timeout_obj))
+        return NULL;
+    double timeout = -1;
+    if (timeout_obj != Py_None && (timeout = PyFloat_AsDouble(timeout_obj)) < 0) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_ValueError, "timeout must be non-negative");
+        return NULL;
+    }
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::microseconds((long long)(timeout * 1e6));
+    BroadcastRecord record;
+    bool got = false, closed = false;
+    while (true) {
+        Py_BEGIN_ALLOW_THREADS
+        {
+            std::lock_guard<std::mutex> guard(*lock);
+            int slice = CAPTURE_WAIT_SLICE;
+            if (timeout >= 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                if (left < slice)
+                    slice = left > 0 ? left : 0;
+            }
+            got = cursor->next(record);
+            if (!got) {
+                closed = cursor->closed();
+                if (!closed && cursor->wait(slice))
+                    got = cursor->next(record);
+            }
+        }
+        Py_END_ALLOW_THREADS
+        if (got)
+            return PyBytes_FromStringAndSize((const char *)&record.payload, sizeof(record.payload));
+        if (closed)
+            Py_RETURN_NONE;
+        if (timeout >= 0 && std::chrono::steady_clock::now() >= deadline)
+            Py_RETURN_NONE;
+        if (PyErr_CheckSignals() < 0)
+            return NULL;
+    }
+}
+
+static void capture_stop_thread(CaptureObject *self) {
+    if (!self->thread)
+        return;
+    self->source->interrupt();
+    Py_BEGIN_ALLOW_THREADS
+    self->thread->join();
+    Py_END_ALLOW_THREADS
+    delete self->thread;
+    delete self->source;
+    self->thread = NULL;
+    self->source = NULL;
+}
+
+/** PyUnicode_FSConverter that leaves None as NULL. */
+static int optional_path(PyObject *arg, void *result) {
+    if (arg == Py_None) {
+        *(PyObject **)result = NULL;
+        return 1;
+    }
+    return PyUnicode_FSConverter(arg, result);
+}
+
+static int Capture_init(CaptureObject *self, PyObject *args, PyObject *kwds) {
+    static const char *kwlist[] = { "pin", "chip", "path", "sampled", "cpu", "priority",
+        "decode_cpu", "decode_priority", "lock_memory", "verbosity", "ring", NULL };
+    unsigned int pin = 17;
+    PyObject *chip = NULL, *path = NULL, *ring = NULL;
+    int sampled = 0, lock_memory = 0, verbosity = 0;
+    ThreadConfig capture, decode;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|IO&O&piiiipiO&", (char **)kwlist,
+                &pin, optional_path, &chip, optional_path, &path,
+                &sampled, &capture.cpu, &capture.priority, &decode.cpu, &decode.priority,
+                &lock_memory, &verbosity, optional_path, &ring))
+        return -1;
+    if (ring) {
+        /* share() replaces the ring's memory, under any cursors on it. */
+        bool shared = false;
+        if (self->thread)
+            PyErr_SetString(PyExc_RuntimeError, "capture is running");
+        else if (self->readers)
+            PyErr_SetString(PyExc_RuntimeError, "capture has readers");
+        else if (!(shared = self->ring->share(PyBytes_AS_STRING(ring))))
+            PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(ring));
+        Py_DECREF(ring);
+        if (!shared) {
+            Py_XDECREF(chip);
+            Py_XDECREF(path);
+            return -1;
+        }
+        std::lock_guard<std::mutex> guard(*self->cursor_lock);
+        delete self->cursor;
+        self->cursor = new BroadcastCursor(*self->ring);
+    }
+    Py_XSETREF(self->chip, chip);
+    Py_XSETREF(self->path, path);
+    self->config = CaptureConfig();
+    self->config.pin = pin;
+    if (chip)
+        self->config.chip = PyBytes_AS_STRING(chip);
+    if (path)
+        self->config.path = PyBytes_AS_STRING(path);
+    self->config.sampled = sampled;
+    self->config.capture = capture;
+    self->config.decode = decode;
+    self->config.lock_memory = lock_memory;
+    self->config.jitter = self->jitter;
+    Serial.out = verbosity > 1 ? stderr : NULL;
+    return 0;
+}
+
+static PyObject *Capture_new(PyTypeObject *type, PyObject *, PyObject *) {
+    CaptureObject *self = (CaptureObject *)type->tp_alloc(type, 0);
+    if (!self)
+        return NULL;
+    self->lock = new std::mutex();
+    self->ring = new BroadcastRing(BROADCAST_SIZE);
+    self->cursor = new BroadcastCursor(*self->ring);
+    self->cursor_lock = new std::mutex();
+    self->jitter = new JitterStats("capture");
+    self->histogram = new PulseHistogram();
+    self->histogram_state = new std::atomic<int>(HISTOGRAM_IDLE);
+    self->decoding = new std::atomic<bool>(false);
+    return (PyObject *)self;
+}
+
+static void Capture_dealloc(CaptureObject *self) {
+    capture_stop_thread(self);
+    delete self->lock;
+    delete self->cursor;
+    delete self->ring;
+    delete self->cursor_lock;
+    delete self->jitter;
+    delete self->decoder;
+    delete self->histogram;
+    delete self->histogram_state;
+    delete self->decoding;
+    Py_XDECREF(self->chip);
+    Py_XDECREF(self->path);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Capture_start(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    if (self->thread)
+        Py_RETURN_NONE;
+    self->source = open_source(self->config);
+    if (!self->source)
+        return PyErr_SetFromErrnoWithFilename(PyExc_OSError,
+                self->config.path ? self->config.path :
+                self->config.sampled ? "/dev/gpiomem" : self->config.chip);
+    self->ring->reopen();
+    delete self->decoder;
+    self->decoder = new AcuDecoder();
+    self->decoding->store(true);
+    self->thread = new std::thread(capture_run, self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Capture_stop(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    capture_stop_thread(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject *Capture_get(CaptureObject *self, PyObject *args, PyObject *kwds) {
+    {
+        std::lock_guard<std::mutex> guard(*self->cursor_lock);
+        if (!self->thread && !self->cursor->pending())
+            Py_RETURN_NONE;
+    }
+    return cursor_get(self->cursor, self->cursor_lock, args, kwds);
+}
+
+static PyObject *Capture_reader(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    ReaderObject *reader = (ReaderObject *)ReaderType.tp_alloc(&ReaderType, 0);
+    if (!reader)
+        return NULL;
+    Py_INCREF(self);
+    self->readers++;
+    reader->capture = (PyObject *)self;
+    reader->cursor = new BroadcastCursor(*self->ring);
+    reader->lock = new std::mutex();
+    return (PyObject *)reader;
+}
+
+static PyObject *Capture_stats(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    std::lock_guard<std::mutex> guard(*self->cursor_lock);
+    return Py_BuildValue("{s:K,s:K,s:K}", "readings", (unsigned long long)self->ring->head(),
+            "dropped", (unsigned long long)self->cursor->lost,
+            "pending", (unsigned long long)self->cursor->pending());
+}
+
+static PyObject *Capture_jitter(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out)
+        return PyErr_NoMemory();
+    self->jitter->report(out);
+    self->jitter->reset();
+    fclose(out);
+    PyObject *result = PyUnicode_FromStringAndSize(text, size);
+    free(text);
+    return result;
+}
+
+/**
+ * Asks the capture thread for a copy of its histogram, which it makes after
+ * its next batch. A receiver that has gone silent leaves the thread blocked
+ * for pulses; after HISTOGRAM_WAIT the request is withdrawn and the copy of
+ * the last one is used. Called with self->lock held, without the GIL.
+ *
+ * @return true if self->histogram holds the copy, false once capture has ended
+ */
+static bool histogram_request(CaptureObject *self) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(HISTOGRAM_WAIT);
+    self->histogram_state->store(HISTOGRAM_WANTED, std::memory_order_relaxed);
+    while (self->decoding->load(std::memory_order_acquire)) {
+        int state = self->histogram_state->load(std::memory_order_acquire);
+        if (state == HISTOGRAM_IDLE)
+            return true;
+        /* Withdrawn unless the thread is already copying, which is brief. */
+        if (state == HISTOGRAM_WANTED && std::chrono::steady_clock::now() >= deadline &&
+                self->histogram_state->compare_exchange_strong(state, HISTOGRAM_IDLE))
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    self->histogram_state->store(HISTOGRAM_IDLE, std::memory_order_relaxed);
+    return false;
+}
+
+static PyObject *Capture_histogram(CaptureObject *self, PyObject *Py_UNUSED(ignored)) {
+    PyObject *list = PyList_New(0);
+    if (!list)
+        return NULL;
+    std::unique_lock<std::mutex> guard(*self->lock, std::defer_lock);
+    const PulseHistogram *histogram = NULL;
+    while (!histogram) {
+        bool copied;
+        Py_BEGIN_ALLOW_THREADS
+        guard.lock();
+        copied = histogram_request(self);
+        Py_END_ALLOW_THREADS
+        /* With the GIL, start() cannot hand the decoder to a new thread. */
+        if (copied)
+            histogram = self->histogram;
+        else if (!self->decoding->load(std::memory_order_acquire))
+            histogram = self->decoder ? &self->decoder->histogram : self->histogram;
+        else
+            guard.unlock();
+    }
+    for (int rfs = 0; rfs < 2; rfs++) {
+        for (int accepted = 0; accepted < 2; accepted++) {
+            for (int b = 0; b < HIST_BUCKETS; b++) {
+                uint32_t count = histogram->counts[rfs][accepted][b];
+                if (!count)
+                    continue;
+                PyObject *item = Py_BuildValue("(iOII)", rfs, accepted ? Py_True : Py_False,
+                        PulseHistogram::bucket_floor(b), count);
+                if (!item || PyList_Append(list, item) < 0) {
+                    Py_XDECREF(item);
+                    Py_DECREF(list);
+                    return NULL;
+                }
+                Py_DECREF(item);
+            }
+        }
+    }
+    return list;
+}
+
+static PyMethodDef Capture_methods[] = {
+    { "start", (PyCFunction)Capture_start, METH_NOARGS, "Start capturing on a native thread." },
+    { "stop", (PyCFunction)Capture_stop, METH_NOARGS, "Stop capturing." },
+    { "get", (PyCFunction)(void (*)(void))Capture_get, METH_VARARGS | METH_KEYWORDS,
+        "get(timeout=None) -> bytes or None\n\nWaits for the next payload." },
+    { "reader", (PyCFunction)Capture_reader, METH_NOARGS,
+        "reader() -> Reader\n\nNew cursor on the readings, starting with the next one." },
+    { "stats", (PyCFunction)Capture_stats, METH_NOARGS, "Reading counters." },
+    { "jitter", (PyCFunction)Capture_jitter, METH_NOARGS,
+        "Capture latency report since the last call." },
+    { "histogram", (PyCFunction)Capture_histogram, METH_NOARGS,
+        "Pulse width histogram as (rfs, accepted, floor_us, count) tuples." },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject CaptureType;
+
+static int Reader_init(ReaderObject *self, PyObject *args, PyObject *kwds) {
+    static const char *kwlist[] = { "name", NULL };
+    PyObject *name = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", (char **)kwlist, PyUnicode_FSConverter, &name))
+        return -1;
+    BroadcastCursor *cursor = new BroadcastCursor();
+    bool opened = cursor->open(PyBytes_AS_STRING(name));
+    if (!opened) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, PyBytes_AS_STRING(name));
+        delete cursor;
+    }
+    Py_DECREF(name);
+    if (!opened)
+        return -1;
+    delete self->cursor;
+    self->cursor = cursor;
+    return 0;
+}
+
+static PyObject *Reader_new(PyTypeObject *type, PyObject *, PyObject *) {
+    ReaderObject *self = (ReaderObject *)type->tp_alloc(type, 0);
+    if (!self)
+        return NULL;
+    self->cursor = new BroadcastCursor();
+    self->lock = new std::mutex();
+    return (PyObject *)self;
+}
+
+static void Reader_dealloc(ReaderObject *self) {
+    delete self->cursor;
+    delete self->lock;
+    if (self->capture)
+        ((CaptureObject *)self->capture)->readers--;
+    Py_XDECREF(self->capture);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Reader_get(ReaderObject *self, PyObject *args, PyObject *kwds) {
+    return cursor_get(self->cursor, self->lock, args, kwds);
+}
+
+static PyObject *Reader_stats(ReaderObject *self, PyObject *Py_UNUSED(ignored)) {
+    std::lock_guard<std::mutex> guard(*self->lock);
+    return Py_BuildValue("{s:K,s:K,s:K}", "position", (unsigned long long)self->cursor->position,
+            "lost", (unsigned long long)self->cursor->lost,
+            "pending", (unsigned long long)self->cursor->pending());
+}
+
+static PyMethodDef Reader_methods[] = {
+    { "get", (PyCFunction)(void (*)(void))Reader_get, METH_VARARGS | METH_KEYWORDS,
+        "get(timeout=None) -> bytes or None\n\nWaits for the next payload." },
+    { "stats", (PyCFunction)Reader_stats, METH_NOARGS,
+        "Position, readings lost to overruns and readings pending." },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyModuleDef acunative_module = {
+    PyModuleDef_HEAD_INIT,
+    "acunative",                            // m_name
+    "Native AcuRite capture and decoding.", // m_doc
+    -1,                                     // m_size
+    NULL,                                   // m_methods
+    NULL,                                   // m_slots
+    NULL,                                   // m_traverse
+    NULL,                                   // m_clear
+    NULL                                    // m_free
+};
+
+PyMODINIT_FUNC PyInit_acunative(void) {
+    /* All PyVarObject_HEAD_INIT(NULL, 0) would set that a zeroed type lacks. */
+    Py_SET_REFCNT(&CaptureType, 1);
+    Py_SET_REFCNT(&ReaderType, 1);
+    CaptureType.tp_name = "acunative.Capture";
+    CaptureType.tp_doc = "Capture(pin=17, chip='/dev/gpiochip0', path=None, sampled=False, cpu=-1, priority=0,\n"
+        "        decode_cpu=-1, decode_priority=0, lock_memory=False, verbosity=0, ring=None)";
+    CaptureType.tp_basicsize = sizeof(CaptureObject);
+    CaptureType.tp_flags = Py_TPFLAGS_DEFAULT;
+    CaptureType.tp_new = Capture_new;
+    CaptureType.tp_init = (initproc)Capture_init;
+    CaptureType.tp_dealloc = (destructor)Capture_dealloc;
+    CaptureType.tp_methods = Capture_methods;
+    if (PyType_Ready(&CaptureType) < 0)
+        return NULL;
+    ReaderType.tp_name = "acunative.Reader";
+    ReaderType.tp_doc = "Reader(name)\n\nCursor on the ring of a Capture(ring=name) in another process.";
+    ReaderType.tp_basicsize = sizeof(ReaderObject);
+    ReaderType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ReaderType.tp_new = Reader_new;
+    ReaderType.tp_init = (initproc)Reader_init;
+    ReaderType.tp_dealloc = (destructor)Reader_dealloc;
+    ReaderType.tp_methods = Reader_methods;
+    if (PyType_Ready(&ReaderType) < 0)
+        return NULL;
+    PyObject *m = PyModule_Create(&acunative_module);
+    if (!m)
+        return NULL;
+    Py_INCREF(&CaptureType);
+    if (PyModule_AddObject(m, "Capture", (PyObject *)&CaptureType) < 0) {
+        Py_DECREF(&CaptureType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    Py_INCREF(&ReaderType);
+    if (PyModule_AddObject(m, "Reader", (PyObject *)&ReaderType) < 0) {
+        Py_DECREF(&ReaderType);
+        Py_DECREF(m);
+        return NULL;
+    }
+    return m;
+}
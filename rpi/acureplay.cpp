@@ -0,0 +1,105 @@
+/**
+ * Decodes a raw OOK sample recording, e.g. a logic analyser capture of the
+ * receiver's data pin or a thresholded SDR envelope.
+ *
+ * Usage: acureplay [-r rate] [-f u8|bit] [-t high:low] [-n] [-q] [file]
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "acudecoder.h"
+#include "ooksampler.h"
+
+#define READ_SIZE   (4 << 20)
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acureplay [-r rate] [-f u8|bit] [-t high:low] [-n] [-q] [file]\n"
+        "  -r rate       sample rate in Hz (default 1000000)\n"
+        "  -f format     u8: one sample per byte, bit: 8 samples per byte, LSB first\n"
+        "  -t high:low   hysteresis thresholds for u8 samples (default 128:96)\n"
+        "  -n            do not invert levels (receiver output high = carrier off)\n"
+        "  -q            do not log bitstreams\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t rate = 1000000;
+    int format = OOK_FORMAT_U8;
+    int high = 128, low = 96;
+    bool invert = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:t:nq")) != -1) {
+        switch (opt) {
+            case 'r':
+                rate = strtoul(optarg, NULL, 10);
+                break;
+            case 'f':
+                if (strcmp(optarg, "u8") == 0)
+                    format = OOK_FORMAT_U8;
+                else if (strcmp(optarg, "bit") == 0)
+                    format = OOK_FORMAT_BIT;
+                else
+                    usage();
+                break;
+            case 't':
+                if (sscanf(optarg, "%d:%d", &high, &low) != 2 || high > 255 || low < 0)
+                    usage();
+                break;
+            case 'n':
+                invert = false;
+                break;
+            case 'q':
+                Serial.out = NULL;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (rate == 0)
+        usage();
+    int fd = 0;
+    if (optind < argc && (fd = open(argv[optind], O_RDONLY)) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    OokSampler sampler(rate, format, high, low, invert);
+    AcuDecoder decoder;
+    std::vector<Pulse> pulses;
+    std::vector<Payload> payloads;
+    uint8_t *buffer = (uint8_t *)malloc(READ_SIZE);
+    uint64_t bytes = 0, pulse_count = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    ssize_t n;
+    do {
+        n = read(fd, buffer, READ_SIZE);
+        if (n < 0) {
+            perror("read");
+            return 1;
+        }
+        pulses.clear();
+        if (n > 0)
+            sampler.feed(buffer, n, pulses);
+        else
+            sampler.flush(pulses);
+        bytes += n;
+        pulse_count += pulses.size();
+        decoder.parse_pulses(pulses.data(), pulses.size(), payloads);
+        for (Payload& p : payloads)
+            printf("model=%u device=%u status=%u battery=%u temperature=%.1f humidity=%.1f\n",
+                    p.model, p.device, p.status, p.battery, p.temperature / 10.0, p.humidity / 10.0);
+        payloads.clear();
+    } while (n > 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "# %llu samples, %llu pulses, %.3fs, %.1f MB/s\n",
+            (unsigned long long)sampler.samples(), (unsigned long long)pulse_count,
+            secs, secs > 0 ? bytes / secs / 1e6 : 0.0);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,313 @@
+/**
+ * Tunes the get_rfs_type windows against recorded pulse files (as written by
+ * acucapture -w) and writes them as a thresholds.h for ../esp32.
+ *
+ * Each round replays the corpus through every neighbour of the current best
+ * window set, one candidate per thread over the same read-only pulses, and
+ * moves to the best scoring one. A reading counts as accepted if the same
+ * reading decodes at least twice under some candidate (the sensors repeat
+ * every block), otherwise as a false accept.
+ *
+ * Usage: acutune [-j threads] [-r rounds] [-p penalty] [-o file] [-q] file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "acudecoder.h"
+#include "pulsesource.h"
+
+#define TUNE_PARAMS     16
+#define TUNE_BATCH      4096
+
+/* Relative steps tried for each window edge, in percent. */
+static const int steps[] = { 1, 2, 5, 10, 20 };
+
+/* Receivers stretch one level at the expense of the other, which moves every
+   window of that level at once; single edge steps cannot follow that. These
+   ranges of params are also shifted together, by shifts microseconds. */
+static const int groups[][2] = { { 0, 4 }, { 4, 8 }, { 9, 16 } };
+static const int shifts[] = { 10, 25, 50, 100, 200 };
+
+struct Candidate {
+    Acurite523::Windows acurite523;
+    Acurite609::Windows acurite609;
+};
+
+/* Decoded readings and how often each was seen. */
+typedef std::unordered_map<uint64_t, uint32_t> Readings;
+
+struct Corpus {
+    std::vector<Pulse> pulses;
+    std::vector<size_t> ends;   // End of each file in pulses
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: acutune [-j threads] [-r rounds] [-p penalty] [-o file] [-q] file...\n"
+        "  -j threads   candidates replayed in parallel (default: all cores)\n"
+        "  -r rounds    maximum search rounds (default 20)\n"
+        "  -p penalty   score cost of a false accept, in readings (default 10)\n"
+        "  -o file      write the header to file instead of stdout\n"
+        "  -q           do not report progress\n");
+    exit(1);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool load(const char *path, Corpus& corpus) {
+    FilePulseSource source(path);
+    if (!source.open_file())
+        return false;
+    Pulse pulses[TUNE_BATCH];
+    ssize_t n;
+    while ((n = source.read_pulses(pulses, TUNE_BATCH)) > 0)
+        corpus.pulses.insert(corpus.pulses.end(), pulses, pulses + n);
+    corpus.ends.push_back(corpus.pulses.size());
+    return n == 0;
+}
+
+/** Window edges that are searched, in the order of the generated header. */
+static uint32_t *param(Candidate& c, int i) {
+    if (i < 4)
+        return &c.acurite523.off[i];
+    if (i < 8)
+        return &c.acurite523.on[i - 4];
+    if (i == 8)
+        return &c.acurite609.off_max;
+    if (i < 12)
+        return &c.acurite609.on[i - 9];
+    if (i < 14)
+        return &c.acurite609.start[i - 12];
+    return &c.acurite609.end[i - 14];
+}
+
+/** True if the windows are ordered and do not overlap. */
+static bool valid(const Candidate& c) {
+    const Acurite523::Windows& a = c.acurite523;
+    const Acurite609::Windows& b = c.acurite609;
+    for (int i = 0; i < 3; i++) {
+        if (a.off[i] >= a.off[i + 1] || a.on[i] >= a.on[i + 1])
+            return false;
+    }
+    return
+        a.off[0] >= PULSE_MIN_DURATION && a.on[0] >= PULSE_MIN_DURATION &&
+        a.on[3] <= a.chunk_end[0] &&
+        b.on[0] < b.on[1] && b.on[1] < b.on[2] && b.on[2] <= b.start[0] &&
+        b.start[0] < b.start[1] && b.start[1] <= b.end[0] &&
+        b.end[0] < b.end[1] && b.end[1] <= b.chunk_end[0];
+}
+
+/** Moves param i by step percent. */
+static bool scale(Candidate& c, int i, int step) {
+    uint32_t *edge = param(c, i);
+    int32_t delta = (int32_t)*edge * step / 100;
+    if (delta == 0)
+        return false;
+    *edge += delta;
+    return valid(c);
+}
+
+/** Moves params [first, last) by shift microseconds. */
+static bool shift(Candidate& c, int first, int last, int32_t shift) {
+    for (int i = first; i < last; i++) {
+        uint32_t *edge = param(c, i);
+        if (shift < 0 && (uint32_t)-shift >= *edge)
+            return false;
+        *edge += shift;
+    }
+    return valid(c);
+}
+
+/** The current best first, then every valid step from it. */
+static std::vector<Candidate> neighbours(const Candidate& best) {
+    std::vector<Candidate> candidates = { best };
+    for (int sign = -1; sign <= 1; sign += 2) {
+        for (int i = 0; i < TUNE_PARAMS; i++) {
+            for (int step : steps) {
+                Candidate c = best;
+                if (scale(c, i, sign * step))
+                    candidates.push_back(c);
+            }
+        }
+        for (auto& group : groups) {
+            for (int us : shifts) {
+                Candidate c = best;
+                if (shift(c, group[0], group[1], sign * us))
+                    candidates.push_back(c);
+            }
+        }
+    }
+    return candidates;
+}
+
+static uint64_t reading_key(const Payload& p) {
+    return (uint64_t)p.device << 48 | (uint64_t)p.battery << 32 |
+        (uint64_t)(uint16_t)p.temperature << 16 | (uint16_t)p.humidity;
+}
+
+static void replay(const Corpus& corpus, const Candidate& candidate, Readings& readings) {
+    std::vector<Payload> payloads;
+    size_t start = 0;
+    for (size_t end : corpus.ends) {
+        AcuDecoder decoder;
+        decoder.acurite523.windows = candidate.acurite523;
+        decoder.acurite609.windows = candidate.acurite609;
+        decoder.parse_pulses(&corpus.pulses[start], end - start, payloads);
+        start = end;
+    }
+    for (Payload& p : payloads)
+        readings[reading_key(p)]++;
+}
+
+static void replay_all(const Corpus& corpus, const std::vector<Candidate>& candidates,
+        std::vector<Readings>& results, int threads) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    results.assign(candidates.size(), Readings());
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&]() {
+            size_t i;
+            while ((i = next++) < candidates.size())
+                replay(corpus, candidates[i], results[i]);
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+static void score(const Readings& readings, const std::unordered_set<uint64_t>& confirmed,
+        uint32_t& accepted, uint32_t& rejected) {
+    accepted = rejected = 0;
+    for (auto& reading : readings) {
+        if (confirmed.count(reading.first))
+            accepted += reading.second;
+        else
+            rejected += reading.second;
+    }
+}
+
+static void write_header(FILE *out, const Candidate& c, const char *summary) {
+    const Acurite523::Windows& a = c.acurite523;
+    const Acurite609::Windows& b = c.acurite609;
+    fprintf(out, "/* Generated by acutune: %s */\n", summary);
+    fprintf(out, "#define ACURITE523_OFF_WINDOWS      { %u, %u, %u, %u }\n", a.off[0], a.off[1], a.off[2], a.off[3]);
+    fprintf(out, "#define ACURITE523_ON_WINDOWS       { %u, %u, %u, %u }\n", a.on[0], a.on[1], a.on[2], a.on[3]);
+    fprintf(out, "#define ACURITE523_CHUNK_END_WINDOW { %u, %u }\n", a.chunk_end[0], a.chunk_end[1]);
+    fprintf(out, "#define ACURITE609_OFF_MAX          %u\n", b.off_max);
+    fprintf(out, "#define ACURITE609_ON_WINDOWS       { %u, %u, %u }\n", b.on[0], b.on[1], b.on[2]);
+    fprintf(out, "#define ACURITE609_START_WINDOW     { %u, %u }\n", b.start[0], b.start[1]);
+    fprintf(out, "#define ACURITE609_END_WINDOW       { %u, %u }\n", b.end[0], b.end[1]);
+    fprintf(out, "#define ACURITE609_CHUNK_END_WINDOW { %u, %u }\n", b.chunk_end[0], b.chunk_end[1]);
+}
+
+int main(int argc, char **argv) {
+    int threads = std::thread::hardware_concurrency();
+    int rounds = 20;
+    double penalty = 10;
+    const char *output = NULL;
+    bool quiet = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:r:p:o:q")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'r':
+                rounds = atoi(optarg);
+                break;
+            case 'p':
+                penalty = atof(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind == argc || rounds < 1)
+        usage();
+    if (threads < 1)
+        threads = 1;
+    Serial.out = NULL;
+
+    Corpus corpus;
+    for (int i = optind; i < argc; i++) {
+        if (!load(argv[i], corpus)) {
+            perror(argv[i]);
+            return 1;
+        }
+    }
+
+    AcuDecoder defaults;
+    Candidate best = { defaults.acurite523.windows, defaults.acurite609.windows };
+    std::unordered_set<uint64_t> confirmed;
+    Readings baseline;
+    double best_score = 0;
+    for (int round = 1; round <= rounds; round++) {
+        double t0 = now();
+        std::vector<Candidate> candidates = neighbours(best);
+        std::vector<Readings> results;
+        replay_all(corpus, candidates, results, threads);
+        if (round == 1)
+            baseline = results[0];
+        for (Readings& readings : results) {
+            for (auto& reading : readings) {
+                if (reading.second >= 2)
+                    confirmed.insert(reading.first);
+            }
+        }
+        size_t chosen = 0;
+        uint32_t accepted, rejected, best_accepted = 0, best_rejected = 0;
+        for (size_t i = 0; i < results.size(); i++) {
+            score(results[i], confirmed, accepted, rejected);
+            double s = accepted - penalty * rejected;
+            if (i == 0 || s > best_score) {
+                chosen = i;
+                best_score = s;
+                best_accepted = accepted;
+                best_rejected = rejected;
+            }
+        }
+        if (!quiet)
+            fprintf(stderr, "round %d: %zu candidates, %u readings, %u false accepts, %.2fs\n",
+                    round, candidates.size(), best_accepted, best_rejected, now() - t0);
+        if (chosen == 0)
+            break;
+        best = candidates[chosen];
+    }
+
+    /* Final scores use every confirmed reading found along the way. */
+    Readings tuned;
+    replay(corpus, best, tuned);
+    uint32_t accepted, rejected, base_accepted, base_rejected;
+    score(tuned, confirmed, accepted, rejected);
+    score(baseline, confirmed, base_accepted, base_rejected);
+    char summary[256];
+    snprintf(summary, sizeof(summary),
+            "%zu files, %zu pulses.\n   %u readings, %u false accepts; the defaults gave %u and %u.",
+            corpus.ends.size(), corpus.pulses.size(), accepted, rejected, base_accepted, base_rejected);
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror(output);
+        return 1;
+    }
+    write_header(out, best, summary);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,275 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <new>
+#include "broadcast.h"
+
+static_assert(sizeof(BroadcastSlot) == 32, "BroadcastSlot must be 32 bytes");
+static_assert(sizeof(BroadcastHeader) == 64, "slots must start on a cache line");
+
+/* Works across processes: the ring may be in shared memory. */
+static void futex_wait(std::atomic<uint32_t> *word, uint32_t value, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT, value, timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t> *word) {
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/** @param capacity records kept, rounded up to a power of two */
+BroadcastRing::BroadcastRing(size_t capacity) {
+    this->capacity = 1;
+    while (this->capacity < capacity)
+        this->capacity <<= 1;
+    size = sizeof(BroadcastHeader) + this->capacity * sizeof(BroadcastSlot);
+    name = NULL;
+    header = (BroadcastHeader *)::operator new(size, std::align_val_t(alignof(BroadcastHeader)));
+    memset((void *)header, 0, size);
+    init();
+}
+
+BroadcastRing::~BroadcastRing() {
+    if (name) {
+        close();
+        munmap(header, size);
+        shm_unlink(name);
+        free(name);
+    }
+    else
+        ::operator delete(header, std::align_val_t(alignof(BroadcastHeader)));
+}
+
+/** Fills in the header of zeroed ring memory. */
+void BroadcastRing::init() {
+    slots = (BroadcastSlot *)(header + 1);
+    header->version = BROADCAST_VERSION;
+    header->slot_size = sizeof(BroadcastSlot);
+    header->capacity = capacity;
+    header->magic.store(BROADCAST_MAGIC, std::memory_order_release);
+}
+
+/**
+ * Moves the ring into a new POSIX shared memory segment so that other
+ * processes can open cursors on it. A ring left by an earlier producer is
+ * closed first, waking its consumers. Call before any publish(); calling
+ * it again moves the ring to another new segment.
+ *
+ * @param name shared memory name, e.g. /acurite-payloads
+ * @return true on success, false with errno set on failure
+ */
+bool BroadcastRing::share(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd >= 0) {
+        void *old = mmap(NULL, sizeof(BroadcastHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (old != MAP_FAILED) {
+            BroadcastHeader *h = (BroadcastHeader *)old;
+            h->closed.store(1, std::memory_order_release);
+            h->futex.fetch_add(1);
+            futex_wake(&h->futex);
+            munmap(old, sizeof(BroadcastHeader));
+        }
+        ::close(fd);
+        shm_unlink(name);
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+        return false;
+    void *shared = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (shared == MAP_FAILED) {
+        shm_unlink(name);
+        errno = error;
+        return false;
+    }
+    if (this->name) {
+        /* Shared before: let the consumers of the old segment go, and the
+           segment with them unless it was just replaced under the same name. */
+        close();
+        munmap(header, size);
+        if (strcmp(this->name, name) != 0)
+            shm_unlink(this->name);
+        free(this->name);
+    }
+    else
+        ::operator delete(header, std::align_val_t(alignof(BroadcastHeader)));
+    header = (BroadcastHeader *)shared;
+    this->name = strdup(name);
+    init();
+    return true;
+}
+
+/**
+ * Writes the next record over the oldest one. The cost is the same for any
+ * number of consumers; the futex is only woken when one of them sleeps.
+ */
+void BroadcastRing::publish(const Payload& payload, uint64_t ns) {
+    uint64_t n = header->head.load(std::memory_order_relaxed);
+    BroadcastSlot& slot = slots[n & (capacity - 1)];
+    uint64_t words[BROADCAST_WORDS] = { };
+    BroadcastRecord record = { ns, payload };
+    memcpy(words, &record, sizeof(record));
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t w = 0; w < BROADCAST_WORDS; w++)
+        slot.words[w].store(words[w], std::memory_order_relaxed);
+    slot.sequence.store(n + 1, std::memory_order_release);
+    header->head.store(n + 1, std::memory_order_release);
+    header->futex.fetch_add(1);
+    if (header->waiters.load())
+        futex_wake(&header->futex);
+}
+
+/** Tells consumers that no more records are coming. */
+void BroadcastRing::close() {
+    header->closed.store(1, std::memory_order_release);
+    header->futex.fetch_add(1);
+    futex_wake(&header->futex);
+}
+
+/** Undoes close() when the producer starts again. */
+void BroadcastRing::reopen() {
+    header->closed.store(0, std::memory_order_release);
+}
+
+BroadcastCursor::BroadcastCursor() {
+    this->header = NULL;
+    this->slots = NULL;
+    this->mask = 0;
+    this->size = 0;
+    this->position = 0;
+    this->lost = 0;
+}
+
+/** Cursor on a ring in this process. */
+BroadcastCursor::BroadcastCursor(const BroadcastRing& ring) {
+    this->header = ring.header;
+    this->slots = (BroadcastSlot *)(ring.header + 1);
+    this->mask = ring.capacity - 1;
+    this->size = 0;
+    this->position = ring.head();
+    this->lost = 0;
+}
+
+BroadcastCursor::~BroadcastCursor() {
+    if (size)
+        munmap(header, size);
+}
+
+/**
+ * Maps a ring shared by another process. The mapping is writable because
+ * sleeping consumers register themselves in the header.
+ *
+ * @return true on success, false with errno set on failure: ENOENT if there
+ *         is no producer, EAGAIN while it is setting up, EPROTO if the layout
+ *         differs
+ */
+bool BroadcastCursor::open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) < 0)
+        st.st_size = 0;
+    else if ((size_t)st.st_size < sizeof(BroadcastHeader))
+        errno = EAGAIN;
+    else
+        mapping = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        errno = error;
+        return false;
+    }
+    BroadcastHeader *h = (BroadcastHeader *)mapping;
+    error = 0;
+    if (h->magic.load(std::memory_order_acquire) != BROADCAST_MAGIC)
+        error = EAGAIN;
+    else if (h->version != BROADCAST_VERSION || h->slot_size != sizeof(BroadcastSlot) ||
+            (h->capacity & (h->capacity - 1)) ||
+            (size_t)st.st_size < sizeof(BroadcastHeader) + (size_t)h->capacity * sizeof(BroadcastSlot))
+        error = EPROTO;
+    if (error) {
+        munmap(mapping, st.st_size);
+        errno = error;
+        return false;
+    }
+    if (size)
+        munmap(header, size);
+    header = h;
+    slots = (BroadcastSlot *)(h + 1);
+    mask = h->capacity - 1;
+    size = st.st_size;
+    position = h->head.load(std::memory_order_acquire);
+    lost = 0;
+    return true;
+}
+
+/**
+ * Copies the next record. If the producer has lapped this cursor, the
+ * overwritten records are added to lost and reading resumes at the oldest
+ * record still in the ring.
+ *
+ * @return false if there is no new record
+ */
+bool BroadcastCursor::next(BroadcastRecord& record) {
+    for (;;) {
+        const BroadcastSlot& slot = slots[position & mask];
+        uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence == position + 1) {
+            uint64_t words[BROADCAST_WORDS];
+            for (size_t w = 0; w < BROADCAST_WORDS; w++)
+                words[w] = slot.words[w].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+                memcpy(&record, words, sizeof(record));
+                position++;
+                return true;
+            }
+        }
+        uint64_t head = header->head.load(std::memory_order_acquire);
+        if (head <= position)
+            return false;
+        /* Record position is complete, so an older sequence is a stale view. */
+        if (sequence != 0 && sequence <= position + 1)
+            continue;
+        uint64_t oldest = head + 1 - (mask + 1);
+        lost += oldest - position;
+        position = oldest;
+    }
+}
+
+/**
+ * Sleeps until a record is published, the ring is closed or timeout_ms
+ * passes (-1 for no limit).
+ *
+ * @return true if there is a record to read
+ */
+bool BroadcastCursor::wait(int timeout_ms) {
+    if (pending())
+        return true;
+    header->waiters.fetch_add(1);
+    uint32_t value = header->futex.load();
+    if (!pending() && !closed())
+        futex_wait(&header->futex, value, timeout_ms);
+    header->waiters.fetch_sub(1);
+    return pending() > 0;
+}
+
+/** @return records published that this cursor has not read, lapped or not */
+uint64_t BroadcastCursor::pending() const {
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    return head > position ? head - position : 0;
+}
@@ -0,0 +1,90 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "../esp32/acumonitor.h"
+
+#define BROADCAST_SIZE      1024            // Default records kept, power of two
+#define BROADCAST_MAGIC     0x52425341      // "ASBR"
+#define BROADCAST_VERSION   1               // Layout of BroadcastHeader and BroadcastSlot
+
+/* A published reading. */
+struct BroadcastRecord {
+    uint64_t ns;            // CLOCK_REALTIME when published
+    Payload payload;
+};
+
+#define BROADCAST_WORDS     ((sizeof(BroadcastRecord) + 7) / 8)
+
+/*
+ * One record. sequence is the record's number + 1 once it is complete and
+ * 0 while the producer is overwriting it.
+ */
+struct alignas(32) BroadcastSlot {
+    std::atomic<uint64_t> sequence;
+    std::atomic<uint64_t> words[BROADCAST_WORDS];   // BroadcastRecord
+};
+
+/* Start of the ring's memory, followed by capacity slots. */
+struct alignas(64) BroadcastHeader {
+    std::atomic<uint32_t> magic;        // Written last
+    uint32_t version;
+    uint32_t slot_size;                 // sizeof(BroadcastSlot)
+    uint32_t capacity;
+    std::atomic<uint64_t> head;         // Records published
+    std::atomic<uint32_t> futex;        // Bumped on every publish and close
+    std::atomic<uint32_t> waiters;      // Consumers asleep on futex
+    std::atomic<uint32_t> closed;       // Producer has stopped
+};
+
+/**
+ * Single-producer, multi-consumer broadcast ring of readings in shared
+ * memory. The producer writes each record once, whatever the number of
+ * consumers, and never waits for them: each consumer (BroadcastCursor) keeps
+ * its own position and finds out when it has been lapped. Consumers in other
+ * processes open the ring by name once share() has been called.
+ */
+class BroadcastRing {
+    public:
+        BroadcastRing(size_t capacity);
+        ~BroadcastRing();
+        bool share(const char *name);
+        void publish(const Payload& payload, uint64_t ns);
+        void close();
+        void reopen();
+        uint64_t head() const { return header->head.load(std::memory_order_acquire); }
+        BroadcastHeader *header;
+        size_t capacity;
+    private:
+        BroadcastSlot *slots;
+        size_t size;                    // Bytes mapped
+        char *name;                     // Shared memory name, or NULL
+        void init();
+};
+
+/**
+ * One consumer's position in a BroadcastRing, starting at the next record
+ * to be published. Not shared between threads.
+ */
+class BroadcastCursor {
+    public:
+        BroadcastCursor();
+        BroadcastCursor(const BroadcastRing& ring);
+        ~BroadcastCursor();
+        bool open(const char *name);
+        bool next(BroadcastRecord& record);
+        bool wait(int timeout_ms);
+        bool closed() const { return !header || header->closed.load(std::memory_order_acquire) != 0; }
+        uint64_t pending() const;
+        uint64_t position;              // Number of the next record to read
+        uint64_t lost;                  // Records overwritten before they were read
+    private:
+        BroadcastHeader *header;
+        BroadcastSlot *slots;
+        size_t mask;
+        size_t size;                    // Bytes mapped by open(), 0 if attached
+};
+
+#endif
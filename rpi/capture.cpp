@@ -0,0 +1,69 @@
+#include <errno.h>
+#include <vector>
+#include "capture.h"
+#include "gpiomem.h"
+
+#define LOAD_BATCH  256
+
+/**
+ * Creates the pulse source described by config: GPIO edge events, the
+ * sampled level register, or a pulse file (played through a simulated
+ * register when sampled is set).
+ *
+ * @return the source, or NULL with errno set
+ */
+PulseSource *open_source(const CaptureConfig& config) {
+    if (config.lock_memory)
+        rt_lock_memory();
+    if (config.path) {
+        FilePulseSource *file = new FilePulseSource(config.path);
+        if (!file->open_file()) {
+            int err = errno;
+            delete file;
+            errno = err;
+            return NULL;
+        }
+        if (!config.sampled) {
+            file->jitter = config.jitter;
+            return file;
+        }
+        std::vector<Pulse> recorded;
+        Pulse batch[LOAD_BATCH];
+        ssize_t n;
+        while ((n = file->read_pulses(batch, LOAD_BATCH)) > 0)
+            recorded.insert(recorded.end(), batch, batch + n);
+        delete file;
+        FakeRegisters *fake = new FakeRegisters(recorded, config.pin);
+        return new SampledPulseSource<FakeRegisters>(fake, config.pin, config.capture, config.jitter);
+    }
+    if (config.sampled) {
+        GpioMemRegisters *registers = new GpioMemRegisters();
+        if (!registers->open_registers()) {
+            int err = errno;
+            delete registers;
+            errno = err;
+            return NULL;
+        }
+        return new SampledPulseSource<GpioMemRegisters>(registers, config.pin, config.capture, config.jitter);
+    }
+    GpioEventSource *gpio = new GpioEventSource(config.chip, config.pin);
+    if (!gpio->open_line()) {
+        int err = errno;
+        delete gpio;
+        errno = err;
+        return NULL;
+    }
+    gpio->jitter = config.jitter;
+    return gpio;
+}
+
+/**
+ * Applies the scheduling config to the calling thread, the one that will run
+ * read_pulses and the parsers: the decode thread when sampling, otherwise the
+ * capture thread itself.
+ */
+bool apply_reader_thread(const CaptureConfig& config) {
+    if (config.sampled)
+        return rt_apply_thread(config.decode, "decoder");
+    return rt_apply_thread(config.capture, "capture");
+}
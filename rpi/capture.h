@@ -0,0 +1,22 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "pulsesource.h"
+#include "realtime.h"
+
+/* Where native capture gets its pulses from. */
+struct CaptureConfig {
+    const char *chip = "/dev/gpiochip0";
+    unsigned int pin = 17;
+    const char *path = NULL;    // Pulse file instead of GPIO, - for stdin
+    bool sampled = false;       // Sample /dev/gpiomem instead of edge events
+    ThreadConfig capture;       // Sampling thread, or the reading thread for edge events
+    ThreadConfig decode;        // Thread running the parsers when separate from capture
+    bool lock_memory = false;   // mlockall before allocating buffers
+    JitterStats *jitter = NULL;
+};
+
+PulseSource *open_source(const CaptureConfig& config);
+bool apply_reader_thread(const CaptureConfig& config);
+
+#endif
@@ -0,0 +1,54 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "gpiomem.h"
+
+#define GPIOMEM_MAP_SIZE    4096
+
+GpioMemRegisters::GpioMemRegisters() {
+    regs = NULL;
+}
+
+GpioMemRegisters::~GpioMemRegisters() {
+    if (regs)
+        munmap((void *)regs, GPIOMEM_MAP_SIZE);
+}
+
+/**
+ * Maps the GPIO register block. /dev/gpiomem is accessible to the gpio group
+ * without root.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool GpioMemRegisters::open_registers(const char *path) {
+    int fd = open(path, O_RDWR | O_SYNC | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    void *map = mmap(NULL, GPIOMEM_MAP_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    regs = (volatile uint32_t *)map;
+    return true;
+}
+
+FakeRegisters::FakeRegisters(const std::vector<Pulse>& pulses, unsigned int pin, uint32_t step_ns) {
+    this->pulses = pulses;
+    this->pin = pin;
+    this->step_ns = step_ns;
+    this->clock = 0;
+    this->index = 0;
+    this->pulse_end = pulses.empty() ? 0 : (uint64_t)pulses[0].duration * 1000;
+}
+
+uint32_t FakeRegisters::levels() {
+    clock += step_ns;
+    while (index < pulses.size() && clock >= pulse_end) {
+        index++;
+        if (index < pulses.size())
+            pulse_end += (uint64_t)pulses[index].duration * 1000;
+    }
+    if (index >= pulses.size())
+        return 0;
+    // The pin level is the inverse of rfs
+    return pulses[index].rfs ? 0 : (1u << pin);
+}
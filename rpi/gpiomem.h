@@ -0,0 +1,169 @@
+#ifndef GPIOMEM_H
+#define GPIOMEM_H
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "../esp32/ringbuffer.h"
+#include "pulsesource.h"
+#include "realtime.h"
+
+#define GPIOMEM_GPLEV0      (0x34 / 4)  // Pin level register for GPIO 0-31
+#define GPIOMEM_RING_SIZE   4096        // Pulses buffered between sampler and decoder
+#define GPIOMEM_POLL_STOP   4096        // Samples between checks of the stop flag
+
+/**
+ * Register sources share this interface (no virtuals, so the sampling loop
+ * inlines the register read):
+ *
+ *     uint32_t levels();   current value of the GPLEV0 register
+ *     uint64_t now();      timestamp in nanoseconds
+ *     bool finished();     no more samples will change
+ */
+
+/**
+ * GPLEV0 read through an mmap of /dev/gpiomem (BCM2835 through BCM2711;
+ * the Pi 5 uses the RP1 and is not supported).
+ */
+class GpioMemRegisters {
+    public:
+        GpioMemRegisters();
+        ~GpioMemRegisters();
+        bool open_registers(const char *path = "/dev/gpiomem");
+        uint32_t levels() { return regs[GPIOMEM_GPLEV0]; }
+        uint64_t now() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+        bool finished() { return false; }
+    private:
+        volatile uint32_t *regs;
+};
+
+/**
+ * Plays back a list of pulses as a level register on a virtual clock for
+ * testing without a Pi. Each read advances the clock by step_ns.
+ */
+class FakeRegisters {
+    public:
+        FakeRegisters(const std::vector<Pulse>& pulses, unsigned int pin, uint32_t step_ns = 100);
+        uint32_t levels();
+        uint64_t now() { return clock; }
+        bool finished() { return index >= pulses.size(); }
+    private:
+        std::vector<Pulse> pulses;
+        unsigned int pin;
+        uint32_t step_ns;
+        uint64_t clock;
+        uint64_t pulse_end;     // Virtual time at which pulses[index] ends
+        size_t index;
+};
+
+/**
+ * Samples one pin in a tight loop and run-length encodes it into pulses on a
+ * lock-free ring. Meant to own an isolated core (isolcpus=) so the loop is
+ * never preempted; edges are timestamped to within one loop iteration.
+ */
+template<class Registers>
+class GpioMemSampler {
+    public:
+        RingBuffer<Pulse, GPIOMEM_RING_SIZE> ring;
+        std::atomic<bool> stop;
+        std::atomic<bool> done;
+        std::atomic<uint64_t> overruns; // Pulses dropped because the ring was full
+        JitterStats *jitter;            // Time per GPIOMEM_POLL_STOP samples
+
+        GpioMemSampler(Registers *registers, unsigned int pin) :
+            stop(false), done(false), overruns(0), jitter(NULL) {
+            this->registers = registers;
+            this->mask = 1u << pin;
+        }
+
+        void run() {
+            uint32_t level = registers->levels() & mask;
+            uint64_t edge = registers->now();
+            bool started = false;
+            while (!stop.load(std::memory_order_relaxed) && !registers->finished()) {
+                uint64_t block = jitter ? registers->now() : 0;
+                for (int i = 0; i < GPIOMEM_POLL_STOP; i++) {
+                    uint32_t value = registers->levels() & mask;
+                    if (value == level)
+                        continue;
+                    uint64_t t = registers->now();
+                    if (started) {
+                        uint64_t us = (t - edge) / 1000;
+                        Pulse pulse;
+                        pulse.duration = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+                        pulse.rfs = level ? 0 : 1;  // rfs is the inverted pin level
+                        if (!ring.push(pulse))
+                            overruns.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    started = true;
+                    level = value;
+                    edge = t;
+                }
+                if (jitter)
+                    jitter->record(registers->now() - block);
+            }
+            done.store(true, std::memory_order_release);
+        }
+
+    private:
+        Registers *registers;
+        uint32_t mask;
+};
+
+/**
+ * Runs a GpioMemSampler on its own thread and hands its pulses to the
+ * decoder through read_pulses. Takes ownership of the register source.
+ */
+template<class Registers>
+class SampledPulseSource : public PulseSource {
+    public:
+        GpioMemSampler<Registers> sampler;
+
+        SampledPulseSource(Registers *registers, unsigned int pin,
+                const ThreadConfig& config = ThreadConfig(), JitterStats *jitter = NULL) :
+            sampler(registers, pin) {
+            this->registers = registers;
+            this->jitter = jitter;
+            sampler.jitter = jitter;
+            rt_prefault(&sampler.ring, sizeof(sampler.ring));
+            thread = std::thread([this, config] {
+                rt_apply_thread(config, "sampler");
+                sampler.run();
+            });
+        }
+
+        ~SampledPulseSource() {
+            sampler.stop.store(true);
+            thread.join();
+            delete registers;
+        }
+
+        void interrupt() override {
+            sampler.stop.store(true);
+        }
+
+        ssize_t read_pulses(Pulse *pulses, size_t max) override {
+            while (true) {
+                bool done = sampler.done.load(std::memory_order_acquire);
+                size_t n = sampler.ring.pop(pulses, max);
+                if (n > 0)
+                    return n;
+                if (done)
+                    return 0;
+                usleep(1000);
+            }
+        }
+
+    private:
+        Registers *registers;
+        std::thread thread;
+};
+
+#endif
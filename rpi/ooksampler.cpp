@@ -0,0 +1,191 @@
+#include "ooksampler.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Vector helpers. Each returns a bitmask with MASK_BITS bits per byte lane so
+ * that the index of the first matching lane is ctz(mask) / MASK_BITS.
+ */
+#if defined(__AVX2__)
+#define VEC_LANES   32
+#define MASK_BITS   1
+static inline uint64_t mask_ge(const uint8_t *p, uint8_t t) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    __m256i ge = _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8(t)), x);
+    return (uint32_t)_mm256_movemask_epi8(ge);
+}
+static inline uint64_t mask_ne(const uint8_t *p, uint8_t v) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)p);
+    return (uint32_t)~_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(v)));
+}
+#define MASK_ALL    0xffffffffULL
+#elif defined(__SSE2__)
+#define VEC_LANES   16
+#define MASK_BITS   1
+static inline uint64_t mask_ge(const uint8_t *p, uint8_t t) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    __m128i ge = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(t)), x);
+    return (uint32_t)_mm_movemask_epi8(ge);
+}
+static inline uint64_t mask_ne(const uint8_t *p, uint8_t v) {
+    __m128i x = _mm_loadu_si128((const __m128i *)p);
+    return ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(v))) & 0xffff;
+}
+#define MASK_ALL    0xffffULL
+#elif defined(__ARM_NEON)
+/* No movemask on NEON; narrow each 0x00/0xff lane to a nibble instead. */
+#define VEC_LANES   16
+#define MASK_BITS   4
+static inline uint64_t nibble_mask(uint8x16_t m) {
+    uint8x8_t n = vshrn_n_u16(vreinterpretq_u16_u8(m), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(n), 0);
+}
+static inline uint64_t mask_ge(const uint8_t *p, uint8_t t) {
+    return nibble_mask(vcgeq_u8(vld1q_u8(p), vdupq_n_u8(t)));
+}
+static inline uint64_t mask_ne(const uint8_t *p, uint8_t v) {
+    return nibble_mask(vmvnq_u8(vceqq_u8(vld1q_u8(p), vdupq_n_u8(v))));
+}
+#define MASK_ALL    0xffffffffffffffffULL
+#endif
+
+/** Index of the first sample in [i, size) that is >= t, or size. */
+static size_t find_ge(const uint8_t *data, size_t i, size_t size, uint8_t t) {
+#ifdef VEC_LANES
+    for (; i + VEC_LANES <= size; i += VEC_LANES) {
+        uint64_t m = mask_ge(data + i, t);
+        if (m)
+            return i + (__builtin_ctzll(m) / MASK_BITS);
+    }
+#endif
+    for (; i < size; i++)
+        if (data[i] >= t)
+            return i;
+    return size;
+}
+
+/** Index of the first sample in [i, size) that is < t, or size. */
+static size_t find_lt(const uint8_t *data, size_t i, size_t size, uint8_t t) {
+#ifdef VEC_LANES
+    for (; i + VEC_LANES <= size; i += VEC_LANES) {
+        uint64_t m = ~mask_ge(data + i, t) & MASK_ALL;
+        if (m)
+            return i + (__builtin_ctzll(m) / MASK_BITS);
+    }
+#endif
+    for (; i < size; i++)
+        if (data[i] < t)
+            return i;
+    return size;
+}
+
+/** Index of the first byte in [i, size) that is not v, or size. */
+static size_t find_ne(const uint8_t *data, size_t i, size_t size, uint8_t v) {
+#ifdef VEC_LANES
+    for (; i + VEC_LANES <= size; i += VEC_LANES) {
+        uint64_t m = mask_ne(data + i, v);
+        if (m)
+            return i + (__builtin_ctzll(m) / MASK_BITS);
+    }
+#endif
+    for (; i < size; i++)
+        if (data[i] != v)
+            return i;
+    return size;
+}
+
+OokSampler::OokSampler(uint32_t rate, int format, uint8_t high, uint8_t low, bool invert) {
+    this->rate = rate;
+    this->format = format;
+    this->high = high;
+    this->low = low > high ? high : low;
+    this->invert = invert;
+    reset();
+}
+
+void OokSampler::reset() {
+    level = 0;
+    started = false;
+    position = 0;
+    edge = 0;
+}
+
+void OokSampler::emit(uint64_t at, std::vector<Pulse>& pulses) {
+    /* Close the run that ends at sample index `at`. The very first run is
+       dropped since its start was never observed. */
+    if (started) {
+        uint64_t us = (at - edge) * 1000000 / rate;
+        Pulse pulse;
+        pulse.duration = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+        pulse.rfs = level ^ (invert ? 1 : 0);
+        pulses.push_back(pulse);
+    }
+    started = true;
+    edge = at;
+}
+
+void OokSampler::feed_u8(const uint8_t *data, size_t size, std::vector<Pulse>& pulses) {
+    size_t i = 0;
+    while (i < size) {
+        i = level ? find_lt(data, i, size, low) : find_ge(data, i, size, high);
+        if (i == size)
+            break;
+        emit(position + i, pulses);
+        level ^= 1;
+        i++;
+    }
+}
+
+void OokSampler::feed_bit(const uint8_t *data, size_t size, std::vector<Pulse>& pulses) {
+    size_t i = 0;
+    int bit = 0;
+    while (i < size) {
+        // Skip whole bytes that hold no edge
+        if (bit == 0) {
+            i = find_ne(data, i, size, level ? 0xff : 0x00);
+            if (i == size)
+                break;
+        }
+        uint8_t diff = (level ? ~data[i] : data[i]) & (0xff << bit);
+        if (diff == 0) {
+            i++;
+            bit = 0;
+            continue;
+        }
+        bit = __builtin_ctz(diff);
+        emit(position + (uint64_t)i * 8 + bit, pulses);
+        level ^= 1;
+        if (++bit == 8) {
+            i++;
+            bit = 0;
+        }
+    }
+}
+
+/**
+ * Thresholds a block of samples and appends every completed pulse. Blocks may
+ * be split anywhere; state carries over between calls.
+ *
+ * @param data samples in the configured format
+ * @param size number of bytes in data
+ * @param pulses receives the completed pulses
+ */
+void OokSampler::feed(const uint8_t *data, size_t size, std::vector<Pulse>& pulses) {
+    if (format == OOK_FORMAT_BIT) {
+        feed_bit(data, size, pulses);
+        position += (uint64_t)size * 8;
+    }
+    else {
+        feed_u8(data, size, pulses);
+        position += size;
+    }
+}
+
+/** Emits the trailing run, e.g. at the end of a recording. */
+void OokSampler::flush(std::vector<Pulse>& pulses) {
+    emit(position, pulses);
+}
@@ -0,0 +1,44 @@
+#ifndef OOKSAMPLER_H
+#define OOKSAMPLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "../esp32/acumonitor.h"
+
+/* Sample formats */
+#define OOK_FORMAT_U8   0   // One amplitude sample per byte
+#define OOK_FORMAT_BIT  1   // Eight 1-bit samples per byte, LSB first
+
+/**
+ * Converts a raw stream of OOK envelope samples (logic analyser or SDR
+ * recording) into the pulses expected by the model parsers.
+ *
+ * 8-bit samples are thresholded with hysteresis: the level goes high once a
+ * sample reaches `high` and goes low again once a sample drops below `low`.
+ * Edges are located with SIMD compares where available so that long runs
+ * without an edge cost only a compare and a mask test per vector.
+ */
+class OokSampler {
+    public:
+        OokSampler(uint32_t rate, int format, uint8_t high = 128, uint8_t low = 96, bool invert = true);
+        void reset();
+        void feed(const uint8_t *data, size_t size, std::vector<Pulse>& pulses);
+        void flush(std::vector<Pulse>& pulses);
+        uint64_t samples() { return position; }
+    private:
+        uint32_t rate;          // Samples per second
+        int format;
+        uint8_t high;           // Rising threshold
+        uint8_t low;            // Falling threshold
+        bool invert;            // Match digitalRead(PIN_RX) ^ 1 used by the GPIO loops
+        uint8_t level;          // Current thresholded level
+        bool started;           // First edge seen; the run before it has no start
+        uint64_t position;      // Absolute index of the next sample
+        uint64_t edge;          // Absolute index of the last edge
+        void emit(uint64_t at, std::vector<Pulse>& pulses);
+        void feed_u8(const uint8_t *data, size_t size, std::vector<Pulse>& pulses);
+        void feed_bit(const uint8_t *data, size_t size, std::vector<Pulse>& pulses);
+};
+
+#endif
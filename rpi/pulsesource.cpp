@@ -0,0 +1,198 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/gpio.h>
+#include "pulsesource.h"
+
+GpioEventSource::GpioEventSource(const char *chip, unsigned int pin) {
+    this->chip = chip;
+    this->pin = pin;
+    this->fd = -1;
+    this->wake_fd = -1;
+    this->dropped = 0;
+    this->last_ns = 0;
+    this->last_seqno = 0;
+}
+
+GpioEventSource::~GpioEventSource() {
+    if (fd >= 0)
+        close(fd);
+    if (wake_fd >= 0)
+        close(wake_fd);
+}
+
+/**
+ * Requests the line as an input with events on both edges.
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool GpioEventSource::open_line() {
+    int chip_fd = open(chip, O_RDONLY | O_CLOEXEC);
+    if (chip_fd < 0)
+        return false;
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    req.offsets[0] = pin;
+    req.num_lines = 1;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT |
+        GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING;
+    req.event_buffer_size = GPIO_EVENT_BATCH * 16;
+    strncpy(req.consumer, "acumonitor", sizeof(req.consumer) - 1);
+    int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+    int err = errno;
+    close(chip_fd);
+    if (ret < 0) {
+        errno = err;
+        return false;
+    }
+    fd = req.fd;
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    return wake_fd >= 0;
+}
+
+ssize_t GpioEventSource::read_pulses(Pulse *pulses, size_t max) {
+    struct gpio_v2_line_event events[GPIO_EVENT_BATCH];
+    size_t want = max < GPIO_EVENT_BATCH ? max : GPIO_EVENT_BATCH;
+    size_t count = 0;
+    // The first edge after open or an overflow only starts a pulse
+    while (count == 0) {
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (fds[1].revents)
+            return 0;
+        ssize_t n = read(fd, events, want * sizeof(events[0]));
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+        if (jitter) {
+            // Wakeup latency: from the kernel timestamp of the last edge to now
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            uint64_t now = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            uint64_t edge = events[n / sizeof(events[0]) - 1].timestamp_ns;
+            jitter->record(now > edge ? now - edge : 0);
+        }
+        for (size_t i = 0; i < n / sizeof(events[0]); i++) {
+            struct gpio_v2_line_event& e = events[i];
+            if (last_ns && e.line_seqno != last_seqno + 1) {
+                // Missed edges; the level of this pulse is unknown
+                dropped += e.line_seqno - last_seqno - 1;
+                last_ns = 0;
+            }
+            if (last_ns) {
+                uint64_t us = (e.timestamp_ns - last_ns) / 1000;
+                pulses[count].duration = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+                // A rising edge ends a low pin level, i.e. rfs 1
+                pulses[count].rfs = e.id == GPIO_V2_LINE_EVENT_RISING_EDGE ? 1 : 0;
+                count++;
+            }
+            last_ns = e.timestamp_ns;
+            last_seqno = e.line_seqno;
+        }
+    }
+    return count;
+}
+
+void GpioEventSource::interrupt() {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+        return;
+}
+
+FilePulseSource::FilePulseSource(const char *path) {
+    this->path = path;
+    this->fd = -1;
+    this->wake_fd = -1;
+    this->used = 0;
+    this->ended = false;
+}
+
+FilePulseSource::~FilePulseSource() {
+    if (fd >= 0 && fd != STDIN_FILENO)
+        close(fd);
+    if (wake_fd >= 0)
+        close(wake_fd);
+}
+
+/**
+ * Opens the file, or stdin if path is "-".
+ *
+ * @return true on success, false with errno set on failure
+ */
+bool FilePulseSource::open_file() {
+    fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    return wake_fd >= 0;
+}
+
+/** Parses whole lines from the buffer into at most max pulses, keeping the rest. */
+size_t FilePulseSource::parse_lines(Pulse *pulses, size_t max) {
+    size_t count = 0, start = 0;
+    char *end;
+    while (count < max && (end = (char *)memchr(buffer + start, '\n', used - start))) {
+        char *line = buffer + start;
+        unsigned int rfs;
+        unsigned long duration;
+        *end = 0;
+        start = end + 1 - buffer;
+        if (line[0] == '#' || sscanf(line, "%u %lu", &rfs, &duration) != 2)
+            continue;
+        pulses[count].rfs = rfs ? 1 : 0;
+        pulses[count].duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+        count++;
+    }
+    memmove(buffer, buffer + start, used - start);
+    used -= start;
+    return count;
+}
+
+ssize_t FilePulseSource::read_pulses(Pulse *pulses, size_t max) {
+    size_t count = 0;
+    while ((count = parse_lines(pulses, max)) == 0 && !ended) {
+        if (used == sizeof(buffer))
+            used = 0;
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (fds[1].revents)
+            return 0;
+        ssize_t n = read(fd, buffer + used, sizeof(buffer) - used);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        used += n;
+        if (n == 0) {
+            /* The last line may have no newline. */
+            ended = true;
+            if (used > 0 && used < sizeof(buffer))
+                buffer[used++] = '\n';
+        }
+    }
+    return count;
+}
+
+void FilePulseSource::interrupt() {
+    uint64_t one = 1;
+    if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+        return;
+}
@@ -0,0 +1,79 @@
+#ifndef PULSESOURCE_H
+#define PULSESOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "../esp32/acumonitor.h"
+#include "realtime.h"
+
+#define GPIO_EVENT_BATCH    64  // Edge events fetched per read()
+#define FILE_BUFFER         4096    // Bytes of pulse text read at a time; longer lines are dropped
+
+/**
+ * Anything that produces pulses for the model parsers.
+ */
+class PulseSource {
+    public:
+        PulseSource() : jitter(NULL) { }
+        virtual ~PulseSource() { }
+        /**
+         * Blocks until at least one pulse is available.
+         *
+         * @param pulses receives up to max pulses
+         * @return number of pulses, 0 at end of input, -1 on error
+         */
+        virtual ssize_t read_pulses(Pulse *pulses, size_t max) = 0;
+        /** Makes a blocked read_pulses return 0; safe from another thread. */
+        virtual void interrupt() { }
+        JitterStats *jitter;    // Capture latency, recorded if set
+};
+
+/**
+ * Edge events from the Linux GPIO character device (uAPI v2). Each event
+ * carries a kernel timestamp, so durations are exact to the microsecond and
+ * do not depend on when userspace gets scheduled. Works the same on a
+ * gpio-sim chip.
+ */
+class GpioEventSource : public PulseSource {
+    public:
+        GpioEventSource(const char *chip, unsigned int pin);
+        ~GpioEventSource();
+        bool open_line();
+        ssize_t read_pulses(Pulse *pulses, size_t max) override;
+        void interrupt() override;
+        uint64_t dropped;       // Events lost to kernel buffer overflow
+    private:
+        const char *chip;
+        unsigned int pin;
+        int fd;
+        int wake_fd;            // eventfd signalled by interrupt()
+        uint64_t last_ns;       // Timestamp of the previous edge, 0 if none
+        uint32_t last_seqno;
+};
+
+/**
+ * Pulses read from a text file with one "rfs duration" pair per line, as
+ * passed to parse_rf. Lines starting with # are ignored. The file is read
+ * with read() rather than stdio, and only once poll() says so, so that a
+ * pipe or terminal with no pulses coming can be woken by interrupt().
+ */
+class FilePulseSource : public PulseSource {
+    public:
+        FilePulseSource(const char *path);
+        ~FilePulseSource();
+        bool open_file();
+        ssize_t read_pulses(Pulse *pulses, size_t max) override;
+        void interrupt() override;
+    private:
+        const char *path;
+        int fd;
+        int wake_fd;            // eventfd signalled by interrupt()
+        char buffer[FILE_BUFFER];
+        size_t used;            // Bytes in buffer, not yet parsed
+        bool ended;             // read() returned end of file
+        size_t parse_lines(Pulse *pulses, size_t max);
+};
+
+#endif
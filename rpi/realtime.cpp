@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "realtime.h"
+
+/**
+ * Pins the calling thread and sets its scheduling policy. Failures (e.g. no
+ * CAP_SYS_NICE in a container) are reported once and otherwise ignored, so
+ * capture always runs, just with more jitter.
+ *
+ * @return true if everything requested was applied
+ */
+bool rt_apply_thread(const ThreadConfig& config, const char *name) {
+    bool ok = true;
+    if (config.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            fprintf(stderr, "# %s: cannot pin to cpu %d: %s\n", name, config.cpu, strerror(err));
+            ok = false;
+        }
+    }
+    if (config.priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config.priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err) {
+            fprintf(stderr, "# %s: cannot set SCHED_FIFO %d: %s\n", name, config.priority, strerror(err));
+            ok = false;
+        }
+    }
+    rt_prefault_stack();
+    return ok;
+}
+
+/**
+ * Locks current and future pages so ring buffers and stacks never fault.
+ * Needs CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+ */
+bool rt_lock_memory() {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "# cannot lock memory: %s\n", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/** Touches every page of a buffer so it is resident before capture starts. */
+void rt_prefault(void *addr, size_t size) {
+    long page = sysconf(_SC_PAGESIZE);
+    volatile uint8_t *p = (volatile uint8_t *)addr;
+    for (size_t i = 0; i < size; i += page)
+        p[i] = p[i];
+    if (size)
+        p[size - 1] = p[size - 1];
+}
+
+/** Faults in the top RT_STACK_PREFAULT bytes of the calling thread's stack. */
+void rt_prefault_stack() {
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 256)
+        stack[i] = 0;
+}
+
+JitterStats::JitterStats(const char *name) {
+    this->name = name;
+    reset();
+}
+
+void JitterStats::record(uint64_t ns) {
+    int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (bucket >= JITTER_BUCKETS)
+        bucket = JITTER_BUCKETS - 1;
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(ns, std::memory_order_relaxed);
+    if (ns > max.load(std::memory_order_relaxed))
+        max.store(ns, std::memory_order_relaxed);
+}
+
+/**
+ * Prints count, mean, max and upper bounds for the 50th, 99th and 99.9th
+ * percentiles (bucketed to powers of two), in microseconds.
+ */
+void JitterStats::report(FILE *out) {
+    uint64_t n = count.load(std::memory_order_relaxed);
+    if (n == 0) {
+        fprintf(out, "# %s: no samples\n", name);
+        return;
+    }
+    const double quantiles[] = { 0.5, 0.99, 0.999 };
+    double bounds[3] = { 0, 0, 0 };
+    uint64_t seen = 0;
+    int q = 0;
+    for (int i = 0; i < JITTER_BUCKETS && q < 3; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        while (q < 3 && seen >= quantiles[q] * n)
+            bounds[q++] = (i ? (1ULL << i) : 1) / 1000.0;
+    }
+    fprintf(out, "# %s: n=%llu mean=%.1fus max=%.1fus p50<%.1fus p99<%.1fus p999<%.1fus\n",
+            name, (unsigned long long)n, sum.load() / 1000.0 / n, max.load() / 1000.0,
+            bounds[0], bounds[1], bounds[2]);
+}
+
+void JitterStats::reset() {
+    count = 0;
+    sum = 0;
+    max = 0;
+    for (int i = 0; i < JITTER_BUCKETS; i++)
+        buckets[i] = 0;
+}
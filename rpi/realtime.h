@@ -0,0 +1,42 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+
+#define RT_STACK_PREFAULT   (64 * 1024)     // Bytes of stack touched per thread
+#define JITTER_BUCKETS      32              // Power-of-two nanosecond buckets
+
+/* Scheduling for one capture path thread. */
+struct ThreadConfig {
+    int cpu = -1;               // Core to pin to, -1 for any
+    int priority = 0;           // SCHED_FIFO priority 1-99, 0 for SCHED_OTHER
+};
+
+bool rt_apply_thread(const ThreadConfig& config, const char *name);
+bool rt_lock_memory();
+void rt_prefault(void *addr, size_t size);
+void rt_prefault_stack();
+
+/**
+ * Latency distribution of a capture thread, e.g. edge event wakeup latency or
+ * the time taken by a block of register samples. Recorded from one thread and
+ * reported from any other.
+ */
+class JitterStats {
+    public:
+        JitterStats(const char *name);
+        void record(uint64_t ns);
+        void report(FILE *out);
+        void reset();
+    private:
+        const char *name;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> max;
+        std::atomic<uint32_t> buckets[JITTER_BUCKETS];
+};
+
+#endif